@@ -0,0 +1,162 @@
+#include "CanCapture.h"
+#include <string.h>
+
+static size_t writeVarint(uint32_t value, uint8_t *out) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t) value;
+    return length;
+}
+
+// returns the number of bytes read, 0 if the varint is truncated or too long
+static size_t readVarint(const uint8_t *in, size_t available, uint32_t *value) {
+    uint32_t result = 0;
+    for (size_t i = 0; i < available && i < 5; i++) {
+        result |= (uint32_t) (in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t canCaptureEncode(const CapturedFrame &frame, uint32_t previousTimestamp, uint8_t *out) {
+    uint8_t dlc = frame.dlc > 8 ? 8 : frame.dlc;
+    size_t length = writeVarint(frame.timestamp - previousTimestamp, out);
+    length += writeVarint(frame.identifier, out + length);
+    out[length++] = (frame.flags & 0x70) | dlc;
+    memcpy(out + length, frame.data, dlc);
+    return length + dlc;
+}
+
+size_t canCaptureRecordSize(const uint8_t *in, size_t available) {
+    uint32_t ignored;
+    size_t length = readVarint(in, available, &ignored);
+    if (length == 0) {
+        return 0;
+    }
+    size_t identifierLength = readVarint(in + length, available - length, &ignored);
+    if (identifierLength == 0) {
+        return 0;
+    }
+    length += identifierLength;
+    if (length >= available) {
+        return 0;
+    }
+    uint8_t dlc = in[length++] & 0x0F;
+    length += dlc > 8 ? 8 : dlc;
+    return length <= available ? length : 0;
+}
+
+void canCaptureWriteHeader(uint8_t *out, uint32_t baseTimestamp) {
+    out[0] = 'R';
+    out[1] = 'C';
+    out[2] = 'A';
+    out[3] = 'P';
+    out[4] = CAN_CAPTURE_VERSION;
+    out[5] = out[6] = out[7] = 0;
+    for (int i = 0; i < 4; i++) {
+        out[8 + i] = (uint8_t) (baseTimestamp >> (8 * i));
+    }
+}
+
+CanCaptureRing::CanCaptureRing(uint8_t *storage, size_t capacity) : storage(storage), capacity(capacity) {}
+
+void CanCaptureRing::clear() {
+    head = tail = used = 0;
+    recordCount = evictedCount = 0;
+    empty = true;
+}
+
+void CanCaptureRing::evictOldest() {
+    uint8_t record[CAN_CAPTURE_MAX_RECORD_SIZE];
+    size_t available = used < CAN_CAPTURE_MAX_RECORD_SIZE ? used : CAN_CAPTURE_MAX_RECORD_SIZE;
+    for (size_t i = 0; i < available; i++) {
+        record[i] = peek(i);
+    }
+    size_t length = canCaptureRecordSize(record, available);
+    if (length == 0) {
+        // can't happen unless the ring got corrupted, start over
+        clear();
+        return;
+    }
+    uint32_t delta;
+    readVarint(record, available, &delta);
+    baseTimestamp += delta;
+    tail = (tail + length) % capacity;
+    used -= length;
+    recordCount--;
+    evictedCount++;
+}
+
+void CanCaptureRing::append(const CapturedFrame &frame) {
+    if (empty) {
+        baseTimestamp = frame.timestamp;
+        lastTimestamp = frame.timestamp;
+        empty = false;
+    }
+    uint8_t record[CAN_CAPTURE_MAX_RECORD_SIZE];
+    size_t length = canCaptureEncode(frame, lastTimestamp, record);
+    if (length > capacity) {
+        return;
+    }
+    while (capacity - used < length) {
+        evictOldest();
+    }
+    for (size_t i = 0; i < length; i++) {
+        storage[(head + i) % capacity] = record[i];
+    }
+    head = (head + length) % capacity;
+    used += length;
+    recordCount++;
+    lastTimestamp = frame.timestamp;
+}
+
+size_t CanCaptureRing::copyTo(uint8_t *out, size_t size, size_t offset) const {
+    uint8_t header[CAN_CAPTURE_HEADER_SIZE];
+    canCaptureWriteHeader(header, baseTimestamp);
+    size_t copied = 0;
+    for (; copied < size && offset < CAN_CAPTURE_HEADER_SIZE + used; copied++, offset++) {
+        out[copied] = offset < CAN_CAPTURE_HEADER_SIZE ? header[offset] : peek(offset - CAN_CAPTURE_HEADER_SIZE);
+    }
+    return copied;
+}
+
+CanCaptureReader::CanCaptureReader(const uint8_t *capture, size_t length) : capture(capture), length(length) {
+    headerValid = length >= CAN_CAPTURE_HEADER_SIZE && memcmp(capture, "RCAP", 4) == 0 &&
+                  capture[4] == CAN_CAPTURE_VERSION;
+    if (headerValid) {
+        timestamp = capture[8] | (capture[9] << 8) | (capture[10] << 16) | ((uint32_t) capture[11] << 24);
+    }
+}
+
+bool CanCaptureReader::next(CapturedFrame *frame) {
+    if (!headerValid || position >= length) {
+        return false;
+    }
+    const uint8_t *in = capture + position;
+    size_t available = length - position;
+    size_t recordLength = canCaptureRecordSize(in, available);
+    if (recordLength == 0) {
+        return false;
+    }
+    uint32_t delta;
+    size_t index = readVarint(in, available, &delta);
+    index += readVarint(in + index, available - index, &frame->identifier);
+    timestamp += delta;
+    frame->timestamp = timestamp;
+    frame->flags = in[index] & 0x70;
+    frame->dlc = in[index] & 0x0F;
+    if (frame->dlc > 8) {
+        frame->dlc = 8;
+    }
+    index++;
+    memset(frame->data, 0, sizeof(frame->data));
+    memcpy(frame->data, in + index, frame->dlc);
+    position += recordLength;
+    return true;
+}
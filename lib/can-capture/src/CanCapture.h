@@ -0,0 +1,89 @@
+#ifndef RESCUE_CANCAPTURE_H
+#define RESCUE_CANCAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+  Compact binary capture of CAN frames, shared by the firmware recorder and the native replay
+  tests. A capture is a header followed by variable length records:
+
+    header: 'R' 'C' 'A' 'P', version (1 byte), 3 reserved bytes, base timestamp (uint32 LE, us)
+    record: timestamp delta to the previous record (varint, us)
+            identifier (varint)
+            flags: bits 0-3 DLC, bit 4 extended, bit 5 RTR, bit 6 sent by us
+            payload (DLC bytes)
+
+  The first record's delta refers to the base timestamp. A full VESC status frame takes 12-13 bytes.
+*/
+
+#define CAN_CAPTURE_VERSION 1
+#define CAN_CAPTURE_HEADER_SIZE 12
+#define CAN_CAPTURE_MAX_RECORD_SIZE 19 // 5 + 5 + 1 + 8
+
+#define CAN_CAPTURE_FLAG_EXTD 0x10
+#define CAN_CAPTURE_FLAG_RTR 0x20
+#define CAN_CAPTURE_FLAG_TX 0x40
+
+struct CapturedFrame {
+    uint32_t timestamp; // us, absolute
+    uint32_t identifier;
+    uint8_t flags;      // see CAN_CAPTURE_FLAG_*, the DLC is in dlc
+    uint8_t dlc;
+    uint8_t data[8];
+};
+
+// encodes one record, returns its size, out must hold CAN_CAPTURE_MAX_RECORD_SIZE bytes
+size_t canCaptureEncode(const CapturedFrame &frame, uint32_t previousTimestamp, uint8_t *out);
+// size of the record starting at in, 0 if it is truncated
+size_t canCaptureRecordSize(const uint8_t *in, size_t available);
+void canCaptureWriteHeader(uint8_t *out, uint32_t baseTimestamp);
+
+/*
+  Fixed size byte ring holding the most recent records. When a new record doesn't fit, the
+  oldest ones are evicted, the base timestamp moves along so the remaining deltas stay valid.
+*/
+class CanCaptureRing {
+  public:
+    CanCaptureRing(uint8_t *storage, size_t capacity);
+    void append(const CapturedFrame &frame);
+    void clear();
+    // copies up to size bytes of the serialized capture (header + records) starting at offset
+    size_t copyTo(uint8_t *out, size_t size, size_t offset = 0) const;
+    size_t captureSize() const { return CAN_CAPTURE_HEADER_SIZE + used; }
+    uint32_t records() const { return recordCount; }
+    uint32_t evicted() const { return evictedCount; }
+
+  private:
+    uint8_t *storage;
+    size_t capacity;
+    size_t head = 0; // next write position
+    size_t tail = 0; // oldest record
+    size_t used = 0;
+    uint32_t baseTimestamp = 0; // time of the last evicted record, start of the oldest delta
+    uint32_t lastTimestamp = 0;
+    uint32_t recordCount = 0;
+    uint32_t evictedCount = 0;
+    bool empty = true;
+    uint8_t peek(size_t offset) const { return storage[(tail + offset) % capacity]; }
+    void evictOldest();
+};
+
+/*
+  Iterates over the records of a capture in memory.
+*/
+class CanCaptureReader {
+  public:
+    CanCaptureReader(const uint8_t *capture, size_t length);
+    bool valid() const { return headerValid; }
+    bool next(CapturedFrame *frame);
+
+  private:
+    const uint8_t *capture;
+    size_t length;
+    size_t position = CAN_CAPTURE_HEADER_SIZE;
+    uint32_t timestamp = 0;
+    bool headerValid = false;
+};
+
+#endif //RESCUE_CANCAPTURE_H
@@ -0,0 +1,38 @@
+#include "Arduino.h"
+#include "NativeClock.h"
+
+static uint64_t clockMicros = 0;
+
+uint64_t NativeClock::now() {
+    return clockMicros;
+}
+
+void NativeClock::advance(uint64_t micros) {
+    clockMicros += micros;
+}
+
+void NativeClock::advanceTo(uint64_t time) {
+    if (time > clockMicros) {
+        clockMicros = time;
+    }
+}
+
+void NativeClock::reset() {
+    clockMicros = 0;
+}
+
+unsigned long millis() {
+    return clockMicros / 1000;
+}
+
+unsigned long micros() {
+    return clockMicros;
+}
+
+void delay(unsigned long ms) {
+    clockMicros += (uint64_t) ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+    clockMicros += us;
+}
@@ -0,0 +1,93 @@
+#ifndef RESCUE_NATIVE_ARDUINO_H
+#define RESCUE_NATIVE_ARDUINO_H
+
+/*
+  The part of the Arduino core the CAN modules use, so they build in env:native.
+  Time comes from NativeClock.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+#define log_e(format, ...) printf("[E] " format "\n", ##__VA_ARGS__)
+#define log_n(format, ...) printf("[N] " format "\n", ##__VA_ARGS__)
+
+class String {
+  public:
+    String(const char *value = "") : value(value != nullptr ? value : "") {}
+    String(const std::string &value) : value(value) {}
+    String &operator=(const char *other) {
+        value = other != nullptr ? other : "";
+        return *this;
+    }
+    const char *c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.size(); }
+    unsigned char concat(const char *other) {
+        value += other;
+        return 1;
+    }
+    String &operator+=(const char *other) {
+        value += other;
+        return *this;
+    }
+    String &operator+=(const String &other) {
+        value += other.value;
+        return *this;
+    }
+    bool operator==(const char *other) const { return value == other; }
+    bool operator==(const String &other) const { return value == other.value; }
+    bool equals(const char *other) const { return value == other; }
+
+  private:
+    std::string value;
+};
+
+class Print {
+  public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t written = 0;
+        while (written < size && write(buffer[written]) == 1) {
+            written++;
+        }
+        return written;
+    }
+    size_t print(const char *text) { return write((const uint8_t *) text, strlen(text)); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+    size_t readBytes(uint8_t *buffer, size_t length) {
+        size_t count = 0;
+        while (count < length && available() > 0) {
+            buffer[count++] = read();
+        }
+        return count;
+    }
+};
+
+#endif //RESCUE_NATIVE_ARDUINO_H
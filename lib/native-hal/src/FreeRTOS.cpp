@@ -0,0 +1,86 @@
+#include "Arduino.h"
+#include "NativeClock.h"
+#include <deque>
+#include <vector>
+
+namespace {
+    struct NativeQueue {
+        UBaseType_t length;
+        UBaseType_t itemSize;
+        std::deque<std::vector<uint8_t>> items;
+    };
+
+    struct NativeMutex {
+        int count;
+    };
+
+    int taskCount = 0;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    // any non-null handle will do, it is only compared and passed back to us
+    taskCount++;
+    if (handle != nullptr) {
+        *handle = (TaskHandle_t) (intptr_t) taskCount;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+    return 0;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    NativeClock::advance((uint64_t) ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t) (NativeClock::now() / 1000 / portTICK_PERIOD_MS);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    return new NativeQueue{length, itemSize, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t ticksToWait) {
+    auto *queue = static_cast<NativeQueue *>(handle);
+    if (queue->items.size() >= queue->length) {
+        return pdFALSE;
+    }
+    const auto *bytes = static_cast<const uint8_t *>(item);
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t ticksToWait) {
+    auto *queue = static_cast<NativeQueue *>(handle);
+    if (queue->items.empty()) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle) {
+    return static_cast<NativeQueue *>(handle)->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new NativeMutex{0};
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+    static_cast<NativeMutex *>(semaphore)->count++;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    static_cast<NativeMutex *>(semaphore)->count--;
+    return pdTRUE;
+}
@@ -0,0 +1,50 @@
+#include "Logger.h"
+#include <stdio.h>
+
+Logger::Level Logger::level = Logger::NOTICE;
+Logger::LoggerOutputFunction Logger::output = Logger::defaultOutput;
+
+void Logger::setLogLevel(Level level) {
+    Logger::level = level;
+}
+
+Logger::Level Logger::getLogLevel() {
+    return level;
+}
+
+void Logger::log(Level level, const char *module, const char *message) {
+    if (level >= Logger::level && Logger::level != SILENT) {
+        output(level, module, message);
+    }
+}
+
+void Logger::verbose(const char *module, const char *message) { log(VERBOSE, module, message); }
+void Logger::verbose(const char *message) { log(VERBOSE, "", message); }
+void Logger::notice(const char *module, const char *message) { log(NOTICE, module, message); }
+void Logger::notice(const char *message) { log(NOTICE, "", message); }
+void Logger::warning(const char *module, const char *message) { log(WARNING, module, message); }
+void Logger::warning(const char *message) { log(WARNING, "", message); }
+void Logger::error(const char *module, const char *message) { log(ERROR, module, message); }
+void Logger::error(const char *message) { log(ERROR, "", message); }
+void Logger::fatal(const char *module, const char *message) { log(FATAL, module, message); }
+void Logger::fatal(const char *message) { log(FATAL, "", message); }
+
+void Logger::setOutputFunction(LoggerOutputFunction function) {
+    output = function != nullptr ? function : defaultOutput;
+}
+
+const char *Logger::asString(Level level) {
+    switch (level) {
+        case VERBOSE: return "VERBOSE";
+        case NOTICE: return "NOTICE";
+        case WARNING: return "WARNING";
+        case ERROR: return "ERROR";
+        case FATAL: return "FATAL";
+        case SILENT: return "SILENT";
+    }
+    return "";
+}
+
+void Logger::defaultOutput(Level level, const char *module, const char *message) {
+    printf("[%s] %s: %s\n", asString(level), module, message);
+}
@@ -0,0 +1,40 @@
+#ifndef RESCUE_NATIVE_LOGGER_H
+#define RESCUE_NATIVE_LOGGER_H
+
+// same interface as bakercp/Logger, which only builds for Arduino targets
+class Logger {
+  public:
+    enum Level {
+        VERBOSE = 0,
+        NOTICE,
+        WARNING,
+        ERROR,
+        FATAL,
+        SILENT
+    };
+
+    typedef void (*LoggerOutputFunction)(Level level, const char *module, const char *message);
+
+    static void setLogLevel(Level level);
+    static Level getLogLevel();
+    static void log(Level level, const char *module, const char *message);
+    static void verbose(const char *module, const char *message);
+    static void verbose(const char *message);
+    static void notice(const char *module, const char *message);
+    static void notice(const char *message);
+    static void warning(const char *module, const char *message);
+    static void warning(const char *message);
+    static void error(const char *module, const char *message);
+    static void error(const char *message);
+    static void fatal(const char *module, const char *message);
+    static void fatal(const char *message);
+    static void setOutputFunction(LoggerOutputFunction function);
+    static const char *asString(Level level);
+
+  private:
+    static Level level;
+    static LoggerOutputFunction output;
+    static void defaultOutput(Level level, const char *module, const char *message);
+};
+
+#endif //RESCUE_NATIVE_LOGGER_H
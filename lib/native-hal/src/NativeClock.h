@@ -0,0 +1,19 @@
+#ifndef RESCUE_NATIVECLOCK_H
+#define RESCUE_NATIVECLOCK_H
+
+#include <stdint.h>
+
+/*
+  Simulated time behind millis() and micros() on the host. Nothing advances it except
+  SimulatedBus::run(), delay() and vTaskDelay(), so a test runs as fast as the host allows
+  and is still reproducible.
+*/
+namespace NativeClock {
+    uint64_t now();
+    void advance(uint64_t micros);
+    // moves the clock forward to time, never backwards
+    void advanceTo(uint64_t time);
+    void reset();
+}
+
+#endif //RESCUE_NATIVECLOCK_H
@@ -0,0 +1,32 @@
+#ifndef RESCUE_NATIVE_PREFERENCES_H
+#define RESCUE_NATIVE_PREFERENCES_H
+
+#include "Arduino.h"
+#include <map>
+
+// in memory, nothing survives the test process
+class Preferences {
+  public:
+    bool begin(const char *name, bool readOnly = false) {
+        space = name;
+        return true;
+    }
+    void end() {}
+    String getString(const char *key, const String &defaultValue = String()) {
+        auto entry = values().find(space + "/" + key);
+        return entry == values().end() ? defaultValue : String(entry->second);
+    }
+    size_t putString(const char *key, const String &value) {
+        values()[space + "/" + key] = value.c_str();
+        return value.length();
+    }
+
+  private:
+    std::string space;
+    static std::map<std::string, std::string> &values() {
+        static std::map<std::string, std::string> stored;
+        return stored;
+    }
+};
+
+#endif //RESCUE_NATIVE_PREFERENCES_H
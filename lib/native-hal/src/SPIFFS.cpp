@@ -0,0 +1,33 @@
+#include "SPIFFS.h"
+
+SPIFFSFS SPIFFS;
+
+size_t File::write(const uint8_t *buffer, size_t size) {
+    if (content == nullptr || !writable) {
+        return 0;
+    }
+    content->insert(content->end(), buffer, buffer + size);
+    return size;
+}
+
+size_t File::read(uint8_t *buffer, size_t size) {
+    if (content == nullptr) {
+        return 0;
+    }
+    size_t count = std::min(size, content->size() - position);
+    memcpy(buffer, content->data() + position, count);
+    position += count;
+    return count;
+}
+
+File SPIFFSFS::open(const char *path, const char *mode) {
+    bool writing = mode[0] == 'w' || mode[0] == 'a';
+    if (!writing && !exists(path)) {
+        return File();
+    }
+    std::vector<uint8_t> &content = files[path];
+    if (mode[0] == 'w') {
+        content.clear();
+    }
+    return File(&content, writing);
+}
@@ -0,0 +1,44 @@
+#ifndef RESCUE_NATIVE_SPIFFS_H
+#define RESCUE_NATIVE_SPIFFS_H
+
+#include "Arduino.h"
+#include <map>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+// a file of the in-memory SPIFFS below
+class File {
+  public:
+    File() = default;
+    File(std::vector<uint8_t> *content, bool writable) : content(content), writable(writable) {}
+    explicit operator bool() const { return content != nullptr; }
+    size_t write(const uint8_t *buffer, size_t size);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t read(uint8_t *buffer, size_t size);
+    int available() const { return content == nullptr ? 0 : content->size() - position; }
+    size_t size() const { return content == nullptr ? 0 : content->size(); }
+    void close() { content = nullptr; }
+
+  private:
+    std::vector<uint8_t> *content = nullptr;
+    bool writable = false;
+    size_t position = 0;
+};
+
+class SPIFFSFS {
+  public:
+    bool begin(bool formatOnFail = false) { return true; }
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path) const { return files.count(path) > 0; }
+    bool remove(const char *path) { return files.erase(path) > 0; }
+
+  private:
+    std::map<std::string, std::vector<uint8_t>> files;
+};
+
+extern SPIFFSFS SPIFFS;
+
+#endif //RESCUE_NATIVE_SPIFFS_H
@@ -0,0 +1,133 @@
+#include "SimulatedBus.h"
+
+SimulatedBus::SimulatedBus() {
+    nodes.push_back({&twai, {}});
+}
+
+SimulatedBus &SimulatedBus::instance() {
+    static SimulatedBus bus;
+    return bus;
+}
+
+void SimulatedBus::attach(SimulatedNode *node) {
+    nodes.push_back({node, {}});
+}
+
+void SimulatedBus::reset() {
+    nodes.resize(1);
+    nodes[0].queue.clear();
+    twai.reset();
+    busy = false;
+    bitrate = SIMULATED_BUS_BITRATE;
+    framesTransmitted = 0;
+    busyTime = 0;
+    NativeClock::reset();
+}
+
+SimulatedBus::Attached *SimulatedBus::find(const SimulatedNode *node) {
+    for (auto &attached : nodes) {
+        if (attached.node == node) {
+            return &attached;
+        }
+    }
+    return nullptr;
+}
+
+void SimulatedBus::send(SimulatedNode *sender, const twai_message_t &frame, uint64_t readyAt) {
+    Attached *attached = find(sender);
+    if (attached == nullptr) {
+        return;
+    }
+    PendingFrame pending = {frame, readyAt};
+    // the identifier registers only have 29 bits, anything above is lost
+    pending.frame.identifier &= frame.extd ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK;
+    attached->queue.push_back(pending);
+}
+
+size_t SimulatedBus::pending(const SimulatedNode *sender) const {
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].node == sender) {
+            return nodes[i].queue.size() + (busy && currentSender == i ? 1 : 0);
+        }
+    }
+    return 0;
+}
+
+void SimulatedBus::clearPending(const SimulatedNode *sender) {
+    Attached *attached = find(sender);
+    if (attached != nullptr) {
+        attached->queue.clear();
+    }
+}
+
+// start of frame, arbitration, control, CRC, ACK and EOF fields, the payload, ~10% stuff bits, interframe space
+uint64_t SimulatedBus::frameTime(const twai_message_t &frame) const {
+    if (bitrate == 0) {
+        return 0;
+    }
+    uint8_t dlc = frame.data_length_code > 8 ? 8 : frame.data_length_code;
+    uint32_t bits = frame.extd ? 67 + 8 * dlc + (54 + 8 * dlc) / 10 : 47 + 8 * dlc + (34 + 8 * dlc) / 10;
+    return ((uint64_t) bits * 1000000 + bitrate - 1) / bitrate;
+}
+
+// picks the next frame to go on the bus, false if none is ready before until
+boolean SimulatedBus::arbitrate(uint64_t until) {
+    uint64_t start = UINT64_MAX;
+    for (auto &attached : nodes) {
+        if (!attached.queue.empty() && attached.queue.front().readyAt < start) {
+            start = attached.queue.front().readyAt;
+        }
+    }
+    if (start == UINT64_MAX) {
+        return false;
+    }
+    if (start < NativeClock::now()) {
+        start = NativeClock::now();
+    }
+    if (start > until) {
+        return false;
+    }
+    int winner = -1;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].queue.empty() || nodes[i].queue.front().readyAt > start) {
+            continue;
+        }
+        if (winner < 0 || nodes[i].queue.front().frame.identifier < nodes[winner].queue.front().frame.identifier) {
+            winner = i;
+        }
+    }
+    current = nodes[winner].queue.front().frame;
+    nodes[winner].queue.pop_front();
+    currentSender = winner;
+    currentEnd = start + frameTime(current);
+    busyTime += currentEnd - start;
+    busy = true;
+    return true;
+}
+
+void SimulatedBus::run(uint64_t micros) {
+    uint64_t until = NativeClock::now() + micros;
+    for (auto &attached : nodes) {
+        attached.node->update(*this, until);
+    }
+    for (;;) {
+        if (!busy && !arbitrate(until)) {
+            break;
+        }
+        if (currentEnd > until) {
+            // still on the bus, completes in a later run()
+            break;
+        }
+        NativeClock::advanceTo(currentEnd);
+        busy = false;
+        framesTransmitted++;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (i == currentSender) {
+                nodes[i].node->transmitted(*this, current, currentEnd);
+            } else {
+                nodes[i].node->receive(*this, current, currentEnd);
+            }
+        }
+    }
+    NativeClock::advanceTo(until);
+}
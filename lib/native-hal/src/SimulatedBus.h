@@ -0,0 +1,113 @@
+#ifndef RESCUE_SIMULATEDBUS_H
+#define RESCUE_SIMULATEDBUS_H
+
+#include "Arduino.h"
+#include "NativeClock.h"
+#include "driver/twai.h"
+#include <deque>
+#include <vector>
+
+#ifndef SIMULATED_BUS_BITRATE
+#define SIMULATED_BUS_BITRATE 500000
+#endif //SIMULATED_BUS_BITRATE
+
+class SimulatedBus;
+
+// something attached to the bus: the TWAI controller of the ESP or a fake VESC
+class SimulatedNode {
+  public:
+    virtual ~SimulatedNode() = default;
+    // a frame of another node finished transmission at now
+    virtual void receive(SimulatedBus &bus, const twai_message_t &frame, uint64_t now) {}
+    // one of our own frames finished transmission at now
+    virtual void transmitted(SimulatedBus &bus, const twai_message_t &frame, uint64_t now) {}
+    // queue the frames the node sends on its own (status broadcasts) up to until
+    virtual void update(SimulatedBus &bus, uint64_t until) {}
+};
+
+/*
+  The controller behind the twai_* functions. Applies the acceptance filter like the hardware
+  does for extended frames in single filter mode, drops frames when the RX queue is full and
+  reports the same alerts and status counters the IDF driver does.
+*/
+class SimulatedTwai : public SimulatedNode {
+  public:
+    esp_err_t install(const twai_general_config_t &general, const twai_filter_config_t &filter);
+    esp_err_t uninstall();
+    esp_err_t start();
+    esp_err_t stop();
+    esp_err_t transmit(const twai_message_t &message);
+    esp_err_t take(twai_message_t *message);
+    esp_err_t readAlerts(uint32_t *alerts);
+    esp_err_t reconfigureAlerts(uint32_t enabled, uint32_t *current);
+    esp_err_t initiateRecovery();
+    esp_err_t getStatus(twai_status_info_t *status);
+    esp_err_t clearTransmitQueue();
+    esp_err_t clearReceiveQueue();
+    // puts the controller into bus-off, as after too many transmit errors
+    void busOff();
+    void reset();
+    boolean accepts(const twai_message_t &frame) const;
+    void receive(SimulatedBus &bus, const twai_message_t &frame, uint64_t now) override;
+    void transmitted(SimulatedBus &bus, const twai_message_t &frame, uint64_t now) override;
+
+  private:
+    boolean installed = false;
+    twai_state_t state = TWAI_STATE_STOPPED;
+    twai_general_config_t general = {};
+    twai_filter_config_t filter = {};
+    std::deque<twai_message_t> rxQueue;
+    uint32_t alerts = 0;
+    uint32_t txFailed = 0;
+    uint32_t rxMissed = 0;
+    void raise(uint32_t alert) { alerts |= alert & general.alerts_enabled; }
+};
+
+/*
+  A CAN bus in simulated time. Nodes queue frames with the time they become ready, run()
+  transmits them one after the other like the real bus would: when several are ready, the
+  lowest identifier wins arbitration, each frame occupies the bus for its length in bits at
+  the configured bitrate, and every other node receives it once it is complete. Every node
+  sends its own frames in order, like a controller with a single transmit buffer.
+*/
+class SimulatedBus {
+  public:
+    SimulatedBus();
+    static SimulatedBus &instance();
+    void attach(SimulatedNode *node);
+    // detaches all nodes except twai, drops queued frames and resets statistics and the clock
+    void reset();
+    void send(SimulatedNode *sender, const twai_message_t &frame, uint64_t readyAt);
+    // frames of sender not yet completely transmitted, including the one on the bus
+    size_t pending(const SimulatedNode *sender) const;
+    void clearPending(const SimulatedNode *sender);
+    // advances NativeClock by micros, transmitting whatever is due meanwhile
+    void run(uint64_t micros);
+    // 0 makes frames take no bus time at all
+    void setBitrate(uint32_t bitsPerSecond) { bitrate = bitsPerSecond; }
+    uint64_t frameTime(const twai_message_t &frame) const;
+
+    SimulatedTwai twai;
+    uint64_t framesTransmitted = 0;
+    uint64_t busyTime = 0; // us the bus was occupied
+
+  private:
+    struct PendingFrame {
+        twai_message_t frame;
+        uint64_t readyAt;
+    };
+    struct Attached {
+        SimulatedNode *node;
+        std::deque<PendingFrame> queue;
+    };
+    std::vector<Attached> nodes;
+    uint32_t bitrate = SIMULATED_BUS_BITRATE;
+    boolean busy = false;
+    size_t currentSender = 0;
+    twai_message_t current = {};
+    uint64_t currentEnd = 0;
+    Attached *find(const SimulatedNode *node);
+    boolean arbitrate(uint64_t until);
+};
+
+#endif //RESCUE_SIMULATEDBUS_H
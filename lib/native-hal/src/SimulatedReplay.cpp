@@ -0,0 +1,41 @@
+#include "SimulatedReplay.h"
+
+SimulatedReplay::SimulatedReplay(const uint8_t *capture, size_t length, uint64_t start)
+        : reader(capture, length), offset(start) {
+}
+
+// next received frame into next, done when there is none
+void SimulatedReplay::advance() {
+    while (reader.next(&next)) {
+        if (!(next.flags & CAN_CAPTURE_FLAG_TX)) {
+            haveNext = true;
+            return;
+        }
+    }
+    haveNext = false;
+    done = true;
+}
+
+void SimulatedReplay::update(SimulatedBus &bus, uint64_t until) {
+    if (!started) {
+        started = true;
+        offset += NativeClock::now();
+        advance();
+        firstTimestamp = next.timestamp;
+    }
+    while (haveNext) {
+        uint64_t at = offset + (uint32_t) (next.timestamp - firstTimestamp);
+        if (at > until) {
+            return;
+        }
+        twai_message_t frame = {};
+        frame.extd = (next.flags & CAN_CAPTURE_FLAG_EXTD) != 0;
+        frame.rtr = (next.flags & CAN_CAPTURE_FLAG_RTR) != 0;
+        frame.identifier = next.identifier;
+        frame.data_length_code = next.dlc;
+        memcpy(frame.data, next.data, sizeof(frame.data));
+        bus.send(this, frame, at);
+        framesReplayed++;
+        advance();
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef RESCUE_SIMULATEDREPLAY_H
+#define RESCUE_SIMULATEDREPLAY_H
+
+#include "SimulatedBus.h"
+#include "CanCapture.h"
+
+/*
+  Plays the received frames of a capture written by CanRecorder back onto the SimulatedBus,
+  at the same distances as they were recorded. The frames we sent ourselves are skipped,
+  the firmware under test sends its own.
+*/
+class SimulatedReplay : public SimulatedNode {
+  public:
+    // capture must stay valid until replayed, frames start start us after attaching
+    SimulatedReplay(const uint8_t *capture, size_t length, uint64_t start = 0);
+    boolean valid() const { return reader.valid(); }
+    boolean finished() const { return done; }
+    uint32_t framesReplayed = 0;
+    void update(SimulatedBus &bus, uint64_t until) override;
+
+  private:
+    CanCaptureReader reader;
+    CapturedFrame next = {};
+    boolean haveNext = false;
+    boolean done = false;
+    boolean started = false;
+    uint64_t offset;
+    uint32_t firstTimestamp = 0;
+    void advance();
+};
+
+#endif //RESCUE_SIMULATEDREPLAY_H
@@ -0,0 +1,236 @@
+#include "SimulatedBus.h"
+
+esp_err_t SimulatedTwai::install(const twai_general_config_t &general, const twai_filter_config_t &filter) {
+    if (installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (general.tx_queue_len == 0 || general.rx_queue_len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    this->general = general;
+    this->filter = filter;
+    installed = true;
+    state = TWAI_STATE_STOPPED;
+    alerts = 0;
+    rxQueue.clear();
+    return ESP_OK;
+}
+
+esp_err_t SimulatedTwai::uninstall() {
+    if (!installed || (state != TWAI_STATE_STOPPED && state != TWAI_STATE_BUS_OFF)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    installed = false;
+    rxQueue.clear();
+    SimulatedBus::instance().clearPending(this);
+    return ESP_OK;
+}
+
+esp_err_t SimulatedTwai::start() {
+    if (!installed || state != TWAI_STATE_STOPPED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    state = TWAI_STATE_RUNNING;
+    return ESP_OK;
+}
+
+// like the IDF driver, stopping drops whatever waits in the transmit queue
+esp_err_t SimulatedTwai::stop() {
+    if (!installed || state != TWAI_STATE_RUNNING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    state = TWAI_STATE_STOPPED;
+    SimulatedBus::instance().clearPending(this);
+    return ESP_OK;
+}
+
+esp_err_t SimulatedTwai::transmit(const twai_message_t &message) {
+    if (!installed || state != TWAI_STATE_RUNNING || general.mode == TWAI_MODE_LISTEN_ONLY) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (message.data_length_code > TWAI_FRAME_MAX_DLC) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    SimulatedBus &bus = SimulatedBus::instance();
+    if (bus.pending(this) >= general.tx_queue_len) {
+        // a zero timeout, the queue stays full
+        return ESP_ERR_TIMEOUT;
+    }
+    bus.send(this, message, NativeClock::now());
+    return ESP_OK;
+}
+
+esp_err_t SimulatedTwai::take(twai_message_t *message) {
+    if (!installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (rxQueue.empty()) {
+        return ESP_ERR_TIMEOUT;
+    }
+    *message = rxQueue.front();
+    rxQueue.pop_front();
+    return ESP_OK;
+}
+
+esp_err_t SimulatedTwai::readAlerts(uint32_t *alerts) {
+    if (!installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *alerts = this->alerts;
+    this->alerts = 0;
+    return *alerts != 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t SimulatedTwai::reconfigureAlerts(uint32_t enabled, uint32_t *current) {
+    if (!installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    general.alerts_enabled = enabled;
+    if (current != nullptr) {
+        *current = alerts;
+    }
+    alerts &= enabled;
+    return ESP_OK;
+}
+
+// the hardware needs 128 occurrences of 11 recessive bits, here recovery completes right away
+esp_err_t SimulatedTwai::initiateRecovery() {
+    if (!installed || state != TWAI_STATE_BUS_OFF) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    state = TWAI_STATE_STOPPED;
+    raise(TWAI_ALERT_BUS_RECOVERED);
+    return ESP_OK;
+}
+
+esp_err_t SimulatedTwai::getStatus(twai_status_info_t *status) {
+    if (!installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *status = {};
+    status->state = state;
+    status->msgs_to_tx = SimulatedBus::instance().pending(this);
+    status->msgs_to_rx = rxQueue.size();
+    status->tx_failed_count = txFailed;
+    status->rx_missed_count = rxMissed;
+    return ESP_OK;
+}
+
+esp_err_t SimulatedTwai::clearTransmitQueue() {
+    if (!installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    SimulatedBus::instance().clearPending(this);
+    return ESP_OK;
+}
+
+esp_err_t SimulatedTwai::clearReceiveQueue() {
+    if (!installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    rxQueue.clear();
+    return ESP_OK;
+}
+
+void SimulatedTwai::busOff() {
+    if (!installed || state != TWAI_STATE_RUNNING) {
+        return;
+    }
+    SimulatedBus &bus = SimulatedBus::instance();
+    txFailed += bus.pending(this);
+    bus.clearPending(this);
+    state = TWAI_STATE_BUS_OFF;
+    raise(TWAI_ALERT_BUS_OFF);
+}
+
+void SimulatedTwai::reset() {
+    installed = false;
+    state = TWAI_STATE_STOPPED;
+    rxQueue.clear();
+    alerts = 0;
+    txFailed = 0;
+    rxMissed = 0;
+}
+
+// single filter mode, see the TWAI chapter of the ESP32 technical reference manual
+boolean SimulatedTwai::accepts(const twai_message_t &frame) const {
+    if (!filter.single_filter) {
+        // dual filter mode isn't used by this firmware, let everything pass
+        return true;
+    }
+    uint32_t bits = frame.extd
+            ? (frame.identifier << 3) | (frame.rtr << 2)
+            : (frame.identifier << 21) | (frame.rtr << 20) | (frame.data[0] << 8) | frame.data[1];
+    return ((bits ^ filter.acceptance_code) & ~filter.acceptance_mask) == 0;
+}
+
+void SimulatedTwai::receive(SimulatedBus &bus, const twai_message_t &frame, uint64_t now) {
+    if (!installed || state != TWAI_STATE_RUNNING || !accepts(frame)) {
+        return;
+    }
+    if (rxQueue.size() >= general.rx_queue_len) {
+        rxMissed++;
+        raise(TWAI_ALERT_RX_QUEUE_FULL);
+        return;
+    }
+    rxQueue.push_back(frame);
+}
+
+void SimulatedTwai::transmitted(SimulatedBus &bus, const twai_message_t &frame, uint64_t now) {
+    raise(TWAI_ALERT_TX_SUCCESS);
+    if (bus.pending(this) == 0) {
+        raise(TWAI_ALERT_TX_IDLE);
+    }
+}
+
+esp_err_t twai_driver_install(const twai_general_config_t *g_config, const twai_timing_config_t *t_config,
+                              const twai_filter_config_t *f_config) {
+    if (g_config == nullptr || t_config == nullptr || f_config == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return SimulatedBus::instance().twai.install(*g_config, *f_config);
+}
+
+esp_err_t twai_driver_uninstall() {
+    return SimulatedBus::instance().twai.uninstall();
+}
+
+esp_err_t twai_start() {
+    return SimulatedBus::instance().twai.start();
+}
+
+esp_err_t twai_stop() {
+    return SimulatedBus::instance().twai.stop();
+}
+
+esp_err_t twai_transmit(const twai_message_t *message, TickType_t ticks_to_wait) {
+    return SimulatedBus::instance().twai.transmit(*message);
+}
+
+esp_err_t twai_receive(twai_message_t *message, TickType_t ticks_to_wait) {
+    return SimulatedBus::instance().twai.take(message);
+}
+
+esp_err_t twai_read_alerts(uint32_t *alerts, TickType_t ticks_to_wait) {
+    return SimulatedBus::instance().twai.readAlerts(alerts);
+}
+
+esp_err_t twai_reconfigure_alerts(uint32_t alerts_enabled, uint32_t *current_alerts) {
+    return SimulatedBus::instance().twai.reconfigureAlerts(alerts_enabled, current_alerts);
+}
+
+esp_err_t twai_initiate_recovery() {
+    return SimulatedBus::instance().twai.initiateRecovery();
+}
+
+esp_err_t twai_get_status_info(twai_status_info_t *status_info) {
+    return SimulatedBus::instance().twai.getStatus(status_info);
+}
+
+esp_err_t twai_clear_transmit_queue() {
+    return SimulatedBus::instance().twai.clearTransmitQueue();
+}
+
+esp_err_t twai_clear_receive_queue() {
+    return SimulatedBus::instance().twai.clearReceiveQueue();
+}
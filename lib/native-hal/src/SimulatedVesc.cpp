@@ -0,0 +1,332 @@
+#include "SimulatedVesc.h"
+#include "buffer.h"
+#include "crc.h"
+
+namespace {
+    // from datatypes.h of the VESC firmware, which can't be included here
+    const uint8_t CAN_PACKET_FILL_RX_BUFFER = 5;
+    const uint8_t CAN_PACKET_FILL_RX_BUFFER_LONG = 6;
+    const uint8_t CAN_PACKET_PROCESS_RX_BUFFER = 7;
+    const uint8_t CAN_PACKET_PROCESS_SHORT_BUFFER = 8;
+    const uint8_t CAN_PACKET_STATUS = 9;
+    const uint8_t CAN_PACKET_STATUS_2 = 14;
+    const uint8_t CAN_PACKET_STATUS_3 = 15;
+    const uint8_t CAN_PACKET_STATUS_4 = 16;
+    const uint8_t CAN_PACKET_PING = 17;
+    const uint8_t CAN_PACKET_PONG = 18;
+    const uint8_t CAN_PACKET_STATUS_5 = 27;
+    const uint8_t CAN_PACKET_STATUS_6 = 58;
+
+    const uint8_t COMM_FW_VERSION = 0;
+    const uint8_t COMM_GET_VALUES = 4;
+    const uint8_t COMM_SET_MCCONF = 13;
+    const uint8_t COMM_GET_MCCONF = 14;
+    const uint8_t COMM_SET_APPCONF = 16;
+    const uint8_t COMM_GET_APPCONF = 17;
+    const uint8_t COMM_CUSTOM_APP_DATA = 36;
+    const uint8_t COMM_GET_VALUES_SELECTIVE = 50;
+
+    const uint8_t HW_TYPE_VESC = 0;
+    const uint8_t FLOAT_PACKAGE_MAGIC = 101;
+    const uint8_t FLOAT_COMMAND_GET_RTDATA = 1;
+    const uint32_t VALUES_ALL = 0x3FFFFF; // the 22 fields of COMM_GET_VALUES
+}
+
+SimulatedVesc::SimulatedVesc(uint8_t id) {
+    this->id = id;
+    // stand-ins for the configuration structs, long enough to need FILL_RX_BUFFER_LONG
+    for (int i = 0; i < 680; i++) {
+        mcconf += (char) (i * 7 + id);
+    }
+    for (int i = 0; i < 420; i++) {
+        appconf += (char) (i * 3 + id);
+    }
+}
+
+void SimulatedVesc::receive(SimulatedBus &bus, const twai_message_t &frame, uint64_t now) {
+    uint8_t target = frame.identifier & 0xFF;
+    uint8_t packetId = (frame.identifier >> 8) & 0xFF;
+    if (!frame.extd || !answering || (target != id && target != 255)) {
+        return;
+    }
+    const uint8_t *data = frame.data;
+    uint8_t length = frame.data_length_code;
+    switch (packetId) {
+        case CAN_PACKET_FILL_RX_BUFFER:
+            if (length > 1 && data[0] + length - 1 <= SIMULATED_VESC_RX_BUFFER_SIZE) {
+                memcpy(rxBuffer + data[0], data + 1, length - 1);
+            }
+            break;
+        case CAN_PACKET_FILL_RX_BUFFER_LONG: {
+            uint16_t offset = (data[0] << 8) | data[1];
+            if (length > 2 && offset + length - 2 <= SIMULATED_VESC_RX_BUFFER_SIZE) {
+                memcpy(rxBuffer + offset, data + 2, length - 2);
+            }
+            break;
+        }
+        case CAN_PACKET_PROCESS_RX_BUFFER: {
+            if (length < 6) {
+                break;
+            }
+            uint16_t packetLength = (data[2] << 8) | data[3];
+            uint16_t crc = (data[4] << 8) | data[5];
+            if (packetLength == 0 || packetLength > SIMULATED_VESC_RX_BUFFER_SIZE || crc16(rxBuffer, packetLength) != crc) {
+                crcErrors++;
+                break;
+            }
+            lastSender = data[0];
+            // 0: process and answer, 1: a response to forward to USB, 2: process without answer
+            if (data[1] != 1) {
+                process(bus, data[0], rxBuffer, packetLength, data[1] == 0, now);
+            }
+            break;
+        }
+        case CAN_PACKET_PROCESS_SHORT_BUFFER:
+            if (length > 0) {
+                lastSender = data[0];
+            }
+            if (length > 2 && data[1] != 1) {
+                process(bus, data[0], data + 2, length - 2, data[1] == 0, now);
+            }
+            break;
+        case CAN_PACKET_PING:
+            if (length > 0) {
+                uint8_t pong[] = {id, HW_TYPE_VESC};
+                sendFrame(bus, CAN_PACKET_PONG, data[0], pong, sizeof(pong), now + responseDelay);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void SimulatedVesc::update(SimulatedBus &bus, uint64_t until) {
+    if (blocking && blockingDoneAt <= NativeClock::now()) {
+        // send_func_blocking uses rx_buffer_last_id as it is now, not as it was for the request
+        blocking = false;
+        sendBuffer(bus, lastSender, (const uint8_t *) blockingResponse.data(), blockingResponse.size(),
+                   NativeClock::now());
+    }
+    if (statusInterval == 0 || !answering) {
+        return;
+    }
+    if (nextStatus < NativeClock::now()) {
+        nextStatus = NativeClock::now();
+    }
+    while (nextStatus <= until) {
+        sendStatus(bus, nextStatus);
+        nextStatus += statusInterval;
+    }
+}
+
+void SimulatedVesc::process(SimulatedBus &bus, uint8_t sender, const uint8_t *packet, uint16_t length,
+                            boolean reply, uint64_t now) {
+    static uint8_t response[SIMULATED_VESC_RX_BUFFER_SIZE];
+    int32_t index = 0;
+    uint8_t command = packet[0];
+    boolean deferred = blockingDelay > 0 && (command == COMM_GET_MCCONF || command == COMM_SET_MCCONF ||
+                                             command == COMM_GET_APPCONF || command == COMM_SET_APPCONF);
+    if (deferred && blocking) {
+        // the blocking thread is busy, the firmware drops the command
+        blockingDropped++;
+        return;
+    }
+    commandsProcessed++;
+    lastCommand = command;
+    response[index++] = command;
+    switch (command) {
+        case COMM_FW_VERSION:
+            response[index++] = firmwareMajor;
+            response[index++] = firmwareMinor;
+            memcpy(response + index, hardwareName.c_str(), hardwareName.size() + 1);
+            index += hardwareName.size() + 1;
+            for (int i = 0; i < 12; i++) {
+                response[index++] = 0xA0 + i; // STM32 UUID
+            }
+            response[index++] = 0; // pairing done
+            response[index++] = 0; // test version
+            response[index++] = HW_TYPE_VESC;
+            response[index++] = 1; // custom configurations
+            response[index++] = 0; // phase filters
+            response[index++] = 0; // QML hw
+            response[index++] = 0; // QML app
+            response[index++] = 0; // NRF flags
+            response[index++] = 0; // firmware name
+            buffer_append_uint32(response, 0x12345678, &index); // hw config CRC
+            break;
+        case COMM_GET_VALUES:
+            appendValues(response, &index, VALUES_ALL);
+            break;
+        case COMM_GET_VALUES_SELECTIVE: {
+            if (length < 5) {
+                return;
+            }
+            int32_t maskIndex = 1;
+            uint32_t mask = buffer_get_uint32(packet, &maskIndex);
+            lastSelectiveMask = mask;
+            buffer_append_uint32(response, mask, &index);
+            appendValues(response, &index, mask);
+            break;
+        }
+        case COMM_CUSTOM_APP_DATA:
+            if (length < 3 || packet[1] != FLOAT_PACKAGE_MAGIC || packet[2] != FLOAT_COMMAND_GET_RTDATA) {
+                return;
+            }
+            response[index++] = FLOAT_PACKAGE_MAGIC;
+            response[index++] = FLOAT_COMMAND_GET_RTDATA;
+            buffer_append_float32_auto(response, values.pidOutput, &index);
+            buffer_append_float32_auto(response, values.pitch, &index);
+            buffer_append_float32_auto(response, values.roll, &index);
+            response[index++] = values.floatState;
+            response[index++] = values.switchState;
+            buffer_append_float32_auto(response, values.adc1, &index);
+            buffer_append_float32_auto(response, values.adc2, &index);
+            break;
+        case COMM_GET_MCCONF:
+        case COMM_GET_APPCONF: {
+            const std::string &configuration = command == COMM_GET_MCCONF ? mcconf : appconf;
+            memcpy(response + index, configuration.data(), configuration.size());
+            index += configuration.size();
+            break;
+        }
+        case COMM_SET_MCCONF:
+            mcconf.assign((const char *) packet + 1, length - 1);
+            break;
+        case COMM_SET_APPCONF:
+            appconf.assign((const char *) packet + 1, length - 1);
+            break;
+        default:
+            // unsupported commands stay unanswered, like on a VESC with older firmware
+            return;
+    }
+    if (!reply) {
+        return;
+    }
+    if (deferred) {
+        blocking = true;
+        blockingDoneAt = now + blockingDelay;
+        blockingResponse.assign((const char *) response, index);
+        return;
+    }
+    sendBuffer(bus, sender, response, index, now + responseDelay);
+}
+
+// field order and scaling of COMM_GET_VALUES(_SELECTIVE) in commands.c, bit n selects field n
+void SimulatedVesc::appendValues(uint8_t *out, int32_t *index, uint32_t mask) {
+    if (mask & ((uint32_t) 1 << 0)) buffer_append_float16(out, values.mosfetTemp, 1e1, index);
+    if (mask & ((uint32_t) 1 << 1)) buffer_append_float16(out, values.motorTemp, 1e1, index);
+    if (mask & ((uint32_t) 1 << 2)) buffer_append_float32(out, values.motorCurrent, 1e2, index);
+    if (mask & ((uint32_t) 1 << 3)) buffer_append_float32(out, values.inputCurrent, 1e2, index);
+    if (mask & ((uint32_t) 1 << 4)) buffer_append_float32(out, 0, 1e2, index); // id
+    if (mask & ((uint32_t) 1 << 5)) buffer_append_float32(out, values.motorCurrent, 1e2, index); // iq
+    if (mask & ((uint32_t) 1 << 6)) buffer_append_float16(out, values.dutyCycle, 1e3, index);
+    if (mask & ((uint32_t) 1 << 7)) buffer_append_float32(out, values.erpm, 1e0, index);
+    if (mask & ((uint32_t) 1 << 8)) buffer_append_float16(out, values.inputVoltage, 1e1, index);
+    if (mask & ((uint32_t) 1 << 9)) buffer_append_float32(out, values.ampHours, 1e4, index);
+    if (mask & ((uint32_t) 1 << 10)) buffer_append_float32(out, values.ampHoursCharged, 1e4, index);
+    if (mask & ((uint32_t) 1 << 11)) buffer_append_float32(out, values.wattHours, 1e4, index);
+    if (mask & ((uint32_t) 1 << 12)) buffer_append_float32(out, values.wattHoursCharged, 1e4, index);
+    if (mask & ((uint32_t) 1 << 13)) buffer_append_int32(out, values.tachometer, index);
+    if (mask & ((uint32_t) 1 << 14)) buffer_append_int32(out, values.tachometerAbs, index);
+    if (mask & ((uint32_t) 1 << 15)) out[(*index)++] = values.fault;
+    if (mask & ((uint32_t) 1 << 16)) buffer_append_float32(out, values.pidPosition, 1e6, index);
+    if (mask & ((uint32_t) 1 << 17)) out[(*index)++] = id;
+    if (mask & ((uint32_t) 1 << 18)) {
+        // three MOSFET temperatures
+        for (int i = 0; i < 3; i++) {
+            buffer_append_float16(out, values.mosfetTemp, 1e1, index);
+        }
+    }
+    if (mask & ((uint32_t) 1 << 19)) buffer_append_float32(out, 0, 1e3, index); // vd
+    if (mask & ((uint32_t) 1 << 20)) buffer_append_float32(out, 0, 1e3, index); // vq
+    if (mask & ((uint32_t) 1 << 21)) out[(*index)++] = 0; // status
+}
+
+// comm_can_send_buffer() with send = 1: the receiver gets a response, not a request
+void SimulatedVesc::sendBuffer(SimulatedBus &bus, uint8_t receiver, const uint8_t *data, uint16_t length,
+                               uint64_t readyAt) {
+    uint8_t frame[8];
+    if (length <= 6) {
+        frame[0] = id;
+        frame[1] = 1;
+        memcpy(frame + 2, data, length);
+        sendFrame(bus, CAN_PACKET_PROCESS_SHORT_BUFFER, receiver, frame, length + 2, readyAt);
+        return;
+    }
+    unsigned int endA = 0;
+    for (unsigned int i = 0; i < length; i += 7) {
+        if (i > 255) {
+            break;
+        }
+        endA = i + 7;
+        uint8_t sendLength = length - i >= 7 ? 7 : length - i;
+        frame[0] = i;
+        memcpy(frame + 1, data + i, sendLength);
+        sendFrame(bus, CAN_PACKET_FILL_RX_BUFFER, receiver, frame, sendLength + 1, readyAt);
+    }
+    for (unsigned int i = endA; i < length; i += 6) {
+        uint8_t sendLength = length - i >= 6 ? 6 : length - i;
+        frame[0] = i >> 8;
+        frame[1] = i & 0xFF;
+        memcpy(frame + 2, data + i, sendLength);
+        sendFrame(bus, CAN_PACKET_FILL_RX_BUFFER_LONG, receiver, frame, sendLength + 2, readyAt);
+    }
+    uint16_t crc = crc16(data, length);
+    frame[0] = id;
+    frame[1] = 1;
+    frame[2] = length >> 8;
+    frame[3] = length & 0xFF;
+    frame[4] = crc >> 8;
+    frame[5] = crc & 0xFF;
+    sendFrame(bus, CAN_PACKET_PROCESS_RX_BUFFER, receiver, frame, 6, readyAt);
+}
+
+void SimulatedVesc::sendFrame(SimulatedBus &bus, uint8_t packetId, uint8_t receiver, const uint8_t *data,
+                              uint8_t length, uint64_t readyAt) {
+    twai_message_t frame = {};
+    frame.extd = 1;
+    frame.identifier = ((uint32_t) packetId << 8) | receiver;
+    frame.data_length_code = length;
+    memcpy(frame.data, data, length);
+    bus.send(this, frame, readyAt);
+}
+
+// the status messages of comm_can_send_status(), all with our own id
+void SimulatedVesc::sendStatus(SimulatedBus &bus, uint64_t at) {
+    uint8_t data[8];
+    int32_t index = 0;
+    buffer_append_int32(data, (int32_t) values.erpm, &index);
+    buffer_append_int16(data, (int16_t) (values.motorCurrent * 1e1), &index);
+    buffer_append_int16(data, (int16_t) (values.dutyCycle * 1e3), &index);
+    sendFrame(bus, CAN_PACKET_STATUS, id, data, index, at);
+
+    index = 0;
+    buffer_append_int32(data, (int32_t) (values.ampHours * 1e4), &index);
+    buffer_append_int32(data, (int32_t) (values.ampHoursCharged * 1e4), &index);
+    sendFrame(bus, CAN_PACKET_STATUS_2, id, data, index, at);
+
+    index = 0;
+    buffer_append_int32(data, (int32_t) (values.wattHours * 1e4), &index);
+    buffer_append_int32(data, (int32_t) (values.wattHoursCharged * 1e4), &index);
+    sendFrame(bus, CAN_PACKET_STATUS_3, id, data, index, at);
+
+    index = 0;
+    buffer_append_int16(data, (int16_t) (values.mosfetTemp * 1e1), &index);
+    buffer_append_int16(data, (int16_t) (values.motorTemp * 1e1), &index);
+    buffer_append_int16(data, (int16_t) (values.inputCurrent * 1e1), &index);
+    buffer_append_int16(data, (int16_t) (values.pidPosition * 50.0), &index);
+    sendFrame(bus, CAN_PACKET_STATUS_4, id, data, index, at);
+
+    index = 0;
+    buffer_append_int32(data, values.tachometer, &index);
+    buffer_append_int16(data, (int16_t) (values.inputVoltage * 1e1), &index);
+    buffer_append_int16(data, 0, &index);
+    sendFrame(bus, CAN_PACKET_STATUS_5, id, data, index, at);
+
+    index = 0;
+    buffer_append_int16(data, (int16_t) (values.adc1 * 1e3), &index);
+    buffer_append_int16(data, (int16_t) (values.adc2 * 1e3), &index);
+    buffer_append_int16(data, 0, &index);
+    buffer_append_int16(data, 0, &index);
+    sendFrame(bus, CAN_PACKET_STATUS_6, id, data, index, at);
+}
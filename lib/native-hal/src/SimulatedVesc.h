@@ -0,0 +1,87 @@
+#ifndef RESCUE_SIMULATEDVESC_H
+#define RESCUE_SIMULATEDVESC_H
+
+#include "SimulatedBus.h"
+#include <string>
+
+#define SIMULATED_VESC_RX_BUFFER_SIZE 4096 // PACKET_MAX_PL_LEN of the VESC firmware
+
+/*
+  Fake VESC (firmware 6.x) on the SimulatedBus. Answers COMM_FW_VERSION, COMM_GET_VALUES,
+  COMM_GET_VALUES_SELECTIVE, the float package's COMM_CUSTOM_APP_DATA and COMM_GET/SET_MCCONF
+  and COMM_GET/SET_APPCONF, the latter two stand in for long proxy transfers. Requests are
+  taken in as PROCESS_SHORT_BUFFER or as FILL_RX_BUFFER(_LONG) + PROCESS_RX_BUFFER, responses
+  go out the way comm_can_send_buffer() does it, after responseDelay. Optionally broadcasts
+  status 1-6 like the "CAN status message" app setting. With blockingDelay the configuration
+  commands are answered later, like from the firmware's blocking thread: the answer goes to
+  whichever sender the last request came from by then.
+  The encoders follow the firmware sources, not the decoders in src/, so the two can't share
+  a mistake.
+*/
+class SimulatedVesc : public SimulatedNode {
+  public:
+    explicit SimulatedVesc(uint8_t id);
+
+    struct Values {
+        float mosfetTemp = 35.5;
+        float motorTemp = 41.2;
+        float motorCurrent = 12.5;
+        float inputCurrent = 8.25;
+        float dutyCycle = 0.35;
+        float erpm = 8450;
+        float inputVoltage = 58.6;
+        float ampHours = 1.2345;
+        float ampHoursCharged = 0.1234;
+        float wattHours = 70.25;
+        float wattHoursCharged = 7.5;
+        int32_t tachometer = 123456;
+        int32_t tachometerAbs = 234567;
+        uint8_t fault = 0;
+        float pidPosition = 0;
+        // float package realtime data
+        float pidOutput = 3.25;
+        float pitch = 1.5;
+        float roll = -2.25;
+        uint8_t floatState = 1;
+        uint8_t switchState = 2;
+        float adc1 = 3.1;
+        float adc2 = 3.2;
+    } values;
+
+    uint8_t firmwareMajor = 6;
+    uint8_t firmwareMinor = 2;
+    std::string hardwareName = "60_MK6";
+    uint32_t responseDelay = 200;    // us from the end of a request to its first response frame
+    uint32_t statusInterval = 0;     // us between status 1-6 broadcasts, 0 disables them
+    std::string mcconf;              // COMM_GET_MCCONF returns it, COMM_SET_MCCONF replaces it
+    std::string appconf;             // same for COMM_GET/SET_APPCONF
+    boolean answering = true;        // false to play dead
+    uint32_t blockingDelay = 0;      // us the configuration commands take, 0 answers them right away
+
+    uint32_t commandsProcessed = 0;
+    uint32_t crcErrors = 0;
+    uint32_t lastCommand = 0;
+    uint32_t lastSelectiveMask = 0;
+    uint32_t blockingDropped = 0;    // configuration commands ignored because another one was running
+
+    void receive(SimulatedBus &bus, const twai_message_t &frame, uint64_t now) override;
+    void update(SimulatedBus &bus, uint64_t until) override;
+
+  private:
+    uint8_t id;
+    uint8_t rxBuffer[SIMULATED_VESC_RX_BUFFER_SIZE];
+    uint64_t nextStatus = 0;
+    uint8_t lastSender = 0;          // rx_buffer_last_id of the firmware
+    boolean blocking = false;
+    uint64_t blockingDoneAt = 0;
+    std::string blockingResponse;
+    void process(SimulatedBus &bus, uint8_t sender, const uint8_t *packet, uint16_t length, boolean reply,
+                 uint64_t now);
+    void sendBuffer(SimulatedBus &bus, uint8_t receiver, const uint8_t *data, uint16_t length, uint64_t readyAt);
+    void sendFrame(SimulatedBus &bus, uint8_t packetId, uint8_t receiver, const uint8_t *data, uint8_t length,
+                   uint64_t readyAt);
+    void sendStatus(SimulatedBus &bus, uint64_t at);
+    void appendValues(uint8_t *out, int32_t *index, uint32_t mask);
+};
+
+#endif //RESCUE_SIMULATEDVESC_H
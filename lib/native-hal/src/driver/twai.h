@@ -0,0 +1,182 @@
+#ifndef RESCUE_NATIVE_TWAI_H
+#define RESCUE_NATIVE_TWAI_H
+
+/*
+  The TWAI driver API of ESP-IDF 4.4, implemented by SimulatedTwai on the SimulatedBus.
+  Types and constants match the IDF, so CanDevice builds unchanged.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_1 = 1,
+    GPIO_NUM_2 = 2,
+    GPIO_NUM_3 = 3,
+    GPIO_NUM_4 = 4,
+    GPIO_NUM_5 = 5,
+    GPIO_NUM_6 = 6,
+    GPIO_NUM_7 = 7,
+    GPIO_NUM_8 = 8,
+    GPIO_NUM_9 = 9,
+    GPIO_NUM_10 = 10,
+    GPIO_NUM_11 = 11,
+    GPIO_NUM_12 = 12,
+    GPIO_NUM_13 = 13,
+    GPIO_NUM_14 = 14,
+    GPIO_NUM_15 = 15,
+    GPIO_NUM_16 = 16,
+    GPIO_NUM_17 = 17,
+    GPIO_NUM_18 = 18,
+    GPIO_NUM_19 = 19,
+    GPIO_NUM_20 = 20,
+    GPIO_NUM_21 = 21,
+    GPIO_NUM_22 = 22,
+    GPIO_NUM_23 = 23,
+    GPIO_NUM_24 = 24,
+    GPIO_NUM_25 = 25,
+    GPIO_NUM_26 = 26,
+    GPIO_NUM_27 = 27,
+    GPIO_NUM_28 = 28,
+    GPIO_NUM_29 = 29,
+    GPIO_NUM_30 = 30,
+    GPIO_NUM_31 = 31,
+    GPIO_NUM_32 = 32,
+    GPIO_NUM_33 = 33,
+    GPIO_NUM_34 = 34,
+    GPIO_NUM_35 = 35,
+    GPIO_NUM_36 = 36,
+    GPIO_NUM_37 = 37,
+    GPIO_NUM_38 = 38,
+    GPIO_NUM_39 = 39,
+    GPIO_NUM_40 = 40,
+    GPIO_NUM_41 = 41,
+    GPIO_NUM_42 = 42,
+    GPIO_NUM_43 = 43,
+    GPIO_NUM_44 = 44,
+    GPIO_NUM_45 = 45,
+    GPIO_NUM_46 = 46,
+    GPIO_NUM_47 = 47,
+    GPIO_NUM_48 = 48,
+} gpio_num_t;
+
+#define TWAI_IO_UNUSED GPIO_NUM_NC
+
+#define TWAI_STD_ID_MASK 0x7FF
+#define TWAI_EXTD_ID_MASK 0x1FFFFFFF
+#define TWAI_FRAME_MAX_DLC 8
+
+#define TWAI_ALERT_TX_IDLE 0x00000001
+#define TWAI_ALERT_TX_SUCCESS 0x00000002
+#define TWAI_ALERT_BELOW_ERR_WARN 0x00000004
+#define TWAI_ALERT_ERR_ACTIVE 0x00000008
+#define TWAI_ALERT_RECOVERY_IN_PROGRESS 0x00000010
+#define TWAI_ALERT_BUS_RECOVERED 0x00000020
+#define TWAI_ALERT_ARB_LOST 0x00000040
+#define TWAI_ALERT_ABOVE_ERR_WARN 0x00000080
+#define TWAI_ALERT_BUS_ERROR 0x00000100
+#define TWAI_ALERT_TX_FAILED 0x00000200
+#define TWAI_ALERT_RX_QUEUE_FULL 0x00000400
+#define TWAI_ALERT_ERR_PASS 0x00000800
+#define TWAI_ALERT_BUS_OFF 0x00001000
+#define TWAI_ALERT_RX_FIFO_OVERRUN 0x00002000
+#define TWAI_ALERT_ALL 0x00003FFF
+#define TWAI_ALERT_NONE 0x00000000
+
+typedef enum {
+    TWAI_MODE_NORMAL,
+    TWAI_MODE_NO_ACK,
+    TWAI_MODE_LISTEN_ONLY,
+} twai_mode_t;
+
+typedef enum {
+    TWAI_STATE_STOPPED,
+    TWAI_STATE_RUNNING,
+    TWAI_STATE_BUS_OFF,
+    TWAI_STATE_RECOVERING,
+} twai_state_t;
+
+typedef struct {
+    union {
+        struct {
+            uint32_t extd: 1;
+            uint32_t rtr: 1;
+            uint32_t ss: 1;
+            uint32_t self: 1;
+            uint32_t dlc_non_comp: 1;
+            uint32_t reserved: 27;
+        };
+        uint32_t flags;
+    };
+    uint32_t identifier;
+    uint8_t data_length_code;
+    uint8_t data[TWAI_FRAME_MAX_DLC];
+} twai_message_t;
+
+typedef struct {
+    twai_mode_t mode;
+    gpio_num_t tx_io;
+    gpio_num_t rx_io;
+    gpio_num_t clkout_io;
+    gpio_num_t bus_off_io;
+    uint32_t tx_queue_len;
+    uint32_t rx_queue_len;
+    uint32_t alerts_enabled;
+    uint32_t clkout_divider;
+    int intr_flags;
+} twai_general_config_t;
+
+typedef struct {
+    uint32_t brp;
+    uint8_t tseg_1;
+    uint8_t tseg_2;
+    uint8_t sjw;
+    bool triple_sampling;
+} twai_timing_config_t;
+
+typedef struct {
+    uint32_t acceptance_code;
+    uint32_t acceptance_mask;
+    bool single_filter;
+} twai_filter_config_t;
+
+typedef struct {
+    twai_state_t state;
+    uint32_t msgs_to_tx;
+    uint32_t msgs_to_rx;
+    uint32_t tx_error_counter;
+    uint32_t rx_error_counter;
+    uint32_t tx_failed_count;
+    uint32_t rx_missed_count;
+    uint32_t rx_overrun_count;
+    uint32_t arb_lost_count;
+    uint32_t bus_error_count;
+} twai_status_info_t;
+
+#define TWAI_GENERAL_CONFIG_DEFAULT(tx_io_num, rx_io_num, op_mode) \
+    {op_mode, tx_io_num, rx_io_num, TWAI_IO_UNUSED, TWAI_IO_UNUSED, 5, 5, TWAI_ALERT_NONE, 0, 0}
+#define TWAI_TIMING_CONFIG_125KBITS() {32, 15, 4, 3, false}
+#define TWAI_TIMING_CONFIG_250KBITS() {16, 15, 4, 3, false}
+#define TWAI_TIMING_CONFIG_500KBITS() {8, 15, 4, 3, false}
+#define TWAI_TIMING_CONFIG_1MBITS() {4, 15, 4, 3, false}
+#define TWAI_FILTER_CONFIG_ACCEPT_ALL() {0, 0xFFFFFFFF, true}
+
+esp_err_t twai_driver_install(const twai_general_config_t *g_config, const twai_timing_config_t *t_config,
+                              const twai_filter_config_t *f_config);
+esp_err_t twai_driver_uninstall();
+esp_err_t twai_start();
+esp_err_t twai_stop();
+esp_err_t twai_transmit(const twai_message_t *message, TickType_t ticks_to_wait);
+esp_err_t twai_receive(twai_message_t *message, TickType_t ticks_to_wait);
+esp_err_t twai_read_alerts(uint32_t *alerts, TickType_t ticks_to_wait);
+esp_err_t twai_reconfigure_alerts(uint32_t alerts_enabled, uint32_t *current_alerts);
+esp_err_t twai_initiate_recovery();
+esp_err_t twai_get_status_info(twai_status_info_t *status_info);
+esp_err_t twai_clear_transmit_queue();
+esp_err_t twai_clear_receive_queue();
+
+#endif //RESCUE_NATIVE_TWAI_H
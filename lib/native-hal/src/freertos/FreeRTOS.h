@@ -0,0 +1,30 @@
+#ifndef RESCUE_NATIVE_FREERTOS_H
+#define RESCUE_NATIVE_FREERTOS_H
+
+#include <stdint.h>
+
+/*
+  Single threaded stand-in for the FreeRTOS API the CAN modules use. Tasks are not started,
+  nothing ever blocks: a call that would wait returns its timeout result right away, see
+  CanDevice::service() for how the task bodies run on the host.
+*/
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void *TaskHandle_t;
+typedef void *QueueHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFF)
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+#endif //RESCUE_NATIVE_FREERTOS_H
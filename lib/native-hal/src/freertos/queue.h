@@ -0,0 +1,12 @@
+#ifndef RESCUE_NATIVE_FREERTOS_QUEUE_H
+#define RESCUE_NATIVE_FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+// a full queue fails immediately, no other task could make room meanwhile
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#endif //RESCUE_NATIVE_FREERTOS_QUEUE_H
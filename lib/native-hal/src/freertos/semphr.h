@@ -0,0 +1,11 @@
+#ifndef RESCUE_NATIVE_FREERTOS_SEMPHR_H
+#define RESCUE_NATIVE_FREERTOS_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+// there is only one thread, taking a mutex always succeeds
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#endif //RESCUE_NATIVE_FREERTOS_SEMPHR_H
@@ -0,0 +1,15 @@
+#ifndef RESCUE_NATIVE_FREERTOS_TASK_H
+#define RESCUE_NATIVE_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+// returns a handle but never runs the task
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait);
+// advances NativeClock
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+
+#endif //RESCUE_NATIVE_FREERTOS_TASK_H
@@ -0,0 +1,109 @@
+#include "VescPacketFramer.h"
+#include <string.h>
+#include "crc.h"
+
+size_t VescPacketFramer::feed(const uint8_t *data, size_t size) {
+    completed = false;
+    size_t used = 0;
+    while (used < size && !completed) {
+        if (state == PAYLOAD) {
+            // the bulk of a packet, copied in one piece
+            size_t count = payloadLength - payloadReceived;
+            if (count > size - used) {
+                count = size - used;
+            }
+            memcpy(buffer + payloadReceived, data + used, count);
+            payloadCrc = crc16_update(payloadCrc, data + used, count);
+            payloadReceived += count;
+            used += count;
+            if (payloadReceived == payloadLength) {
+                state = CRC_HIGH;
+            }
+            continue;
+        }
+        if (consume(data[used])) {
+            used++;
+        }
+    }
+    return used;
+}
+
+size_t VescPacketFramer::feed(const uint8_t *data, size_t size, uint32_t now) {
+    expire(now);
+    lastByte = now;
+    return feed(data, size);
+}
+
+bool VescPacketFramer::expire(uint32_t now) {
+    if (!receiving() || now - lastByte < VESC_PACKET_TIMEOUT) {
+        return false;
+    }
+    timeouts++;
+    reset();
+    return true;
+}
+
+void VescPacketFramer::reset() {
+    state = START;
+    completed = false;
+    payloadLength = 0;
+    payloadReceived = 0;
+    payloadCrc = 0;
+}
+
+// one byte of the framing around the payload, false if it has to be looked at again as a start byte
+bool VescPacketFramer::consume(uint8_t byte) {
+    switch (state) {
+        case START:
+            if (byte == 0x02) {
+                state = LENGTH_LOW;
+                started++;
+            } else if (byte == 0x03) {
+                state = LENGTH_HIGH;
+                started++;
+            } else {
+                skippedBytes++;
+            }
+            payloadLength = 0;
+            payloadReceived = 0;
+            payloadCrc = 0;
+            return true;
+        case LENGTH_HIGH:
+            payloadLength = byte << 8;
+            state = LENGTH_LOW;
+            return true;
+        case LENGTH_LOW:
+            payloadLength |= byte;
+            if (payloadLength == 0 || payloadLength > VESC_PACKET_MAX_PAYLOAD) {
+                framingErrors++;
+                state = START;
+            } else {
+                state = PAYLOAD;
+            }
+            return true;
+        case CRC_HIGH:
+            packetCrc = byte << 8;
+            state = CRC_LOW;
+            return true;
+        case CRC_LOW:
+            packetCrc |= byte;
+            state = END;
+            return true;
+        case END:
+            state = START;
+            if (byte != 0x03) {
+                framingErrors++;
+                return false;
+            }
+            if (packetCrc != payloadCrc) {
+                crcErrors++;
+                return true;
+            }
+            packets++;
+            completed = true;
+            return true;
+        default:
+            state = START;
+            return true;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef RESCUE_VESCPACKETFRAMER_H
+#define RESCUE_VESCPACKETFRAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef VESC_PACKET_MAX_PAYLOAD
+#define VESC_PACKET_MAX_PAYLOAD 4096 // PACKET_MAX_PL_LEN of the VESC firmware
+#endif //VESC_PACKET_MAX_PAYLOAD
+
+#ifndef VESC_PACKET_TIMEOUT
+#define VESC_PACKET_TIMEOUT 1000 // ms between two bytes of a packet before it is given up, like the timeout of packet.c
+#endif //VESC_PACKET_TIMEOUT
+
+/*
+  Incremental parser for the VESC packet framing on a byte stream:
+  0x02 length | 0x03 length_high length_low, payload, crc16 high low, 0x03.
+  The stream may be cut anywhere, a write can end in the middle of a packet or carry several
+  of them. Bytes outside of a packet are skipped, a packet with an impossible length, without
+  its end byte or with a checksum that doesn't match is dropped and the search for the next
+  start byte continues. The checksum is computed while the payload arrives. A packet that
+  doesn't continue for VESC_PACKET_TIMEOUT ms is dropped as well, a client that stops in the
+  middle of one or a stray start byte would otherwise keep the framer waiting for 4 KB.
+  A completed packet is a view into the framer's own buffer, valid until the next feed().
+*/
+class VescPacketFramer {
+  public:
+    // consumes bytes up to the end of the next complete packet, returns how many were used
+    size_t feed(const uint8_t *data, size_t size);
+    // feed() of bytes that arrived at now (ms), a packet that timed out before is dropped first
+    size_t feed(const uint8_t *data, size_t size, uint32_t now);
+    // drops a packet whose next byte is overdue at now, true if there was one
+    bool expire(uint32_t now);
+    // feed() stopped at the end of a packet, payload() and length() describe it
+    bool complete() const { return completed; }
+    // a packet has started but isn't complete yet
+    bool receiving() const { return state != START; }
+    // the payload, of a packet that is still receiving() only the first received() bytes
+    const uint8_t *payload() const { return buffer; }
+    uint16_t length() const { return payloadLength; }
+    uint16_t received() const { return payloadReceived; }
+    // the checksum as sent, high byte first
+    uint16_t crc() const { return packetCrc; }
+    void reset();
+
+    uint32_t started = 0;       // start bytes, tells consecutive packets apart while they stream in
+    uint32_t packets = 0;       // complete packets
+    uint32_t framingErrors = 0; // packets dropped for a bad length or a missing end byte
+    uint32_t crcErrors = 0;     // packets dropped because their checksum didn't match
+    uint32_t skippedBytes = 0;  // bytes outside of any packet
+    uint32_t timeouts = 0;      // packets dropped because the rest never arrived
+
+  private:
+    enum State {
+        START, LENGTH_HIGH, LENGTH_LOW, PAYLOAD, CRC_HIGH, CRC_LOW, END
+    };
+    State state = START;
+    bool completed = false;
+    uint16_t payloadLength = 0;
+    uint16_t payloadReceived = 0;
+    uint16_t packetCrc = 0;
+    uint16_t payloadCrc = 0;
+    uint32_t lastByte = 0; // ms, of the feed() with a time
+    uint8_t buffer[VESC_PACKET_MAX_PAYLOAD];
+    bool consume(uint8_t byte);
+};
+
+#endif //RESCUE_VESCPACKETFRAMER_H
@@ -0,0 +1,15 @@
+#ifndef RESCUE_CRC_H
+#define RESCUE_CRC_H
+
+#include <stdint.h>
+
+/*
+  CRC16-CCITT (XModem: polynomial 0x1021, initial value 0) as used by the VESC
+  packet framing and the CAN_PACKET_PROCESS_RX_BUFFER checksum, table driven.
+*/
+uint16_t crc16(const uint8_t *buf, uint32_t len);
+
+// continues a checksum over the next part of a message that arrives in pieces, start with 0
+uint16_t crc16_update(uint16_t crc, const uint8_t *buf, uint32_t len);
+
+#endif //RESCUE_CRC_H
@@ -11,6 +11,10 @@ AppConfiguration* AppConfiguration::getInstance() {
     return instance;
 }
 boolean AppConfiguration::readPreferences() {
+#ifdef NATIVE
+    // host builds have no flash, CanBus and the tests run with the defaults they set
+    return true;
+#else
     String json = "";
     if(!preferences.begin("rESCue", true)) {
         log_e("no config file found");
@@ -68,6 +72,7 @@ boolean AppConfiguration::readPreferences() {
     config.logLevel = doc["logLevel"] | Logger::SILENT;
     config.mtuSize = doc["mtuSize"] | 512;
     config.oddevenActive = doc["oddevenActive"] | true;
+    config.canPollBudget = doc["canPollBudget"] | 500;
     config.lightsSwitch = true;
     config.saveConfig = false;
     config.sendConfig = false;
@@ -75,9 +80,13 @@ boolean AppConfiguration::readPreferences() {
       return false;
     } 
     return true;
+#endif //NATIVE
 }
 
 boolean AppConfiguration::savePreferences() {
+#ifdef NATIVE
+    return true;
+#else
     StaticJsonDocument<1024> doc;
     doc["deviceName"] = config.deviceName;
     doc["otaUpdateActive"] = config.otaUpdateActive;
@@ -112,6 +121,7 @@ boolean AppConfiguration::savePreferences() {
     doc["mallGrab"] = config.mallGrab;
     doc["logLevel"] = config.logLevel;
     doc["mtuSize"] = config.mtuSize;
+    doc["canPollBudget"] = config.canPollBudget;
     String json = "";
     serializeJson(doc, json);
     log_n("savePreferences: %s", json.c_str());
@@ -124,6 +134,7 @@ boolean AppConfiguration::savePreferences() {
     preferences.putString("config", json);
     preferences.end();
     return true;
+#endif //NATIVE
 }
 
 boolean AppConfiguration::readMelodies() {
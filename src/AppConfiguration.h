@@ -59,6 +59,7 @@ struct Config {
     VISITABLE(int , mtuSize);
     VISITABLE(boolean , oddevenActive);
     VISITABLE(boolean, lightsSwitch);
+    VISITABLE(int, canPollBudget);
   END_VISITABLES;
 };
 
@@ -111,6 +111,7 @@ void BMSController::broadcastVESCBMS()
 
   const uint16_t *cellMillivolts = relay->getCellMillivolts();
   canbus_->bmsVCell(cellMillivolts,cellSeries);
+  updateCellRange(cellMillivolts,cellSeries);
 
   const int8_t *thermTemps = relay->getTemperaturesCelsius();
   canbus_->bmsTemps(thermTemps,cellThermistors);
@@ -138,6 +139,20 @@ void BMSController::broadcastVESCBMS()
   canbus_->bmsState(op_state, fault_state);
 }
 
+// cells the relay hasn't reported yet read 0 and are left out
+void BMSController::updateCellRange(const uint16_t* cellMillivolts, int numCells)
+{
+  uint16_t cellMin=0;
+  uint16_t cellMax=0;
+  for (int i = 0; i < numCells; i++) {
+    if (cellMillivolts[i]==0) continue;
+    if (cellMin==0 || cellMillivolts[i]<cellMin) cellMin=cellMillivolts[i];
+    if (cellMillivolts[i]>cellMax) cellMax=cellMillivolts[i];
+  }
+  vescData->cellMinMillivolts=cellMin;
+  vescData->cellMaxMillivolts=cellMax;
+}
+
 boolean BMSController::isBatteryCellOvercharged(const uint16_t* cellMillivolts, int cell_max)
 {
 	int cell_now = 0;
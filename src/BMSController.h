@@ -33,6 +33,7 @@ private:
     boolean isBatteryCellOvercharged(const uint16_t*, int);
     boolean isBatteryCellUndercharged(const uint16_t*, int);
     float batteryCellVariance(const uint16_t*, int);
+    void updateCellRange(const uint16_t*, int);
     boolean isBatteryCellTempMax(const int8_t*, int);
     boolean isBatteryCellTempMin(const int8_t*, int);
     boolean isBMSTempMax(const int8_t);
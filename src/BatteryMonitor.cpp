@@ -24,8 +24,10 @@ void BatteryMonitor::init() {
 
 // Read the voltage from the voltage divider and update the battery bar if connected
 double BatteryMonitor::readValues() {
-    auto voltage = (double) vescData->inputVoltage;
-    auto current = (double) abs(vescData->current);
+    // voltage and current from the same CanBus loop
+    VescTelemetry telemetry = vescData->snapshot.read();
+    auto voltage = telemetry.batteryVoltage();
+    auto current = abs(telemetry.boardCurrent());
     updateCurrentArray(current);
 
     if (Logger::getLogLevel() == Logger::VERBOSE) {
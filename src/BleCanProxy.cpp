@@ -1,131 +1,328 @@
 #include "BleCanProxy.h"
+#include "crc.h"
 
 
-BleCanProxy::BleCanProxy(CanDevice *candevice, Stream *stream, uint8_t vesc_id, uint8_t ble_proxy_can_id) {
+BleCanProxy::BleCanProxy(CanDevice *candevice, uint8_t vesc_id, uint8_t ble_proxy_can_id,
+                         const VescSnapshot<VescTelemetry> *telemetry, VescArbiter *arbiter)
+        : responder(telemetry) {
     this->candevice = candevice;
-    this->stream = stream;
+    this->arbiter = arbiter;
     this->vesc_id = vesc_id;
-    this->ble_proxy_can_id = ble_proxy_can_id;
-}
-
-void BleCanProxy::proxyIn(std::string in) {
-    auto packet_type = (uint8_t) in.at(0);
-
-    if (!longPacket) {
-        switch (packet_type) {
-            case 2:
-                length = (uint8_t) in.at(1);
-                command = (uint8_t) in.at(2);
-                processing = true;
-                if (length > (in.size() - 5)) {
-                    longPacket = true;
-                }
-                break;
-            case 3:
-                length = ((uint8_t) in.at(1) << 8) + (uint8_t) in.at(2);
-                command = (uint8_t) in.at(3);
-                longPacket = true;
-                processing = true;
-                break;
-            default:
-                return;
+    for (int i = 0; i < PROXY_SESSIONS; i++) {
+        sessions[i].canId = ble_proxy_can_id + i;
+    }
+}
+
+ProxySession *BleCanProxy::open(uint16_t connection) {
+    for (ProxySession &session : sessions) {
+        if (session.state.load(std::memory_order_acquire) == PROXY_SESSION_FREE) {
+            session.connection = connection;
+            session.state.store(PROXY_SESSION_OPEN, std::memory_order_release);
+            return &session;
         }
-        if (Logger::getLogLevel() == Logger::VERBOSE) {
-            snprintf(buf, bufSize, "Proxy in, command %d, length %d\n", command, length);
-            Logger::verbose(LOG_TAG_BLE_CAN_PROXY, buf);
+    }
+    return nullptr;
+}
+
+void BleCanProxy::close(uint16_t connection) {
+    for (ProxySession &session : sessions) {
+        if (session.open() && session.connection == connection) {
+            session.state.store(PROXY_SESSION_CLOSING, std::memory_order_release);
         }
     }
+}
 
-    if (length <= 6) {
-        twai_message_t tx_frame = {};
-        tx_frame.extd = 1;
-        tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_PROCESS_SHORT_BUFFER) << 8) + vesc_id;
-        tx_frame.data_length_code = 0x02 + length;
-        tx_frame.data[0] = ble_proxy_can_id;
-        tx_frame.data[1] = 0x00;
-        tx_frame.data[2] = command;
-        for (int i = 3; i < length + 2; i++) {
-            tx_frame.data[i] = (uint8_t) in.at(i);
-        }
-        candevice->sendCanFrame(&tx_frame);
-    } else {
-        longPackBuffer += in;
-        if (length + 5 > longPackBuffer.size()) {
-            //Serial.printf("Buffer not full, needed %d, is %d\n", length + 5, longPackBuffer.size());
-            return;
+// a full ring drops the whole write, the framer skips to the next packet that arrives intact
+boolean BleCanProxy::receive(uint16_t connection, const uint8_t *data, size_t size) {
+    for (ProxySession &session : sessions) {
+        if (session.open() && session.connection == connection) {
+            return session.in.write(data, size);
         }
-        //Serial.printf("Buffer full now processing, needed %d, is %d\n", length +  5, longPackBuffer.size());
+    }
+    return false;
+}
 
-        int pos = longPacket && length>>8 != 0 ? 3 : 2;
-        longPackBuffer = longPackBuffer.substr(pos, longPackBuffer.length()-pos);
+// the ids start out consecutive, CanBus moves a session whose id turns out to be taken
+ProxySession *BleCanProxy::session(uint8_t canId) {
+    for (ProxySession &session : sessions) {
+        if (session.canId == canId) {
+            return &session;
+        }
+    }
+    return nullptr;
+}
 
-        unsigned int end_a = 0;
-        for (unsigned int byteNum = 0; byteNum < length; byteNum += 7) {
-            if (byteNum > 255) {
-                break;
+/*
+  Round robin over the sessions, PROXY_SERVICE_CHUNK bytes each per turn, until all inbound
+  rings are empty or only hold packets that wait for the VESC's rx buffer. A client uploading
+  firmware doesn't hold up the telemetry polls of another one.
+*/
+void BleCanProxy::service() {
+    for (ProxySession &session : sessions) {
+        if (session.state.load(std::memory_order_acquire) == PROXY_SESSION_CLOSING) {
+            reset(session);
+            session.state.store(PROXY_SESSION_FREE, std::memory_order_release);
+        }
+    }
+    size_t used;
+    do {
+        used = 0;
+        for (int i = 0; i < PROXY_SESSIONS; i++) {
+            ProxySession &session = sessions[(nextSession + i) % PROXY_SESSIONS];
+            if (session.open()) {
+                used += service(session, PROXY_SERVICE_CHUNK);
             }
+        }
+        nextSession = (nextSession + 1) % PROXY_SESSIONS;
+    } while (used > 0);
+    unsigned long now = millis();
+    for (ProxySession &session : sessions) {
+        if (session.open() && session.framer.expire(now)) {
+            abandon(session);
+        }
+    }
+    processing = rxOwner != nullptr;
+}
 
-            end_a = byteNum + 7;
+size_t BleCanProxy::service(ProxySession &session, size_t budget) {
+    if (session.waiting) {
+        if (!forward(session)) {
+            return 0;
+        }
+        session.waiting = false;
+    }
+    size_t used = 0;
+    const uint8_t *data;
+    size_t size;
+    while (used < budget && !session.waiting && (size = session.in.peek(&data)) > 0) {
+        size_t taken = proxyIn(session, data, size < budget - used ? size : budget - used);
+        session.in.consume(taken);
+        used += taken;
+    }
+    return used;
+}
 
-            int sendLen = (length >= byteNum+ 7) ? 7 : length - byteNum;
-            //Serial.printf("bufLen %d, byteNum %d, sendlen %d\n", length, byteNum , sendLen);
+// a session with a complete packet goes first, a busy client can't keep the others out for long
+boolean BleCanProxy::acquireRxBuffer(ProxySession &session) {
+    if (rxOwner == &session) {
+        return true;
+    }
+    if (rxOwner != nullptr) {
+        return false;
+    }
+    for (const ProxySession &other : sessions) {
+        if (&other != &session && other.waiting && !session.waiting) {
+            return false;
+        }
+    }
+    rxOwner = &session;
+    return true;
+}
 
-            twai_message_t tx_frame = {};
-            tx_frame.extd = 1;
-            tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_FILL_RX_BUFFER) << 8) + vesc_id;
-            tx_frame.data_length_code = sendLen + 1;
-            tx_frame.data[0] = byteNum; //startbyte counter of frame
+// the client stopped in the middle of a packet, the other sessions get the rx buffer
+void BleCanProxy::abandon(ProxySession &session) {
+    if (rxOwner == &session) {
+        rxOwner = nullptr;
+    }
+    session.sent = 0;
+    session.sendFailed = false;
+    snprintf(buf, bufSize, "packet from %d incomplete for %d ms, dropped", session.canId, VESC_PACKET_TIMEOUT);
+    Logger::warning(LOG_TAG_BLE_CAN_PROXY, buf);
+}
 
+void BleCanProxy::reset(ProxySession &session) {
+    if (rxOwner == &session) {
+        rxOwner = nullptr;
+    }
+    arbiter->release(session.canId);
+    session.in.clear();
+    session.out.clear();
+    session.framer.reset();
+    session.response.clear();
+    session.sent = 0;
+    session.sendFailed = false;
+    session.waiting = false;
+}
 
-            for (int i = 1; i < sendLen+1; i++) {
-                //Serial.printf("Reading byte %d, length %d, index %d, sendlen %d\n", byteNum + i, bufLen, i, sendLen);
-                tx_frame.data[i] = (uint8_t) longPackBuffer.at(byteNum-1 + i);
-            }
-            candevice->sendCanFrame(&tx_frame);
+/*
+  The payload of a long packet goes out in FILL_RX_BUFFER frames as soon as it arrives, so
+  the bus is busy while the rest of the packet is still on its way over BLE. The VESC only
+  processes its buffer once CAN_PACKET_PROCESS_RX_BUFFER follows, which is sent when the
+  packet is complete and its checksum matched.
+  Returns the bytes taken, less than size if a complete packet has to wait for the rx buffer.
+*/
+size_t BleCanProxy::proxyIn(ProxySession &session, const uint8_t *data, size_t size) {
+    VescPacketFramer &framer = session.framer;
+    uint32_t dropped = framer.crcErrors + framer.framingErrors;
+    size_t taken = 0;
+    while (taken < size) {
+        taken += framer.feed(data + taken, size - taken, millis());
+        if (framer.started != session.streaming) {
+            session.streaming = framer.started;
+            session.sent = 0;
+            session.sendFailed = false;
         }
+        const uint8_t *payload = framer.payload();
+        uint16_t length = framer.length();
+        if (framer.receiving() && length > 6 && acquireRxBuffer(session)) {
+            fillRxBuffer(session, payload, framer.received(), length);
+        }
+        if (!framer.complete()) {
+            continue;
+        }
+        if (Logger::getLogLevel() == Logger::VERBOSE) {
+            snprintf(buf, bufSize, "Proxy in from %d, command %d, length %d\n", session.canId, payload[0], length);
+            Logger::verbose(LOG_TAG_BLE_CAN_PROXY, buf);
+        }
+        uint16_t cachedLength;
+        const uint8_t *cached = cache.find(payload, length, &cachedLength);
+        if (cached != nullptr) {
+            // answered without a round trip, the VESC never sees the request
+            writePacket(session, cached, cachedLength);
+            continue;
+        }
+        uint8_t answer[TELEMETRY_RESPONSE_SIZE];
+        uint16_t answerLength = responder.answer(payload, length, millis(), answer);
+        if (answerLength > 0) {
+            // a telemetry poll, CanBus has a fresh enough sample of the same values
+            writePacket(session, answer, answerLength);
+            continue;
+        }
+        if (!forward(session)) {
+            session.waiting = true;
+            break;
+        }
+    }
+    if (rxOwner == &session && !framer.receiving() && !session.waiting) {
+        // a corrupt or abandoned packet, let the next session have the rx buffer
+        rxOwner = nullptr;
+    }
+    if (framer.crcErrors + framer.framingErrors != dropped) {
+        snprintf(buf, bufSize, "dropped corrupt packet from BLE, %" PRIu32 " crc errors, %" PRIu32 " framing errors",
+                 framer.crcErrors, framer.framingErrors);
+        Logger::warning(LOG_TAG_BLE_CAN_PROXY, buf);
+    }
+    return taken;
+}
 
-        for (unsigned int byteNum = end_a; byteNum<length; byteNum += 6) {
-            int sendLen = (length >= byteNum + 6) ? 6 : length - byteNum ;
-            //Serial.printf("bufLen %d, byteNum %d, sendlen %d\n", length, byteNum , sendLen);
-
-            twai_message_t tx_frame = {};
-            tx_frame.extd = 1;
-            tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_FILL_RX_BUFFER_LONG) << 8) + vesc_id;
-            tx_frame.data_length_code= sendLen + 2;
-            tx_frame.data[0] = byteNum >> 8;
-            tx_frame.data[1] = byteNum & 0xFF;
+/*
+  Sends the complete packet of the session to the VESC, false while another session fills its
+  rx buffer or holds the VESC with a blocking command. Only the final PROCESS frame decides
+  where the VESC answers, the FILL_RX_BUFFER frames may already be out.
+*/
+boolean BleCanProxy::forward(ProxySession &session) {
+    const uint8_t *payload = session.framer.payload();
+    uint16_t length = session.framer.length();
+    unsigned long now = millis();
+    if (length <= 6) {
+        if (!arbiter->canSend(session.canId, now)) {
+            return false;
+        }
+        cache.requested(payload, length);
+        sendShortBuffer(session, payload, length);
+        arbiter->sent(session.canId, payload[0], now);
+        return true;
+    }
+    if (!acquireRxBuffer(session) || !arbiter->canSend(session.canId, now)) {
+        return false;
+    }
+    cache.requested(payload, length);
+    fillRxBuffer(session, payload, length, length);
+    processRxBuffer(session, length, session.framer.crc());
+    arbiter->sent(session.canId, payload[0], now);
+    rxOwner = nullptr;
+    return true;
+}
 
-            for (int i = 2; i < sendLen+2; i++) {
-                //Serial.printf("Reading byte %d, length %d, index %d, sendlen %d\n", byteNum + i, bufLen, i, sendLen);
-                tx_frame.data[i] = (uint8_t) longPackBuffer.at(byteNum-2 + i);
-            }
+// the whole packet in one frame, the VESC processes it without a checksum
+void BleCanProxy::sendShortBuffer(ProxySession &session, const uint8_t *payload, uint16_t length) {
+    twai_message_t tx_frame = {};
+    tx_frame.extd = 1;
+    tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_PROCESS_SHORT_BUFFER) << 8) + vesc_id;
+    tx_frame.data_length_code = 0x02 + length;
+    tx_frame.data[0] = session.canId;
+    tx_frame.data[1] = 0x00;
+    memcpy(&tx_frame.data[2], payload, length);
+    if (!candevice->sendCanFrame(&tx_frame, CAN_TX_PROXY)) {
+        txFailed++;
+    }
+}
 
-            candevice->sendCanFrame(&tx_frame);
+/*
+  Sends payload[sent, available) into the RX buffer of the VESC, 7 bytes per frame while the
+  offset fits into one byte and 6 bytes behind a 16 bit offset after that. A frame that
+  wouldn't be full waits for the next write unless the payload is complete.
+*/
+void BleCanProxy::fillRxBuffer(ProxySession &session, const uint8_t *payload, uint16_t available, uint16_t length) {
+    uint16_t &sent = session.sent;
+    while (sent < available && !session.sendFailed) {
+        boolean longOffset = sent > 255;
+        uint16_t frameLength = longOffset ? 6 : 7;
+        uint16_t sendLen = available - sent < frameLength ? available - sent : frameLength;
+        if (sendLen < frameLength && available < length) {
+            return;
         }
-
         twai_message_t tx_frame = {};
         tx_frame.extd = 1;
-        tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_PROCESS_RX_BUFFER) << 8) + vesc_id;
-        tx_frame.data_length_code = 6;
-        tx_frame.data[0] = ble_proxy_can_id;
-        tx_frame.data[1] = 0; // IS THIS CORRECT?????
-        tx_frame.data[2] = length >> 8;
-        tx_frame.data[3] = length & 0xFF;
-        tx_frame.data[4] = longPackBuffer.at(longPackBuffer.size() - 3);
-        tx_frame.data[5] = longPackBuffer.at(longPackBuffer.size() - 2);
-        candevice->sendCanFrame(&tx_frame);
+        if (longOffset) {
+            tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_FILL_RX_BUFFER_LONG) << 8) + vesc_id;
+            tx_frame.data_length_code = sendLen + 2;
+            tx_frame.data[0] = sent >> 8;
+            tx_frame.data[1] = sent & 0xFF;
+            memcpy(&tx_frame.data[2], payload + sent, sendLen);
+        } else {
+            tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_FILL_RX_BUFFER) << 8) + vesc_id;
+            tx_frame.data_length_code = sendLen + 1;
+            tx_frame.data[0] = sent;
+            memcpy(&tx_frame.data[1], payload + sent, sendLen);
+        }
+        if (!candevice->sendCanFrame(&tx_frame, CAN_TX_PROXY)) {
+            // a gap in the buffer, the VESC would reject the checksum anyway
+            session.sendFailed = true;
+            txFailed++;
+            Logger::error(LOG_TAG_BLE_CAN_PROXY, "transmit queue full, packet dropped");
+            return;
+        }
+        sent += sendLen;
+    }
+}
 
+void BleCanProxy::processRxBuffer(ProxySession &session, uint16_t length, uint16_t crc) {
+    if (session.sendFailed) {
+        return;
+    }
+    twai_message_t tx_frame = {};
+    tx_frame.extd = 1;
+    tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_PROCESS_RX_BUFFER) << 8) + vesc_id;
+    tx_frame.data_length_code = 6;
+    tx_frame.data[0] = session.canId;
+    tx_frame.data[1] = 0; // send the response back to the sender
+    tx_frame.data[2] = length >> 8;
+    tx_frame.data[3] = length & 0xFF;
+    tx_frame.data[4] = crc >> 8;
+    tx_frame.data[5] = crc & 0xFF;
+    if (!candevice->sendCanFrame(&tx_frame, CAN_TX_PROXY)) {
+        txFailed++;
     }
+}
 
-    length = 0;
-    command = 0;
-    processing = false;
-    longPacket = false;
-    longPackBuffer = "";
+void BleCanProxy::proxyOut(ProxySession &session, const uint8_t *data, unsigned int size) {
+    if (size > 0) {
+        arbiter->answered(session.canId, data[0]);
+    }
+    cache.responded(data, size);
+    responder.learn(data, size, millis());
+    writePacket(session, data, size);
 }
 
-void BleCanProxy::proxyOut(uint8_t *data, unsigned int size, uint8_t crc1, uint8_t crc2) {
-    if (size > BUFFER_SIZE) {
+/*
+  The VESC announces length and checksum of a response only in its last frame, so responses
+  are framed once CanBus has reassembled them and go to the outbound ring in three bulk writes.
+  The ring only ever takes whole packets, a client that doesn't keep up loses responses, not
+  parts of them.
+*/
+void BleCanProxy::writePacket(ProxySession &session, const uint8_t *data, unsigned int size) {
+    if (size == 0 || size > VESC_PACKET_MAX_PAYLOAD) {
         Logger::error(LOG_TAG_BLE_CAN_PROXY, "proxyOut - Buffer size exceeded, abort (message not sent via proxy)");
         return;
     }
@@ -134,47 +331,47 @@ void BleCanProxy::proxyOut(uint8_t *data, unsigned int size, uint8_t crc1, uint8
         Logger::verbose(LOG_TAG_BLE_CAN_PROXY, buf);
     }
     //Start bit, package size
+    uint8_t header[3];
+    size_t headerLength = 0;
     if (size <= 255) {
-        //Serial.print(0x02);
-        stream->write(0x02);
-        // size
-        //Serial.print(size);
-        stream->write(size);
-    } else if (size <= 65535) {
-        //Serial.print(0x03);
-        stream->write(0x03);
-        // size
-        //Serial.print(size >> 8);
-        //Serial.print(size & 0xFF);
-        stream->write(size >> 8);
-        stream->write(size & 0xFF);
+        header[headerLength++] = 0x02;
     } else {
-        //Serial.print(0x04);
-        stream->write(0x04);
-        // size
-        //Serial.print(size >> 16);
-        //Serial.print((size >> 8) & 0x0F);
-        //Serial.print(size & 0xFF);
-        stream->write(size >> 16);
-        stream->write((size >> 8) & 0x0F);
-        stream->write(size & 0xFF);
-    }
-
-    // data
-    for (int i = 0; i < size; i++) {
-        //Serial.print(data[i]);
-        stream->write(data[i]);
-    }
-
-    //crc 2 byte
-    //Serial.print(crc1);
-    //Serial.print(crc2);
-    stream->write(crc1);
-    stream->write(crc2);
-
-    // Stop bit
-    //Serial.print(0x03);
-    stream->write(0x03);
-
-    //Serial.println("");
+        header[headerLength++] = 0x03;
+        header[headerLength++] = size >> 8;
+    }
+    header[headerLength++] = size & 0xFF;
+    if (!session.open()) {
+        // the client disconnected while its request was on the bus
+        return;
+    }
+    ByteRing<PROXY_TX_RING_SIZE> &out = session.out;
+    if (out.space() < headerLength + size + 3) {
+        txDropped++;
+        Logger::warning(LOG_TAG_BLE_CAN_PROXY, "BLE client doesn't keep up, response dropped");
+        return;
+    }
+    out.write(header, headerLength);
+
+    out.write(data, size);
+
+    //crc 2 byte, stop bit
+    uint16_t crc = crc16(data, size);
+    uint8_t trailer[] = {(uint8_t) (crc >> 8), (uint8_t) (crc & 0xFF), 0x03};
+    out.write(trailer, sizeof(trailer));
+    packetsOut++;
+}
+
+int BleCanProxy::format(char *out, int size) const {
+    uint32_t packetsIn = 0, crcErrors = 0, framingErrors = 0, skippedBytes = 0, rxDropped = 0;
+    for (const ProxySession &session : sessions) {
+        packetsIn += session.framer.packets;
+        crcErrors += session.framer.crcErrors;
+        framingErrors += session.framer.framingErrors + session.framer.timeouts;
+        skippedBytes += session.framer.skippedBytes;
+        rxDropped += session.in.droppedBytes();
+    }
+    return snprintf(out, size, "%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32
+                               ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32,
+                    packetsIn, packetsOut, crcErrors, framingErrors, skippedBytes, txFailed,
+                    cache.hits, cache.misses, responder.answered, rxDropped, txDropped);
 }
@@ -5,29 +5,75 @@
 #include "config.h"
 #include <Logger.h>
 #include "VescCanConstants.h"
-#include "LoopbackStream.h"
+#include "ProxySession.h"
 #include "CanDevice.h"
+#include "ProxyResponseCache.h"
+#include "TelemetryResponder.h"
+#include "VescArbiter.h"
 
 #define LOG_TAG_BLE_CAN_PROXY "BleCanProxy"
 
+#ifndef PROXY_SERVICE_CHUNK
+#define PROXY_SERVICE_CHUNK 512 // bytes of one session framed before the next session's turn
+#endif //PROXY_SERVICE_CHUNK
+
+/*
+  Forwards the VESC packets of up to PROXY_SESSIONS BLE clients over CAN and frames the
+  responses for each of them. The BLE task only puts the bytes it received into the inbound
+  ring of the client's session, they are framed and sent by service() on the loop task together
+  with everything else that touches the bus. Responses wait in the session's outbound ring
+  until BleServer::loop() notifies them to that connection.
+  The VESC has a single buffer for FILL_RX_BUFFER transfers, whichever sender fills it, so only
+  one session at a time streams a long packet and the others queue behind it. Short packets,
+  cache hits and synthesized answers never wait. A session that stops in the middle of a packet
+  for VESC_PACKET_TIMEOUT ms gives the buffer up. Cache and responder are shared, a client
+  changing the configuration invalidates it for all of them. While a blocking command of one
+  session is outstanding, the requests of the others wait, see VescArbiter.
+*/
 class BleCanProxy {
   public:
-    BleCanProxy(CanDevice *candevice, Stream *stream, uint8_t vesc_id, uint8_t ble_proxy_can_id);
-    void proxyIn(std::string in);
-    void proxyOut(uint8_t *data, unsigned int size, uint8_t crc1, uint8_t crc2);
-    boolean processing = false;
+    BleCanProxy(CanDevice *candevice, uint8_t vesc_id, uint8_t ble_proxy_can_id,
+                const VescSnapshot<VescTelemetry> *telemetry, VescArbiter *arbiter);
+    // a BLE client connected, nullptr if all sessions are taken. BLE task
+    ProxySession *open(uint16_t connection);
+    // the client disconnected, its session is cleaned up by the next service(). BLE task
+    void close(uint16_t connection);
+    // bytes of one BLE write, packets may be split over several writes or share one. BLE task
+    boolean receive(uint16_t connection, const uint8_t *data, size_t size);
+    // frames and forwards what was received since the last call, loop task
+    void service();
+    // the session a frame addressed to canId belongs to, nullptr if it is not a proxy id
+    ProxySession *session(uint8_t canId);
+    // a response payload, framed and checksummed for the client of the session
+    void proxyOut(ProxySession &session, const uint8_t *data, unsigned int size);
+    // packetsIn;packetsOut;crcErrors;framingErrors;skippedBytes;txFailed;cacheHits;cacheMisses;synthesized;rxDropped;txDropped
+    int format(char *out, int size) const;
+    boolean processing = false; // a long packet is on its way to the VESC
+    uint32_t packetsOut = 0;
+    uint32_t txFailed = 0;  // packets that didn't fit into the CAN transmit queue
+    uint32_t txDropped = 0; // responses that didn't fit into an outbound ring
+    ProxySession sessions[PROXY_SESSIONS];
+    ProxyResponseCache cache;
+    TelemetryResponder responder;
 
   private:
     const static int bufSize = 64;
     char buf[bufSize];
     CanDevice *candevice;
-    Stream *stream;
-    uint16_t length = 0;
-    uint8_t command = 0;
-    boolean longPacket = false;
-    std::string longPackBuffer;
+    VescArbiter *arbiter;
     uint8_t vesc_id;
-    uint8_t ble_proxy_can_id;
+    ProxySession *rxOwner = nullptr; // the session filling the VESC's rx buffer
+    uint8_t nextSession = 0;         // where the round robin of service() starts
+    size_t service(ProxySession &session, size_t budget);
+    size_t proxyIn(ProxySession &session, const uint8_t *data, size_t size);
+    boolean forward(ProxySession &session);
+    boolean acquireRxBuffer(ProxySession &session);
+    void abandon(ProxySession &session);
+    void reset(ProxySession &session);
+    void writePacket(ProxySession &session, const uint8_t *data, unsigned int size);
+    void sendShortBuffer(ProxySession &session, const uint8_t *payload, uint16_t length);
+    void fillRxBuffer(ProxySession &session, const uint8_t *payload, uint16_t available, uint16_t length);
+    void processRxBuffer(ProxySession &session, uint16_t length, uint16_t crc);
 };
 
 #endif //RESCUE_BLECANPROXY_H
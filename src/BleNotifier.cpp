@@ -0,0 +1,93 @@
+#include "BleNotifier.h"
+
+boolean BleNotifier::queue(NimBLECharacteristic *characteristic, const char *value, size_t length) {
+    if (count == BLE_NOTIFY_QUEUE_SIZE) {
+        return false;
+    }
+    Message &message = messages[(head + count) % BLE_NOTIFY_QUEUE_SIZE];
+    message.characteristic = characteristic;
+    message.length = length < BLE_NOTIFY_MESSAGE_SIZE ? length : BLE_NOTIFY_MESSAGE_SIZE;
+    memcpy(message.data, value, message.length);
+    count++;
+    return true;
+}
+
+/*
+  A message that only reached some of the subscribers before the host ran out of buffers goes
+  to all of them again, they are key=value states that don't mind being repeated.
+*/
+void BleNotifier::flush() {
+    while (count > 0) {
+        Message &message = messages[head];
+        if (!notify(message.characteristic, message.data, message.length)) {
+            return;
+        }
+        head = (head + 1) % BLE_NOTIFY_QUEUE_SIZE;
+        count--;
+    }
+}
+
+boolean BleNotifier::ready() const {
+    return !congested && os_msys_num_free() > BLE_NOTIFY_RESERVE;
+}
+
+boolean BleNotifier::notify(NimBLECharacteristic *characteristic, const uint8_t *data, size_t length) {
+    if (!ready()) {
+        congestion();
+        return false;
+    }
+    // NimBLE reports the outcome for every subscriber through onStatus, see status()
+    characteristic->notify(data, length);
+    return !congested;
+}
+
+// NimBLECharacteristic::notify() of NimBLE 1.4.1 can't address a single client
+boolean BleNotifier::notify(NimBLECharacteristic *characteristic, uint16_t connection, const uint8_t *data,
+                            size_t length) {
+    if (!ready()) {
+        congestion();
+        return false;
+    }
+    os_mbuf *om = ble_hs_mbuf_from_flat(data, length);
+    if (om == nullptr) {
+        congestion();
+        return false;
+    }
+    // onStatus isn't called for this path, the host call's result is all there is to count
+    int rc = ble_gattc_notify_custom(connection, characteristic->getHandle(), om);
+    if (rc == 0) {
+        sent++;
+    } else if (rc == BLE_HS_ENOMEM || rc == BLE_HS_EBUSY) {
+        congestion();
+        return false;
+    } else {
+        failed++;
+    }
+    // sent, or the client is gone and nobody wants the data anymore
+    return true;
+}
+
+void BleNotifier::status(NimBLECharacteristicCallbacks::Status status, int code) {
+    switch (status) {
+        case NimBLECharacteristicCallbacks::Status::SUCCESS_NOTIFY:
+            sent++;
+            break;
+        case NimBLECharacteristicCallbacks::Status::ERROR_GATT:
+            if (code == BLE_HS_ENOMEM || code == BLE_HS_EBUSY) {
+                congestion();
+            } else {
+                failed++;
+            }
+            break;
+        default:
+            // no subscriber, indications
+            break;
+    }
+}
+
+void BleNotifier::congestion() {
+    if (!congested) {
+        congested = true;
+        congestions++;
+    }
+}
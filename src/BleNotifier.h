@@ -0,0 +1,60 @@
+#ifndef RESCUE_BLENOTIFIER_H
+#define RESCUE_BLENOTIFIER_H
+
+#include "Arduino.h"
+#include <NimBLEDevice.h>
+
+#ifndef BLE_NOTIFY_QUEUE_SIZE
+#define BLE_NOTIFY_QUEUE_SIZE 16 // status and configuration messages waiting for the BLE host
+#endif //BLE_NOTIFY_QUEUE_SIZE
+
+#define BLE_NOTIFY_MESSAGE_SIZE 128 // "key=value" messages, longer ones are cut off
+
+#ifndef BLE_NOTIFY_RESERVE
+#define BLE_NOTIFY_RESERVE 2 // mbufs left to the BLE host for its own traffic, e.g. write responses
+#endif //BLE_NOTIFY_RESERVE
+
+/*
+  Sends notifications as fast as the BLE host takes them instead of one per delay(). Every
+  notification holds an mbuf of the host's fixed pool until the controller sent it over the air,
+  so a pool that runs dry (BLE_HS_ENOMEM, from the host call or reported through onStatus) means
+  the link is at capacity. The notifier then stops until the next loop and the producers keep
+  their data: queue() refuses new messages, the proxy and UART rings stay filled.
+  Only used from the loop task, no synchronization.
+*/
+class BleNotifier {
+  public:
+    // a message to every subscriber of the characteristic, false if the queue is full
+    boolean queue(NimBLECharacteristic *characteristic, const char *value, size_t length);
+    // sends queued messages until the queue is empty or the link is congested
+    void flush();
+    // a notification to every subscriber, right away. false if it has to be sent again later
+    boolean notify(NimBLECharacteristic *characteristic, const uint8_t *data, size_t length);
+    // a notification to one client, right away. false if it has to be sent again later
+    boolean notify(NimBLECharacteristic *characteristic, uint16_t connection, const uint8_t *data, size_t length);
+    // the host has buffers for another notification
+    boolean ready() const;
+    // a new loop, the host had time to send what it took so far
+    void resume() { congested = false; }
+    // NimBLECharacteristicCallbacks::onStatus of a notification
+    void status(NimBLECharacteristicCallbacks::Status status, int code);
+    boolean pending() const { return count > 0; }
+
+    uint32_t sent = 0;
+    uint32_t congestions = 0; // times the host ran out of buffers
+    uint32_t failed = 0;      // notifications the host refused for other reasons
+
+  private:
+    struct Message {
+        NimBLECharacteristic *characteristic;
+        uint8_t length;
+        uint8_t data[BLE_NOTIFY_MESSAGE_SIZE];
+    };
+    Message messages[BLE_NOTIFY_QUEUE_SIZE];
+    uint8_t head = 0;
+    uint8_t count = 0;
+    boolean congested = false;
+    void congestion();
+};
+
+#endif //RESCUE_BLENOTIFIER_H
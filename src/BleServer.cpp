@@ -14,6 +14,8 @@ NimBLECharacteristic *pCharacteristicFw = nullptr;
 NimBLECharacteristic *pCharacteristicLoop = nullptr;
 NimBLECharacteristic *pCharacteristicId = nullptr;
 NimBLECharacteristic *pCharacteristicVersion = nullptr;
+NimBLECharacteristic *pCharacteristicCan = nullptr;
+NimBLECharacteristic *pCharacteristicTelemetry = nullptr;
 char tmpbuf[1024]; // CAUTION: always use a global buffer, local buffer will flood the stack
 
 
@@ -21,12 +23,15 @@ bool deviceConnected = false;
 bool oldDeviceConnected = false;
 uint32_t value = 0;
 Stream *vescSerial;
-std::string vescBuffer;
+ByteRing<BLE_UART_RING_SIZE> vescOut; // what the VESC sent over UART, waiting for a notification
+BleNotifier notifier;
+int configSent = 0; // configuration values already queued by sendConfig()
+TelemetryFrame telemetryFrame;
 std::string updateBuffer;
 unsigned long bleLoop = 0;
+unsigned long bleCanLoop = 0;
 unsigned long loopTimeSum = 0;
 unsigned long loopCount = 0;
-unsigned int bleWait = 5;
 
 BleServer::BleServer() = default;
 
@@ -40,14 +45,23 @@ void BleServer::onConnect(NimBLEServer *pServer, ble_gap_conn_desc *desc) {
     Logger::notice(LOG_TAG_BLESERVER, buf);
     Logger::notice(LOG_TAG_BLESERVER, "Multi-connect support: start advertising");
     deviceConnected = true;
+#ifdef CANBUS_ONLY
+    if (canbus->proxy->open(desc->conn_handle) == nullptr) {
+        Logger::warning(LOG_TAG_BLESERVER, "no proxy session left, the client can't reach the VESC");
+    }
+#endif
     NimBLEDevice::startAdvertising();
 }
 
 // NimBLEServerCallbacks::onDisconnect
 inline
-void BleServer::onDisconnect(NimBLEServer *pServer) {
+void BleServer::onDisconnect(NimBLEServer *pServer, ble_gap_conn_desc *desc) {
     Logger::notice(LOG_TAG_BLESERVER, "Client disconnected - start advertising");
-    deviceConnected = false;
+#ifdef CANBUS_ONLY
+    canbus->proxy->close(desc->conn_handle);
+#endif
+    // other clients may still be connected
+    deviceConnected = pServer->getConnectedCount() > 0;
     NimBLEDevice::startAdvertising();
 }
 
@@ -148,6 +162,24 @@ void BleServer::init(Stream *vesc) {
     pCharacteristicVersion->setValue((uint8_t *) hardwareVersion, 5);
     pCharacteristicVersion->setCallbacks(this);
 
+#if defined(CANBUS_ENABLED)
+    pCharacteristicCan = pServiceRescue->createCharacteristic(
+            RESCUE_CHARACTERISTIC_UUID_CAN,
+            NIMBLE_PROPERTY::NOTIFY |
+            NIMBLE_PROPERTY::READ
+    );
+    pCharacteristicCan->setCallbacks(this);
+
+    pCharacteristicTelemetry = pServiceRescue->createCharacteristic(
+            RESCUE_CHARACTERISTIC_UUID_TELEMETRY,
+            NIMBLE_PROPERTY::NOTIFY |
+            NIMBLE_PROPERTY::READ |
+            NIMBLE_PROPERTY::WRITE |
+            NIMBLE_PROPERTY::WRITE_NR
+    );
+    pCharacteristicTelemetry->setCallbacks(this);
+#endif
+
     // Start the VESC service
     pServiceVesc->start();
     pServiceRescue->start();
@@ -168,29 +200,18 @@ void BleServer::loop(VescData *vescData, unsigned long loopTime, unsigned long m
     loopCount++;
     loopTimeSum += loopTime;
     
-    if (vescSerial->available()) {
-        int oneByte;
-        while (vescSerial->available()) {
-            oneByte = vescSerial->read();
-            vescBuffer.push_back(oneByte);
-        }
-
-        if (deviceConnected) {
-            while (vescBuffer.length() > 0) {
-                if (vescBuffer.length() > PACKET_SIZE) {
-                    dumpBuffer("VESC => BLE/UART", vescBuffer.substr(0, PACKET_SIZE));
-                    pCharacteristicVescTx->setValue(vescBuffer.substr(0, PACKET_SIZE));
-                    vescBuffer = vescBuffer.substr(PACKET_SIZE);
-                } else {
-                    dumpBuffer("VESC => BLE/UART", vescBuffer);
-                    pCharacteristicVescTx->setValue(vescBuffer);
-                    vescBuffer.clear();
-                }
-                pCharacteristicVescTx->notify();
-                delay(bleWait); // bluetooth stack will go into congestion, if too many packets are sent
-            }
-        }
+#ifndef CANBUS_ONLY
+    // only as much as the ring takes, the rest waits in the UART driver until the link caught up
+    uint8_t chunk[64];
+    size_t length;
+    while ((length = std::min((size_t) vescSerial->available(), std::min((size_t) vescOut.space(), sizeof(chunk)))) > 0) {
+        vescSerial->readBytes(chunk, length);
+        vescOut.write(chunk, length);
     }
+    if (!deviceConnected) {
+        vescOut.clear();
+    }
+#endif //CANBUS_ONLY
 
     // disconnecting
     if (!deviceConnected && oldDeviceConnected) {
@@ -205,12 +226,25 @@ void BleServer::loop(VescData *vescData, unsigned long loopTime, unsigned long m
         oldDeviceConnected = deviceConnected;
     }
 
+    flushNotifications();
+#ifdef CANBUS_ENABLED
+    if (deviceConnected && telemetryFrame.due(millis())) {
+        notifyTelemetry(vescData);
+    }
+#endif
+
     if (millis() - bleLoop > 500) {
         updateRescueApp(loopCount, loopTimeSum/loopCount, maxLoopTime);
         bleLoop = millis();
         loopTimeSum = 0;
         loopCount = 0;
     }
+#ifdef CANBUS_ENABLED
+    if (deviceConnected && millis() - bleCanLoop > CAN_METRICS_INTERVAL) {
+        updateCanMetrics();
+        bleCanLoop = millis();
+    }
+#endif
 }
 
 void BleServer::stop() {
@@ -228,8 +262,54 @@ void BleServer::dumpBuffer(std::string header, std::string buffer) {
     Logger::verbose(LOG_TAG_BLESERVER, tmpbuf);
 }
 
+/*
+  Queued messages first, then the VESC stream in notifications of at most MTU - 3 bytes straight
+  out of the rings, until everything is sent or the BLE host is out of buffers. What is left
+  goes out in the next loop.
+*/
+void BleServer::flushNotifications() {
+    notifier.resume();
+    notifier.flush();
+    const uint8_t *data;
+    size_t length;
+#ifdef CANBUS_ONLY
+    // one notification per proxy session and turn, a large response to one client doesn't hold up the others
+    boolean notified;
+    do {
+        notified = false;
+        for (ProxySession &session : canbus->proxy->sessions) {
+            length = session.open() ? session.out.peek(&data) : 0;
+            if (length == 0) {
+                continue;
+            }
+            uint16_t mtu = pServer->getPeerMTU(session.connection);
+            size_t packetSize = mtu > 3 ? mtu - 3 : 20;
+            length = length > packetSize ? packetSize : length;
+            if (!notifier.notify(pCharacteristicVescTx, session.connection, data, length)) {
+                return;
+            }
+            if (Logger::getLogLevel() == Logger::VERBOSE) {
+                dumpBuffer("VESC => BLE/UART", std::string((const char *) data, length));
+            }
+            session.out.consume(length);
+            notified = true;
+        }
+    } while (notified);
+#else
+    while ((length = vescOut.peek(&data)) > 0 && notifier.ready()) {
+        length = length > PACKET_SIZE ? PACKET_SIZE : length;
+        if (Logger::getLogLevel() == Logger::VERBOSE) {
+            dumpBuffer("VESC => BLE/UART", std::string((const char *) data, length));
+        }
+        // consumed even if some subscribers missed it, a repeated chunk would corrupt the stream of the others
+        notifier.notify(pCharacteristicVescTx, data, length);
+        vescOut.consume(length);
+    }
+#endif //CANBUS_ONLY
+}
+
 //NimBLECharacteristicCallbacks::onWrite
-void BleServer::onWrite(BLECharacteristic *pCharacteristic) {
+void BleServer::onWrite(BLECharacteristic *pCharacteristic, ble_gap_conn_desc *desc) {
     snprintf(buf, bufSize, "onWrite to characteristics: %s", pCharacteristic->getUUID().toString().c_str());
     Logger::verbose(LOG_TAG_BLESERVER, buf);
     std::string rxValue = pCharacteristic->getValue();
@@ -238,7 +318,9 @@ void BleServer::onWrite(BLECharacteristic *pCharacteristic) {
             dumpBuffer("BLE/UART => VESC: ", rxValue);
 
 #ifdef CANBUS_ONLY
-          canbus->proxy->proxyIn(rxValue);
+          if (!canbus->proxy->receive(desc->conn_handle, (const uint8_t *) rxValue.data(), rxValue.length())) {
+              Logger::warning(LOG_TAG_BLESERVER, "BLE proxy busy, write dropped");
+          }
 #else
             for (int i = 0; i < rxValue.length(); i++) {
                 vescSerial->write(rxValue[i]);
@@ -347,6 +429,18 @@ void BleServer::onWrite(BLECharacteristic *pCharacteristic) {
                     snprintf(buf, bufSize, "New MTU-size: %d", mtu);
                     Logger::warning(LOG_TAG_BLESERVER, buf);
                 }
+            } else if (key == "canPollBudget") {
+                AppConfiguration::getInstance()->config.canPollBudget = parseInt(value);
+#ifdef CANBUS_ENABLED
+            } else if (key == "canCapture") {
+                if (value == "start") {
+                    canbus->getRecorder()->start();
+                } else if (value == "stop") {
+                    canbus->getRecorder()->stop();
+                } else if (value == "flush") {
+                    canbus->getRecorder()->requestFlush();
+                }
+#endif
             } else if(key == "lightsSwitch") {
                 AppConfiguration::getInstance()->config.lightsSwitch = ("true" == value);
             } else if(key == "update"){
@@ -356,9 +450,18 @@ void BleServer::onWrite(BLECharacteristic *pCharacteristic) {
                 }
             }
             Logger::notice(LOG_TAG_BLESERVER, buf);
+#ifdef CANBUS_ENABLED
+        } else if (pCharacteristic->getUUID().equals(pCharacteristicTelemetry->getUUID())) {
+            if (telemetryFrame.configure((const uint8_t *) rxValue.data(), rxValue.length())) {
+                snprintf(buf, bufSize, "Telemetry frames every %d ms, fields 0x%04x", telemetryFrame.interval(),
+                         telemetryFrame.mask());
+                Logger::notice(LOG_TAG_BLESERVER, buf);
+            } else {
+                Logger::warning(LOG_TAG_BLESERVER, "Telemetry settings need interval and field mask");
+            }
+#endif
         }
     }
-    delay(bleWait); // needed to give BLE stack some time
 }
 
 //NimBLECharacteristicCallbacks::onSubscribe
@@ -371,6 +474,7 @@ void BleServer::onSubscribe(NimBLECharacteristic *pCharacteristic, ble_gap_conn_
 
 //NimBLECharacteristicCallbacks::onStatus
 void BleServer::onStatus(NimBLECharacteristic *pCharacteristic, Status status, int code) {
+    notifier.status(status, code);
     if(Logger::getLogLevel() == Logger::VERBOSE) {
         snprintf(buf, bufSize, "Notification/Indication characteristics: %s, status code: %d, return code: %d", 
         pCharacteristic->getUUID().toString().c_str(), status, code);
@@ -383,14 +487,48 @@ void BleServer::updateRescueApp(long count, long loopTime, long maxLoopTime) {
     this->sendValue(pCharacteristicLoop, "loopTime", buf);
 }
 
+#ifdef CANBUS_ENABLED
+void BleServer::updateCanMetrics() {
+    canbus->metrics.format(buf, bufSize);
+    this->sendValue(pCharacteristicCan, "canMetrics", buf);
+    canbus->broadcasts.format(buf, bufSize);
+    this->sendValue(pCharacteristicCan, "canStatusIntervals", buf);
+    canbus->proxy->format(buf, bufSize);
+    this->sendValue(pCharacteristicCan, "canProxy", buf);
+    snprintf(buf, bufSize, "%" PRIu32 ";%" PRIu32 ";%" PRIu32, notifier.sent, notifier.congestions, notifier.failed);
+    this->sendValue(pCharacteristicCan, "bleNotify", buf);
+}
+
+/*
+  The binary telemetry frame of the last whole CanBus::loop(). While the host is out of buffers
+  nothing is packed, the next loop sends a fresh sample instead of queueing a stale one. All
+  clients get the same notification, so it only holds what fits the smallest MTU of them.
+*/
+void BleServer::notifyTelemetry(const VescData *vescData) {
+    uint8_t frame[TELEMETRY_FRAME_MAX_SIZE];
+    if (!notifier.ready()) {
+        return;
+    }
+    size_t packetSize = TELEMETRY_FRAME_MAX_SIZE;
+    for (uint16_t connection : pServer->getPeerDevices()) {
+        uint16_t mtu = pServer->getPeerMTU(connection);
+        size_t size = mtu > 3 ? mtu - 3 : 20;
+        packetSize = size < packetSize ? size : packetSize;
+    }
+    unsigned long now = millis();
+    size_t length = telemetryFrame.next(vescData->snapshot.read(), now, frame, packetSize);
+    pCharacteristicTelemetry->setValue(frame, length);
+    notifier.notify(pCharacteristicTelemetry, frame, length);
+}
+#endif
+
 template<typename TYPE>
 void BleServer::sendValue(NimBLECharacteristic *pCharacteristic, std::string key, TYPE value) {
     std::stringstream ss;
     ss << key << "=" << value;
-    pCharacteristic->setValue(ss.str());
-    pCharacteristic->notify();
-    ss.str("");
-    delay(bleWait);
+    std::string message = ss.str();
+    // periodic values, if the queue is full the next one is more recent anyway
+    notifier.queue(pCharacteristic, message.data(), message.size());
 }
 
 static boolean isStringType(String a) { return true; }
@@ -414,6 +552,8 @@ double BleServer::parseDouble(const std::string& strValue) {
 struct BleServer::sendConfigValue {
     NimBLECharacteristic *pCharacteristic;
     std::stringstream ss;
+    int index = 0;
+    boolean full = false;
 
     explicit sendConfigValue(NimBLECharacteristic *pCharacteristic) {
         this->pCharacteristic = pCharacteristic;
@@ -421,19 +561,32 @@ struct BleServer::sendConfigValue {
 
     template<typename T>
     void operator()(const char *name, const T &value) {
+        if (index++ < configSent || full) {
+            return;
+        }
         if (isStringType(value)) {
             ss << name << "=" << static_cast<String>(value).c_str();
         } else {
             ss << name << "=" << value;
         }
-        Serial.println("Sending: " + String(ss.str().c_str()));
-        pCharacteristic->setValue(ss.str());
-        pCharacteristic->notify();
+        std::string message = ss.str();
         ss.str("");
-        delay(bleWait);
+        if (!notifier.queue(pCharacteristic, message.data(), message.size())) {
+            full = true;
+            return;
+        }
+        Serial.println("Sending: " + String(message.c_str()));
+        configSent++;
     }
 };
 
-void BleServer::sendConfig() {
-    visit_struct::for_each(AppConfiguration::getInstance()->config, sendConfigValue(pCharacteristicConf));
-}
\ No newline at end of file
+// queues the configuration values that fit, true once all of them are on their way
+boolean BleServer::sendConfig() {
+    sendConfigValue sender(pCharacteristicConf);
+    visit_struct::for_each(AppConfiguration::getInstance()->config, sender);
+    if (sender.full) {
+        return false;
+    }
+    configSent = 0;
+    return true;
+}
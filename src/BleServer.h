@@ -8,9 +8,16 @@
 #include "Buzzer.h"
 #include <NimBLEDevice.h>
 #include "base64.h"
+#include "BleNotifier.h"
+#include "ByteRing.h"
+#include "TelemetryFrame.h"
 
 #define LOG_TAG_BLESERVER "BleServer"
 
+#ifndef BLE_UART_RING_SIZE
+#define BLE_UART_RING_SIZE 2048 // bytes from the VESC UART waiting for a notification, power of two
+#endif //BLE_UART_RING_SIZE
+
 #define VESC_SERVICE_UUID            "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"
 #define VESC_CHARACTERISTIC_UUID_RX  "6E400002-B5A3-F393-E0A9-E50E24DCCA9E"
 #define VESC_CHARACTERISTIC_UUID_TX  "6E400003-B5A3-F393-E0A9-E50E24DCCA9E"
@@ -21,6 +28,8 @@
 #define RESCUE_CHARACTERISTIC_UUID_FW         "99EB1514-A9E9-4024-B0A4-3DC4B4FABFB0"
 #define RESCUE_CHARACTERISTIC_UUID_HW_VERSION "99EB1515-A9E9-4024-B0A4-3DC4B4FABFB0"
 #define RESCUE_CHARACTERISTIC_UUID_LOOP       "99EB1516-A9E9-4024-B0A4-3DC4B4FABFB0"
+#define RESCUE_CHARACTERISTIC_UUID_CAN        "99EB1517-A9E9-4024-B0A4-3DC4B4FABFB0"
+#define RESCUE_CHARACTERISTIC_UUID_TELEMETRY  "99EB1518-A9E9-4024-B0A4-3DC4B4FABFB0"
 
 class BleServer :
   public NimBLEServerCallbacks,
@@ -37,23 +46,28 @@ class BleServer :
 
       // NimBLEServerCallbacks
       void onConnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) override;
-      void onDisconnect(NimBLEServer* pServer) override;
+      void onDisconnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) override;
       void onMTUChange(uint16_t MTU, ble_gap_conn_desc* desc) override;
 
       // NimBLECharacteristicCallbacks
-      void onWrite(NimBLECharacteristic* pCharacteristic) override;
+      void onWrite(NimBLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc) override;
       void onSubscribe(NimBLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc, uint16_t subValue) override;
       void onStatus(NimBLECharacteristic* pCharacteristic, Status status, int code) override;
-      static void sendConfig();
+      static boolean sendConfig();
       template<typename TYPE>
       void sendValue(NimBLECharacteristic *pCharacteristic, std::string key, TYPE value);
       void updateRescueApp(long count, long loopTime, long maxLoopTime);
+#ifdef CANBUS_ENABLED
+      void updateCanMetrics();
+      void notifyTelemetry(const VescData *vescData);
+#endif
 
     private:
       const static int bufSize = 256;
       char buf[bufSize];
       CanBus *canbus{};
       struct sendConfigValue;
+      void flushNotifications();
       static void dumpBuffer(std::string header, std::string buffer);
       static int parseInt(const std::string& strValue);
       static double parseDouble(const std::string& strValue);
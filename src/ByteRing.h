@@ -0,0 +1,82 @@
+#ifndef RESCUE_BYTERING_H
+#define RESCUE_BYTERING_H
+
+#include "Arduino.h"
+#include <atomic>
+
+/*
+  Lock-free single-producer/single-consumer ring of bytes, written and read in spans instead
+  of byte by byte. The consumer peeks at the waiting bytes in place (e.g. to hand them to a BLE
+  notification) and consumes what it used. A write either fits completely or is dropped and
+  counted, so a packet is never cut off in the middle. Size must be a power of two.
+*/
+template<uint32_t Size>
+class ByteRing {
+  public:
+    boolean write(const uint8_t *data, size_t size) {
+        uint32_t head = this->head.load(std::memory_order_relaxed);
+        uint32_t tail = this->tail.load(std::memory_order_acquire);
+        if (size > Size - (head - tail)) {
+            dropped.fetch_add(size, std::memory_order_relaxed);
+            return false;
+        }
+        uint32_t offset = head & MASK;
+        size_t first = size < Size - offset ? size : Size - offset;
+        memcpy(bytes + offset, data, first);
+        memcpy(bytes, data + first, size - first);
+        this->head.store(head + size, std::memory_order_release);
+        if (head + size - tail > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(head + size - tail, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // the oldest waiting bytes that are contiguous in memory, the rest follows after consume()
+    size_t peek(const uint8_t **data) const {
+        uint32_t tail = this->tail.load(std::memory_order_relaxed);
+        uint32_t head = this->head.load(std::memory_order_acquire);
+        uint32_t offset = tail & MASK;
+        *data = bytes + offset;
+        uint32_t waiting = head - tail;
+        return waiting < Size - offset ? waiting : Size - offset;
+    }
+
+    void consume(size_t size) {
+        uint32_t tail = this->tail.load(std::memory_order_relaxed);
+        uint32_t head = this->head.load(std::memory_order_acquire);
+        this->tail.store(tail + (size < head - tail ? size : head - tail), std::memory_order_release);
+    }
+
+    // consumer side only
+    void clear() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    uint32_t available() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    uint32_t space() const {
+        return Size - available();
+    }
+
+    uint32_t droppedBytes() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    // most bytes that were waiting at the same time
+    uint32_t highWaterMark() const {
+        return highWater.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static_assert((Size & (Size - 1)) == 0, "ByteRing size must be a power of two");
+    const static uint32_t MASK = Size - 1;
+    uint8_t bytes[Size];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<uint32_t> highWater{0};
+};
+
+#endif //RESCUE_BYTERING_H
@@ -1,59 +1,158 @@
 #include "CanBus.h"
 
+// the configured voltage correction in the 1/10 V of VescTelemetry::inputVoltage
+static int16_t batteryDrift() {
+    decltype(VescTelemetry::inputVoltage) drift;
+    drift.set(AppConfiguration::getInstance()->config.batteryDrift);
+    return drift.raw;
+}
+
 CanBus::CanBus(VescData *vescData) {
     this->vescData = vescData;
-    this->stream = new LoopbackStream(BUFFER_SIZE);
 }
 
 void CanBus::init() {
     vesc_id = AppConfiguration::getInstance()->config.vescId;
     esp_can_id = vesc_id + 1;
     ble_proxy_can_id = vesc_id + 2;
-    RECV_STATUS_1 = (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_STATUS) << 8) + this->vesc_id;
-    RECV_STATUS_2 = (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_STATUS_2) << 8) + this->vesc_id;
-    RECV_STATUS_3 = (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_STATUS_3) << 8) + this->vesc_id;
-    RECV_STATUS_4 = (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_STATUS_4) << 8) + vesc_id;
-    RECV_STATUS_5 = (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_STATUS_5) << 8) + vesc_id;
-
-    RECV_FILL_RX_BUFFER = (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_FILL_RX_BUFFER) << 8) + esp_can_id;
-    RECV_PROCESS_RX_BUFFER = (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_PROCESS_RX_BUFFER) << 8) + esp_can_id;
-
-    RECV_PROCESS_SHORT_BUFFER_PROXY =
-            (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_PROCESS_SHORT_BUFFER) << 8) + ble_proxy_can_id;
-    RECV_FILL_RX_BUFFER_PROXY =
-            (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_FILL_RX_BUFFER) << 8) + ble_proxy_can_id;
-    RECV_FILL_RX_BUFFER_LONG_PROXY =
-            (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_FILL_RX_BUFFER_LONG) << 8) + ble_proxy_can_id;
-    RECV_PROCESS_RX_BUFFER_PROXY =
-            (uint32_t(0x0000) << 16) + (uint16_t(CAN_PACKET_PROCESS_RX_BUFFER) << 8) + ble_proxy_can_id;
+    addRoute(CAN_PACKET_STATUS, vesc_id, &CanBus::handleStatus1, "status1");
+    addRoute(CAN_PACKET_STATUS_2, vesc_id, &CanBus::handleStatus2, "status2");
+    addRoute(CAN_PACKET_STATUS_3, vesc_id, &CanBus::handleStatus3, "status3");
+    addRoute(CAN_PACKET_STATUS_4, vesc_id, &CanBus::handleStatus4, "status4");
+    addRoute(CAN_PACKET_STATUS_5, vesc_id, &CanBus::handleStatus5, "status5");
+    addRoute(CAN_PACKET_STATUS_6, vesc_id, &CanBus::handleStatus6, "status6");
+
+    addRoute(CAN_PACKET_FILL_RX_BUFFER, esp_can_id, &CanBus::handleFillRxBuffer, "fill rx buffer");
+    addRoute(CAN_PACKET_FILL_RX_BUFFER_LONG, esp_can_id, &CanBus::handleFillRxBuffer, "fill rx long buffer");
+    addRoute(CAN_PACKET_PROCESS_RX_BUFFER, esp_can_id, &CanBus::handleProcessRxBuffer, "process rx buffer");
+    addRoute(CAN_PACKET_PROCESS_SHORT_BUFFER, esp_can_id, &CanBus::handleProcessShortBuffer, "process short buffer");
+    addRoute(CAN_PACKET_PONG, esp_can_id, &CanBus::handlePong, "pong");
+
+    // one CAN id per proxy session, the VESC sends the responses to the id a request came from
+    for (int i = 0; i < PROXY_SESSIONS; i++) {
+        addProxyRoutes(ble_proxy_can_id + i);
+    }
+
     candevice = new CanDevice();
-    candevice->init();
-    proxy = new BleCanProxy(candevice, stream, vesc_id, ble_proxy_can_id);
+    uint8_t acceptedIds[2 + PROXY_SESSIONS] = {vesc_id, esp_can_id};
+    for (int i = 0; i < PROXY_SESSIONS; i++) {
+        acceptedIds[2 + i] = ble_proxy_can_id + i;
+    }
+    candevice->init(acceptedIds, sizeof(acceptedIds));
+    proxy = new BleCanProxy(candevice, vesc_id, ble_proxy_can_id, &vescData->snapshot, &arbiter);
+    controllers.add(vesc_id);
+
+    // request + fragments + process frame of the response
+    scheduler.setFrameCost(TELEMETRY_REALTIME, 2 + (VALUES_SELECTIVE_RESPONSE_SIZE + 6) / 7);
+    scheduler.setFrameCost(TELEMETRY_FLOAT_PACKAGE, 2 + (FLOAT_RTDATA_RESPONSE_SIZE + 6) / 7);
+    scheduler.setFrameCost(TELEMETRY_SLOW, 2 + (FW_VERSION_RESPONSE_SIZE + 6) / 7);
+    scheduler.init(AppConfiguration::getInstance()->config.canPollBudget);
+}
+
+/*
+  A status broadcast or a response of the primary controller. Secondary controllers, the BMS,
+  pongs and FILL_RX_BUFFER fragments, which don't name their sender, don't tell whether the
+  primary is still there.
+*/
+boolean CanBus::isFromPrimary(const twai_message_t &rx_frame) const {
+    uint8_t id = rx_frame.identifier & 0xFF;
+    switch ((rx_frame.identifier >> 8) & 0xFF) {
+        case CAN_PACKET_STATUS:
+        case CAN_PACKET_STATUS_2:
+        case CAN_PACKET_STATUS_3:
+        case CAN_PACKET_STATUS_4:
+        case CAN_PACKET_STATUS_5:
+        case CAN_PACKET_STATUS_6:
+            return id == vesc_id;
+        case CAN_PACKET_PROCESS_SHORT_BUFFER:
+        case CAN_PACKET_PROCESS_RX_BUFFER:
+            // data[0] is the sender
+            return id != vesc_id && rx_frame.data_length_code > 0 && rx_frame.data[0] == vesc_id;
+        default:
+            return false;
+    }
+}
+
+// hands the working copy to readers on other tasks, once per loop and only if something changed
+void CanBus::publishTelemetry(int frameCount) {
+    if (frameCount == 0 && vescData->connected == publishedConnected) {
+        return;
+    }
+    vescData->snapshot.publish(*vescData);
+    publishedConnected = vescData->connected;
+}
+
+/*
+  Drops the fields of every status the VESC broadcasts fast enough from the realtime request and
+  puts them back as soon as that status stops. Broadcast mode, with its slower realtime polls,
+  needs status 1, 4 and 5: erpm and duty, temperatures, input voltage.
+*/
+void CanBus::updateBroadcastMode(unsigned long now) {
+    uint8_t covered = broadcasts.covered(micros(), scheduler.baseInterval(TELEMETRY_REALTIME));
+    if (covered == coveredBroadcasts) {
+        return;
+    }
+    coveredBroadcasts = covered;
+    realtimeMask = pollMask(VALUES_SELECTIVE, VALUES_SELECTIVE_COUNT, covered);
+    int responseSize = 5 + payloadSize(VALUES_SELECTIVE, VALUES_SELECTIVE_COUNT, realtimeMask);
+    scheduler.setFrameCost(TELEMETRY_REALTIME, 2 + (responseSize + 6) / 7);
+    const uint8_t essential = STATUS_BIT(1) | STATUS_BIT(4) | STATUS_BIT(5);
+    scheduler.setBroadcastMode((covered & essential) == essential, now);
+    snprintf(buf, bufSize, "status broadcasts 0x%02x cover the realtime values, polling mask 0x%06" PRIx32 "%s",
+             covered, realtimeMask, scheduler.broadcastMode() ? ", broadcast mode" : "");
+    Logger::notice(LOG_TAG_CANBUS, buf);
 }
 
 /*
-  The VESC has to be configured to send status 1-5 regularly. It is recommenden to reduce the
-  interval from 50Hz to something around 1-5Hz, which is absolutely sufficient for this application.
+  Realtime values are polled with COMM_GET_VALUES_SELECTIVE. If the VESC is configured to send
+  status 1-6 regularly and at least as fast as we would poll, the broadcast fields are left out
+  of the request and the polls slow down to what the broadcasts don't carry, see updateBroadcastMode().
 */
 void CanBus::loop() {
     int frameCount = 0;
-    twai_message_t rx_frame;
+    CanFrame frame;
     unsigned long now = millis();
     if (initialized) {
-        if (lastRealtimeData <= now && now - lastRealtimeData > interval && !proxy->processing) {
-            if(!requestRealtimeData()) {
-                lastRealtimeData = (millis() + 500);
+        scheduler.update(vescData, now);
+        updateBroadcastMode(now);
+        requests.expire(now);
+        // polls only use PROCESS_SHORT_BUFFER, so they don't interfere with a proxy transfer in progress,
+        // but they wait while a proxy session's blocking command is outstanding
+        boolean vescFree = arbiter.canSend(esp_can_id, now);
+        if (scheduler.due(TELEMETRY_REALTIME, now) && vescFree && requests.canSend(vesc_id, COMM_GET_VALUES_SELECTIVE, now)) {
+            if(requestRealtimeData()) {
+                requests.sent(vesc_id, COMM_GET_VALUES_SELECTIVE, now);
+                scheduler.sent(TELEMETRY_REALTIME, now);
+            } else {
+                scheduler.backoff(TELEMETRY_REALTIME, now, 500);
                 this->vescData->connected = false;
             }
         }
 
-        if (lastBalanceData <= now && now - lastBalanceData > interval && !proxy->processing) {
-            if(!requestFloatPackageData()) {
-                lastBalanceData = (millis() + 500);
+        if (scheduler.due(TELEMETRY_FLOAT_PACKAGE, now) && vescFree && requests.canSend(vesc_id, COMM_CUSTOM_APP_DATA, now)) {
+            if(requestFloatPackageData()) {
+                requests.sent(vesc_id, COMM_CUSTOM_APP_DATA, now);
+                scheduler.sent(TELEMETRY_FLOAT_PACKAGE, now);
+            } else {
+                scheduler.backoff(TELEMETRY_FLOAT_PACKAGE, now, 500);
                 this->vescData->connected = false;
             }
         }
-    } else if(initRetryCounter > 0 && lastRetry <= now && now - lastRetry > 500) {
+
+        if (scheduler.due(TELEMETRY_SLOW, now) && vescFree && requests.canSend(vesc_id, COMM_FW_VERSION, now)) {
+            if (requestFirmwareVersion()) {
+                requests.sent(vesc_id, COMM_FW_VERSION, now, 1000);
+            }
+            scheduler.sent(TELEMETRY_SLOW, now);
+        }
+
+        // a primary that still broadcasts its status is alive even if it doesn't answer
+        if (requests.consecutiveTimeouts(vesc_id, COMM_GET_VALUES_SELECTIVE) >= 3 &&
+            now - lastPrimaryFrame > CONTROLLER_TIMEOUT) {
+            this->vescData->connected = false;
+        }
+    } else if(initRetryCounter > 0 && lastRetry <= now && now - lastRetry > 500 && arbiter.canSend(esp_can_id, now)) {
+        // a BLE client may already talk to the VESC through the proxy, its blocking commands come first
         requestFirmwareVersion();
         initRetryCounter--;
         lastRetry = millis();
@@ -64,34 +163,84 @@ void CanBus::loop() {
         }
     }
 
-    //receive next CAN frame from queue
-    while (twai_receive( &rx_frame, 3 * portTICK_PERIOD_MS) == ESP_OK) {
-        if(!this->vescData->connected) {
-            this->vescData->connected = true;
+    // what BLE clients wrote since the last loop, on this task so it doesn't race the frame handlers
+    proxy->service();
+
+#ifdef NATIVE
+    // there are no CAN tasks on the host, hand over what we just queued and fetch what arrived
+    candevice->service();
+#endif //NATIVE
+    //take the frames the CAN RX task has queued since the last loop, never blocks. If our own
+    //queue is full they stay in the ring, which drops and counts what doesn't fit anymore
+    while (!pending.full() && candevice->receive(&frame)) {
+        metrics.countRx(frame.message);
+        pending.push(frame);
+    }
+    // control and proxy frames first, then the newest status of each kind, whatever doesn't
+    // fit into the budget waits for the next loop
+    unsigned long sliceStart = micros();
+    while (frameCount < CAN_LOOP_FRAME_BUDGET && micros() - sliceStart < CAN_LOOP_TIME_BUDGET && pending.pop(&frame)) {
+        twai_message_t &rx_frame = frame.message;
+        if (isFromPrimary(rx_frame)) {
+            lastPrimaryFrame = now;
+            if (!this->vescData->connected) {
+                this->vescData->connected = true;
+                // the VESC may have been reconfigured or updated meanwhile
+                proxy->cache.clear();
+            }
         }
         if (!initialized) {
             Logger::notice(LOG_TAG_CANBUS, "CANBUS is now initialized");
             initialized = true;
         }
         frameCount++;
-        //VESC only uses ext packages, so skip std packages
-        if (rx_frame.extd) {
-            if (Logger::getLogLevel() == Logger::VERBOSE) {
-                printFrame(rx_frame, frameCount);
-            }
-            processFrame(rx_frame, frameCount);
+        // std packages are already dropped by the CanDevice acceptance filter
+        if (Logger::getLogLevel() == Logger::VERBOSE) {
+            printFrame(rx_frame, frameCount);
         }
+        frameTimestamp = frame.timestamp;
+        processFrame(rx_frame, frameCount);
         clearFrame(rx_frame);
-        if (frameCount > 1000) {
-            // WORKAROUND if messages arrive too fast
-            Logger::error(LOG_TAG_CANBUS, "reached 1000 frames in one loop, abort");
-            buffer.clear();
-            return;
-        }
     }
+    metrics.countLoop(frameCount, pending.size() + candevice->pendingFrames(), pending.coalesced);
+    boolean sampled = metrics.sample(candevice, now);
+    pollControllers();
+    publishTelemetry(frameCount);
+    // a capture the BLE client asked for is written here, the SPIFFS write must not stall the BLE task
+    candevice->recorder.loop();
     if (Logger::getLogLevel() == Logger::VERBOSE) {
         dumpVescValues();
+        if (sampled) {
+            metrics.dump();
+            broadcasts.dump();
+            requests.dumpStats();
+        }
+    }
+}
+
+/*
+  Secondary controllers (dual motor boards, a separate VESC for lights or the BMS) are found
+  by a broadcast ping, every VESC answers with a pong carrying its id. From then on their
+  status broadcasts are routed into the registry and their fault code is polled, the primary
+  controller's record is kept in sync with vescData.
+*/
+void CanBus::pollControllers() {
+    unsigned long now = millis();
+    if (initialized && now - lastPing > CONTROLLER_PING_INTERVAL) {
+        ping();
+        lastPing = now;
+    }
+    if (initialized && now - lastFaultPoll > interval) {
+        for (int i = 0; i < controllers.count(); i++) {
+            uint8_t id = controllers.at(i).id;
+            if (id != vesc_id && requests.canSend(id, COMM_GET_VALUES_SELECTIVE, now) && requestFault(id)) {
+                requests.sent(id, COMM_GET_VALUES_SELECTIVE, now);
+            }
+        }
+        lastFaultPoll = now;
     }
+    controllers.updateFromVescData(vesc_id, vescData);
+    controllers.refreshAggregates(vescData);
 }
 
 boolean CanBus::isInitialized()
@@ -99,6 +248,11 @@ boolean CanBus::isInitialized()
     return initialized;
 }
 
+CanRecorder *CanBus::getRecorder()
+{
+    return &candevice->recorder;
+}
+
 int CanBus::getInterval()
 {
     return interval;
@@ -121,7 +275,7 @@ boolean CanBus::bmsVTOT(float v_tot, float v_charge) {
     memcpy(&tx_frame.data[0], buffer, 8);
 
     // Send CAN frame
-    return candevice->sendCanFrame(&tx_frame);
+    return candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
 }
 
     /*
@@ -161,7 +315,7 @@ boolean CanBus::bmsSOCSOHTempStat(float vCellMin, float vCellMax, float SOC, flo
     memcpy(&tx_frame.data[0], buffer, 8);
 
     // Send CAN frame
-    return candevice->sendCanFrame(&tx_frame);
+    return candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
 }
 
 boolean CanBus::bmsAHWHDischargeTotal(float ampHours, float wattHours) {
@@ -177,7 +331,7 @@ boolean CanBus::bmsAHWHDischargeTotal(float ampHours, float wattHours) {
 
     memcpy(&tx_frame.data[0], buffer, 8);
     // Send CAN frame
-    return candevice->sendCanFrame(&tx_frame);
+    return candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
 }
 
 boolean CanBus::bmsAHWHChargeTotal(float ampHours, float wattHours) {
@@ -193,7 +347,7 @@ boolean CanBus::bmsAHWHChargeTotal(float ampHours, float wattHours) {
 
     memcpy(&tx_frame.data[0], buffer, 8);
     // Send CAN frame
-    return candevice->sendCanFrame(&tx_frame);
+    return candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
 }
 
 boolean CanBus::bmsAHWH(float ampHours, float wattHours) {
@@ -209,7 +363,7 @@ boolean CanBus::bmsAHWH(float ampHours, float wattHours) {
 
     memcpy(&tx_frame.data[0], buffer, 8);
     // Send CAN frame
-    return candevice->sendCanFrame(&tx_frame);
+    return candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
 }
 
 boolean CanBus::bmsI(float currentAmps) {
@@ -225,7 +379,7 @@ boolean CanBus::bmsI(float currentAmps) {
 
     memcpy(&tx_frame.data[0], buffer, 8);
     // Send CAN frame
-    return candevice->sendCanFrame(&tx_frame);
+    return candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
 }
 
 boolean CanBus::bmsBal(boolean isBalancing) {
@@ -250,7 +404,7 @@ boolean CanBus::bmsBal(boolean isBalancing) {
 
     memcpy(&tx_frame.data[0], buffer, 8);
     // Send CAN frame
-    return candevice->sendCanFrame(&tx_frame);
+    return candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
 }
 
 boolean CanBus::bmsVCell(const uint16_t* cellMillivolts, int cell_max) {
@@ -276,7 +430,7 @@ boolean CanBus::bmsVCell(const uint16_t* cellMillivolts, int cell_max) {
 		}
         memcpy(&tx_frame.data[0], buffer, 8);
         // Send CAN frame
-        candevice->sendCanFrame(&tx_frame);
+        candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
     }
     return true;
 }
@@ -304,7 +458,7 @@ boolean CanBus::bmsTemps(const int8_t* thermTemps, int temp_max) {
 		}
         memcpy(&tx_frame.data[0], buffer, 8);
         // Send CAN frame
-        candevice->sendCanFrame(&tx_frame);		
+        candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);		
     }
     twai_message_t tx_frame = {};
     // Configure CAN frame
@@ -317,7 +471,7 @@ boolean CanBus::bmsTemps(const int8_t* thermTemps, int temp_max) {
 	buffer_append_float16(buffer, 0.0f, 1e2, &send_index);
 	buffer_append_float16(buffer, thermTemps[4], 1e2, &send_index); // Put IC temp here instead of making mew msg
     memcpy(&tx_frame.data[0], buffer, 8);
-    candevice->sendCanFrame(&tx_frame);
+    candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
     return true;
 }
 
@@ -331,7 +485,7 @@ boolean CanBus::bmsState(bms_op_state op_state, bms_fault_state fault_state) {
 	int32_t send_index = 0;
 	buffer[send_index++] = op_state;
 	buffer[send_index++] = fault_state;
-    return candevice->sendCanFrame(&tx_frame);
+    return candevice->sendCanFrame(&tx_frame, CAN_TX_BMS);
 }
 
 boolean CanBus::requestFirmwareVersion() {
@@ -348,7 +502,7 @@ boolean CanBus::requestFirmwareVersion() {
 }
 
 boolean CanBus::requestRealtimeData() {
-    Logger::notice(LOG_TAG_CANBUS, "requestRealtimeData");
+    Logger::verbose(LOG_TAG_CANBUS, "requestRealtimeData");
     twai_message_t tx_frame = {};
 
     tx_frame.extd = 1;
@@ -357,11 +511,11 @@ boolean CanBus::requestRealtimeData() {
     tx_frame.data[0] = esp_can_id;
     tx_frame.data[1] = 0x00;
     tx_frame.data[2] = 0x32;      // COMM_GET_VALUES_SELECTIVE
-    // mask
-    tx_frame.data[3] = 0x00;      // Byte1 of mask (Bits 24-31)
-    tx_frame.data[4] = 0x00;      // Byte2 of mask (Bits 16-23)
-    tx_frame.data[5] = B10000111; // Byte3 of mask (Bits 8-15)
-    tx_frame.data[6] = B11000011; // Byte4 of mask (Bits 0-7)
+    // mask, the fields VALUES_SELECTIVE has a destination for and no status broadcast delivers
+    tx_frame.data[3] = (realtimeMask >> 24) & 0xFF;
+    tx_frame.data[4] = (realtimeMask >> 16) & 0xFF;
+    tx_frame.data[5] = (realtimeMask >> 8) & 0xFF;
+    tx_frame.data[6] = realtimeMask & 0xFF;
     return candevice->sendCanFrame(&tx_frame);
 }
 
@@ -379,7 +533,7 @@ boolean CanBus::requestBalanceData() {
 }
 
 boolean CanBus::requestFloatPackageData() {
-    Logger::notice(LOG_TAG_CANBUS, "requestFloatPackageData");
+    Logger::verbose(LOG_TAG_CANBUS, "requestFloatPackageData");
     twai_message_t tx_frame = {};
 
     tx_frame.extd = 1;
@@ -396,12 +550,30 @@ boolean CanBus::requestFloatPackageData() {
 void CanBus::ping() {
     twai_message_t tx_frame = {};
     tx_frame.extd = 1;
-    tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_PING) << 8) + vesc_id;
+    // 255 is the broadcast id, every controller on the bus answers
+    tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_PING) << 8) + 255;
     tx_frame.data_length_code = 0x01;
     tx_frame.data[0] = esp_can_id;
     candevice->sendCanFrame(&tx_frame);
 }
 
+// fault code only, the answer fits into a single PROCESS_SHORT_BUFFER frame
+boolean CanBus::requestFault(uint8_t controllerId) {
+    twai_message_t tx_frame = {};
+
+    tx_frame.extd = 1;
+    tx_frame.identifier = (uint32_t(0x8000) << 16) + (uint16_t(CAN_PACKET_PROCESS_SHORT_BUFFER) << 8) + controllerId;
+    tx_frame.data_length_code = 0x07;
+    tx_frame.data[0] = esp_can_id;
+    tx_frame.data[1] = 0x00;
+    tx_frame.data[2] = 0x32;      // COMM_GET_VALUES_SELECTIVE
+    tx_frame.data[3] = 0x00;      // Byte1 of mask (Bits 24-31)
+    tx_frame.data[4] = 0x00;      // Byte2 of mask (Bits 16-23)
+    tx_frame.data[5] = 0x80;      // Byte3 of mask (Bits 8-15), bit 15 = fault
+    tx_frame.data[6] = 0x00;      // Byte4 of mask (Bits 0-7)
+    return candevice->sendCanFrame(&tx_frame);
+}
+
 void CanBus::printFrame(twai_message_t rx_frame, int frameCount) {
     if (rx_frame.rtr)
         printf("#%d RTR from 0x%08x, DLC %d\r\n", frameCount, rx_frame.identifier, rx_frame.data_length_code);
@@ -430,272 +602,377 @@ void CanBus::clearFrame(twai_message_t rx_frame) {
     rx_frame.data[7]=0;
 }
 
-void CanBus::processFrame(twai_message_t rx_frame, int frameCount) {
-    String frametype = "";
-    uint32_t ID = rx_frame.identifier;
-    if (RECV_STATUS_1 == ID) {
-        frametype = "status1";
-        vescData->erpm = readInt32Value(rx_frame, 0);
-        vescData->current = readInt16Value(rx_frame, 4) / 10.0;
-        vescData->dutyCycle = readInt16Value(rx_frame, 6);
-    }
-     if (RECV_STATUS_2 == ID) {
-        frametype = "status2";
-        vescData->ampHours = readInt32Value(rx_frame, 0) / 10000.0;
-        vescData->ampHoursCharged = readInt32Value(rx_frame, 4) / 10000.0;
-    }
-     if (RECV_STATUS_3 == ID) {
-        frametype = "status3";
-        vescData->wattHours = readInt32Value(rx_frame, 0) / 10000.0;
-        vescData->wattHoursCharged = readInt32Value(rx_frame, 4) / 10000.0;
-    }
-     if (RECV_STATUS_4 == ID) {
-        frametype = "status4";
-        vescData->mosfetTemp = readInt16Value(rx_frame, 0) / 10.0;
-        vescData->motorTemp = readInt16Value(rx_frame, 2) / 10.0;
-        vescData->totalCurrentIn = readInt16Value(rx_frame, 4) / 10.0;
-        vescData->pidPosition = readInt16Value(rx_frame, 6) / 50.0;
-        vescData->motorPosition = readInt16Value(rx_frame, 6) / 50.0;
-    }
-     if (RECV_STATUS_5 == ID) {
-        frametype = "status5";
-        vescData->tachometer = readInt32Value(rx_frame, 0);
-        vescData->inputVoltage = readInt16Value(rx_frame, 4) / 10.0;
-        vescData->inputVoltage += AppConfiguration::getInstance()->config.batteryDrift;
-    }
-
-     if (RECV_PROCESS_SHORT_BUFFER_PROXY == ID) {
-        frametype = "process short buffer for <<BLE proxy>>";
-        for (int i = 1; i < rx_frame.data_length_code; i++) {
-            proxybuffer.push_back(rx_frame.data[i]);
+void CanBus::addRoute(uint8_t packetId, uint8_t controllerId, FrameHandler handler, const char *name) {
+    uint16_t key = (uint16_t(packetId) << 8) | controllerId;
+    for (int i = 0; i < ROUTE_TABLE_SIZE; i++) {
+        FrameRoute &route = routes[(routeSlot(key) + i) & (ROUTE_TABLE_SIZE - 1)];
+        if (route.handler == nullptr || route.key == key) {
+            route.key = key;
+            route.handler = handler;
+            route.name = name;
+            return;
         }
-        proxy->proxyOut(proxybuffer.data(), proxybuffer.size(), rx_frame.data[4], rx_frame.data[5]);
-        proxybuffer.clear();
     }
+    Logger::error(LOG_TAG_CANBUS, "frame route table is full");
+}
 
-     if (RECV_FILL_RX_BUFFER == ID) {
-        frametype = "fill rx buffer";
-        for (int i = 1; i < rx_frame.data_length_code; i++) {
-            buffer.push_back(rx_frame.data[i]);
+const CanBus::FrameRoute *CanBus::findRoute(uint32_t identifier) const {
+    // the VESC leaves the upper 13 bits of the extended id empty
+    if (identifier > 0xFFFF) {
+        return nullptr;
+    }
+    auto key = (uint16_t) identifier;
+    for (int i = 0; i < ROUTE_TABLE_SIZE; i++) {
+        const FrameRoute &route = routes[(routeSlot(key) + i) & (ROUTE_TABLE_SIZE - 1)];
+        if (route.handler == nullptr) {
+            return nullptr;
+        }
+        if (route.key == key) {
+            return &route;
         }
     }
+    return nullptr;
+}
 
-     if (RECV_FILL_RX_BUFFER_PROXY == ID || RECV_FILL_RX_BUFFER_LONG_PROXY == ID) {
-        boolean longBuffer = RECV_FILL_RX_BUFFER_LONG_PROXY == ID;
-        frametype = longBuffer ? "fill rx long buffer" : "fill rx buffer";
-        for (int i = (longBuffer ? 2 : 1); i < rx_frame.data_length_code; i++) {
-            proxybuffer.push_back(rx_frame.data[i]);
-        }
+void CanBus::processFrame(const twai_message_t &rx_frame, int frameCount) {
+    const FrameRoute *route = findRoute(rx_frame.identifier);
+    if (route == nullptr) {
+        return;
+    }
+    (this->*(route->handler))(rx_frame);
+
+    if (Logger::getLogLevel() == Logger::VERBOSE) {
+        snprintf(buf, bufSize, "processed frame #%d, type %s", frameCount, route->name);
+        Logger::verbose(LOG_TAG_CANBUS, buf);
+    }
+}
+
+void CanBus::handleStatus1(const twai_message_t &rx_frame) {
+    broadcasts.seen(1, frameTimestamp);
+    vescData->erpm.raw = readInt32Value(rx_frame, 0);
+    // the motor current, the input current comes with status 4
+    vescData->motorCurrent = decltype(vescData->motorCurrent)::fromRaw<10>(readInt16Value(rx_frame, 4));
+    vescData->dutyCycle.raw = readInt16Value(rx_frame, 6);
+}
+
+void CanBus::handleStatus2(const twai_message_t &rx_frame) {
+    broadcasts.seen(2, frameTimestamp);
+    vescData->ampHours.raw = readInt32Value(rx_frame, 0);
+    vescData->ampHoursCharged.raw = readInt32Value(rx_frame, 4);
+}
+
+void CanBus::handleStatus3(const twai_message_t &rx_frame) {
+    broadcasts.seen(3, frameTimestamp);
+    vescData->wattHours.raw = readInt32Value(rx_frame, 0);
+    vescData->wattHoursCharged.raw = readInt32Value(rx_frame, 4);
+}
+
+void CanBus::handleStatus4(const twai_message_t &rx_frame) {
+    broadcasts.seen(4, frameTimestamp);
+    vescData->mosfetTemp.raw = readInt16Value(rx_frame, 0);
+    vescData->motorTemp.raw = readInt16Value(rx_frame, 2);
+    vescData->totalCurrentIn.raw = readInt16Value(rx_frame, 4);
+    vescData->current = decltype(vescData->current)::fromRaw<10>(readInt16Value(rx_frame, 4));
+    vescData->pidPosition.raw = readInt16Value(rx_frame, 6);
+    vescData->motorPosition = decltype(vescData->motorPosition)::fromRaw<50>(readInt16Value(rx_frame, 6));
+}
+
+void CanBus::handleStatus5(const twai_message_t &rx_frame) {
+    broadcasts.seen(5, frameTimestamp);
+    vescData->tachometer.raw = readInt32Value(rx_frame, 0);
+    vescData->inputVoltage.raw = readInt16Value(rx_frame, 4) + batteryDrift();
+}
+
+// ADC voltages in 1/1000 V, the footpad sensors on a float package board
+void CanBus::handleStatus6(const twai_message_t &rx_frame) {
+    broadcasts.seen(6, frameTimestamp);
+    vescData->adc1 = decltype(vescData->adc1)::fromRaw<1000>(readInt16Value(rx_frame, 0));
+    vescData->adc2 = decltype(vescData->adc2)::fromRaw<1000>(readInt16Value(rx_frame, 2));
+}
+
+void CanBus::handlePong(const twai_message_t &rx_frame) {
+    uint8_t id = rx_frame.data[0];
+    if (rx_frame.data_length_code < 1 || id == vesc_id || controllers.find(id) != nullptr) {
+        return;
+    }
+    if (id == esp_can_id) {
+        snprintf(buf, bufSize, "controller %d uses the CAN id of rESCue, change one of them", id);
+        Logger::error(LOG_TAG_CANBUS, buf);
+    }
+    if (controllers.add(id) == nullptr) {
+        snprintf(buf, bufSize, "ignoring controller %d, registry is full", id);
+        Logger::warning(LOG_TAG_CANBUS, buf);
+        return;
+    }
+    snprintf(buf, bufSize, "found controller %d (hw type %d)", id, rx_frame.data[1]);
+    Logger::notice(LOG_TAG_CANBUS, buf);
+    // STATUS_2 and _3 only carry energy counters, which are not aggregated
+    addRoute(CAN_PACKET_STATUS, id, &CanBus::handleControllerStatus, "status1 secondary");
+    addRoute(CAN_PACKET_STATUS_4, id, &CanBus::handleControllerStatus, "status4 secondary");
+    addRoute(CAN_PACKET_STATUS_5, id, &CanBus::handleControllerStatus, "status5 secondary");
+    candevice->acceptController(id);
+
+    // responses for a proxy session with this id would reach the controller as well, move the session
+    ProxySession *session = proxy->session(id);
+    if (session != nullptr) {
+        uint8_t moved = freeCanId();
+        arbiter.release(id);
+        session->canId = moved;
+        addProxyRoutes(moved);
+        candevice->acceptController(moved);
+        snprintf(buf, bufSize, "proxy session moved from CAN id %d to %d", id, moved);
+        Logger::warning(LOG_TAG_CANBUS, buf);
     }
+}
 
-    if (RECV_PROCESS_RX_BUFFER == ID || RECV_PROCESS_RX_BUFFER_PROXY == ID) {
-        boolean isProxyRequest = false;
-        frametype = "process rx buffer for ";
-        if (RECV_PROCESS_RX_BUFFER_PROXY == ID) {
-            frametype += " <<BLE proxy>> ";
-            isProxyRequest = true;
+// an id for a proxy session that no known controller, rESCue or another session uses
+uint8_t CanBus::freeCanId() {
+    // 255 is the broadcast id
+    uint8_t id = (ble_proxy_can_id + PROXY_SESSIONS) % 255;
+    for (int i = 0; i < 255; i++, id = (id + 1) % 255) {
+        if (id != vesc_id && id != esp_can_id && controllers.find(id) == nullptr && proxy->session(id) == nullptr) {
+            return id;
         }
-        //Serial.printf("bytes %d\n", buffer.size());
+    }
+    return ble_proxy_can_id;
+}
 
-        if ((!isProxyRequest && buffer.empty()) || (isProxyRequest && proxybuffer.empty())) {
-            Serial.printf("buffer empty, abort");
+void CanBus::addProxyRoutes(uint8_t canId) {
+    addRoute(CAN_PACKET_PROCESS_SHORT_BUFFER, canId, &CanBus::handleProcessShortBufferProxy,
+             "process short buffer for <<BLE proxy>>");
+    addRoute(CAN_PACKET_FILL_RX_BUFFER, canId, &CanBus::handleFillRxBufferProxy,
+             "fill rx buffer for <<BLE proxy>>");
+    addRoute(CAN_PACKET_FILL_RX_BUFFER_LONG, canId, &CanBus::handleFillRxBufferProxy,
+             "fill rx long buffer for <<BLE proxy>>");
+    addRoute(CAN_PACKET_PROCESS_RX_BUFFER, canId, &CanBus::handleProcessRxBufferProxy,
+             "process rx buffer for <<BLE proxy>>");
+}
+
+void CanBus::handleControllerStatus(const twai_message_t &rx_frame) {
+    ControllerTelemetry *controller = controllers.find(rx_frame.identifier & 0xFF);
+    if (controller == nullptr) {
+        return;
+    }
+    switch ((rx_frame.identifier >> 8) & 0xFF) {
+        case CAN_PACKET_STATUS:
+            controller->erpm = readInt32Value(rx_frame, 0);
+            controller->motorCurrent = readInt16Value(rx_frame, 4) / 10.0f;
+            controller->dutyCycle = readInt16Value(rx_frame, 6) / 1000.0f;
+            break;
+        case CAN_PACKET_STATUS_4:
+            controller->mosfetTemp = readInt16Value(rx_frame, 0) / 10.0f;
+            controller->motorTemp = readInt16Value(rx_frame, 2) / 10.0f;
+            controller->totalCurrentIn = readInt16Value(rx_frame, 4) / 10.0f;
+            // input current like vescData->current of the primary, status 1 has the motor current
+            controller->current = controller->totalCurrentIn;
+            break;
+        case CAN_PACKET_STATUS_5:
+            controller->inputVoltage = readInt16Value(rx_frame, 4) / 10.0f
+                                       + AppConfiguration::getInstance()->config.batteryDrift;
+            break;
+        default:
             return;
-        }
-        uint8_t command = (isProxyRequest ? proxybuffer : buffer).at(0);
-        if (command == 0x00) {
-            frametype += "COMM_FW_VERSION";
-            int offset = 1;
-            vescData->majorVersion = readInt8ValueFromBuffer(0, isProxyRequest);
-            vescData->minorVersion = readInt8ValueFromBuffer(1, isProxyRequest);
-            vescData->name = readStringValueFromBuffer(2 + offset, 12, isProxyRequest);
-        } else if (command == 0x4F) {  //0x4F = 79 DEC
-            frametype += "COMM_GET_DECODED_BALANCE";
-            int offset = 1;
-            vescData->pidOutput = readInt32ValueFromBuffer(0 + offset, isProxyRequest) / 1000000.0;
-            vescData->pitch = readInt32ValueFromBuffer(4 + offset, isProxyRequest) / 1000000.0;
-            vescData->roll = readInt32ValueFromBuffer(8 + offset, isProxyRequest) / 1000000.0;
-            vescData->loopTime = readInt32ValueFromBuffer(12 + offset, isProxyRequest);
-            vescData->motorCurrent = readInt32ValueFromBuffer(16 + offset, isProxyRequest) / 1000000.0;
-            vescData->motorPosition = readInt32ValueFromBuffer(20 + offset, isProxyRequest) / 1000000.0;
-            vescData->balanceState = readInt16ValueFromBuffer(24 + offset, isProxyRequest);
-            vescData->switchState = readInt16ValueFromBuffer(26 + offset, isProxyRequest);
-            vescData->adc1 = readInt32ValueFromBuffer(28 + offset, isProxyRequest) / 1000000.0;
-            vescData->adc2 = readInt32ValueFromBuffer(32 + offset, isProxyRequest) / 1000000.0;
-            lastBalanceData = millis();
-        } else if (command == 0x24) {  //0x24 = 36 DEC
-            frametype += "COMM_CUSTOM_APP_DATA";
-            if(readInt8ValueFromBuffer(1,isProxyRequest) == 101) //magic number
+    }
+    controller->active = true;
+    controller->lastSeen = millis();
+}
+
+void CanBus::handleProcessShortBuffer(const twai_message_t &rx_frame) {
+    // data[0] sender id, data[1] send flag, data[2..] payload
+    ControllerTelemetry *controller = controllers.find(rx_frame.data[0]);
+    if (controller == nullptr || rx_frame.data_length_code < 8 || rx_frame.data[2] != 0x32) {
+        return;
+    }
+    uint32_t mask = ((uint32_t) rx_frame.data[3] << 24) | ((uint32_t) rx_frame.data[4] << 16) |
+                    ((uint32_t) rx_frame.data[5] << 8) | rx_frame.data[6];
+    if (mask != ((uint32_t) 1 << 15)) {
+        return;
+    }
+    requests.answered(controller->id, COMM_GET_VALUES_SELECTIVE, frameTimestamp);
+    uint8_t fault = rx_frame.data[7];
+    if (fault != controller->fault) {
+        snprintf(buf, bufSize, "controller %d fault code changed from %d to %d", controller->id, controller->fault, fault);
+        Logger::warning(LOG_TAG_CANBUS, buf);
+    }
+    controller->fault = fault;
+    controller->active = true;
+    controller->lastSeen = millis();
+}
+
+void CanBus::handleProcessShortBufferProxy(const twai_message_t &rx_frame) {
+    // data[0] sender id, data[1] send flag, data[2..] the whole response, it carries no checksum
+    if (rx_frame.data_length_code <= 2) {
+        return;
+    }
+    ProxySession *session = proxy->session(rx_frame.identifier & 0xFF);
+    if (session != nullptr) {
+        proxy->proxyOut(*session, &rx_frame.data[2], rx_frame.data_length_code - 2);
+    }
+}
+
+void CanBus::fillRxBuffer(CanRxBuffer &rxBuffer, const twai_message_t &rx_frame) {
+    boolean longBuffer = ((rx_frame.identifier >> 8) & 0xFF) == CAN_PACKET_FILL_RX_BUFFER_LONG;
+    int headerLength = longBuffer ? 2 : 1;
+    if (rx_frame.data_length_code <= headerLength) {
+        return;
+    }
+    uint16_t offset = longBuffer ? (rx_frame.data[0] << 8) | rx_frame.data[1] : rx_frame.data[0];
+    if (!rxBuffer.fill(offset, &rx_frame.data[headerLength], rx_frame.data_length_code - headerLength)) {
+        snprintf(buf, bufSize, "rx buffer overflow at offset %d, dropping fragment", offset);
+        Logger::warning(LOG_TAG_CANBUS, buf);
+    }
+}
+
+void CanBus::handleFillRxBuffer(const twai_message_t &rx_frame) {
+    fillRxBuffer(buffer, rx_frame);
+}
+
+void CanBus::handleFillRxBufferProxy(const twai_message_t &rx_frame) {
+    ProxySession *session = proxy->session(rx_frame.identifier & 0xFF);
+    if (session != nullptr) {
+        fillRxBuffer(session->response, rx_frame);
+    }
+}
+
+void CanBus::handleProcessRxBuffer(const twai_message_t &rx_frame) {
+    processRxBuffer(rx_frame, false);
+}
+
+void CanBus::handleProcessRxBufferProxy(const twai_message_t &rx_frame) {
+    processRxBuffer(rx_frame, true);
+}
+
+const char *CanBus::commandName(uint8_t command) {
+    switch (command) {
+        case 0x00: return "COMM_FW_VERSION";
+        case 0x04: return "COMM_GET_VALUES";
+        case 0x0E: return "COMM_GET_MCCONF";
+        case 0x11: return "COMM_GET_APPCONF";
+        case 0x24: return "COMM_CUSTOM_APP_DATA";
+        case 0x2F: return "COMM_GET_VALUES_SETUP";
+        case 0x32: return "COMM_GET_VALUES_SELECTIVE";
+        case 0x33: return "COMM_GET_VALUES_SETUP_SELECTIVE";
+        case 0x3E: return "COMM_PING_CAN";
+        case 0x41: return "COMM_GET_IMU_DATA";
+        case 0x4F: return "COMM_GET_DECODED_BALANCE";
+        default: return "unknown";
+    }
+}
+
+void CanBus::processRxBuffer(const twai_message_t &rx_frame, boolean isProxyRequest) {
+    ProxySession *session = isProxyRequest ? proxy->session(rx_frame.identifier & 0xFF) : nullptr;
+    if (isProxyRequest && session == nullptr) {
+        return;
+    }
+    CanRxBuffer &rxBuffer = isProxyRequest ? session->response : buffer;
+    uint16_t length = (rx_frame.data[2] << 8) | rx_frame.data[3];
+    uint16_t crc = (rx_frame.data[4] << 8) | rx_frame.data[5];
+    if (rx_frame.data_length_code < 6 || !rxBuffer.process(length, crc)) {
+        snprintf(buf, bufSize, "rx buffer incomplete or corrupt (expected %d bytes, crc %04x), abort", length, crc);
+        Logger::warning(LOG_TAG_CANBUS, buf);
+        rxBuffer.clear();
+        return;
+    }
+    uint8_t command = rxBuffer.at(0);
+    if (!isProxyRequest) {
+        requests.answered(rx_frame.data[0], command, frameTimestamp);
+    }
+    if (Logger::getLogLevel() == Logger::VERBOSE) {
+        snprintf(buf, bufSize, "process rx buffer for %s%s", isProxyRequest ? "<<BLE proxy>> " : "", commandName(command));
+        Logger::verbose(LOG_TAG_CANBUS, buf);
+    }
+    if (command == 0x00) {
+        int offset = 1;
+        vescData->majorVersion = readInt8ValueFromBuffer(0 + offset, rxBuffer);
+        vescData->minorVersion = readInt8ValueFromBuffer(1 + offset, rxBuffer);
+        vescData->name = readStringValueFromBuffer(2 + offset, 12, rxBuffer);
+    } else if (command == 0x4F) {  //0x4F = 79 DEC
+        int offset = 1;
+        vescData->pidOutput.raw = readInt32ValueFromBuffer(0 + offset, rxBuffer);
+        vescData->pitch.raw = readInt32ValueFromBuffer(4 + offset, rxBuffer);
+        vescData->roll.raw = readInt32ValueFromBuffer(8 + offset, rxBuffer);
+        vescData->loopTime = readInt32ValueFromBuffer(12 + offset, rxBuffer);
+        vescData->motorCurrent = decltype(vescData->motorCurrent)::fromRaw<1000000>(readInt32ValueFromBuffer(16 + offset, rxBuffer));
+        vescData->motorPosition.raw = readInt32ValueFromBuffer(20 + offset, rxBuffer);
+        vescData->balanceState = readInt16ValueFromBuffer(24 + offset, rxBuffer);
+        vescData->switchState = readInt16ValueFromBuffer(26 + offset, rxBuffer);
+        vescData->adc1.raw = readInt32ValueFromBuffer(28 + offset, rxBuffer);
+        vescData->adc2.raw = readInt32ValueFromBuffer(32 + offset, rxBuffer);
+        vescData->balanceUpdated = millis();
+    } else if (command == 0x24) {  //0x24 = 36 DEC
+        if(readInt8ValueFromBuffer(1, rxBuffer) == 101) //magic number
+        {
+            if(readInt8ValueFromBuffer(2, rxBuffer) == 1 ) //FLOAT_COMMAND_GET_RTDATA (0x1)
             {
-                if(readInt8ValueFromBuffer(2,isProxyRequest) == 1 ) //FLOAT_COMMAND_GET_RTDATA (0x1)
+                int offset = 3;
+                //FLOAT PACKAGE (0x65)
+                //FLOAT_COMMAND_GET_RTDATA (0x1)
+                //printFrame(rx_frame,frameCount);
+                //dumpVescValues();
+                // Reading floats
+                vescData->pidOutput.set(readFloatValueFromBuffer(0 + offset, rxBuffer));
+                vescData->pitch.set(readFloatValueFromBuffer(4 + offset, rxBuffer));
+                vescData->roll.set(readFloatValueFromBuffer(8 + offset, rxBuffer));
+                //vescData->loopTime = readInt32ValueFromBuffer(12 + offset, rxBuffer); No functional equivilent
+                //vescData->motorCurrent = readInt32ValueFromBuffer(16 + offset, rxBuffer) / 1000000.0; Done in COMM_GET_VALUES 0x4
+                //vescData->motorPosition = readInt32ValueFromBuffer(20 + offset, rxBuffer) / 1000000.0; Done in COMM_GET_VALUES 0x4
+                // Reading state (1 byte)
+                vescData->balanceState = readInt8ValueFromBuffer(12 + offset, rxBuffer);
+                // Reading switch_state (1 byte)
+                uint16_t switchState = readInt8ValueFromBuffer(13 + offset, rxBuffer);
+                // Reading adc1 and adc2 (floats)
+                vescData->adc1.set(readFloatValueFromBuffer(14 + offset, rxBuffer));
+                vescData->adc2.set(readFloatValueFromBuffer(18 + offset, rxBuffer));
+
+                switch(switchState)
                 {
-                    int offset = 3;
-                    //FLOAT PACKAGE (0x65)
-                    //FLOAT_COMMAND_GET_RTDATA (0x1)
-                    //printFrame(rx_frame,frameCount);
-                    //dumpVescValues();
-                    // Reading floats
-                    vescData->pidOutput = readFloatValueFromBuffer(0 + offset, isProxyRequest);
-                    vescData->pitch = readFloatValueFromBuffer(4 + offset, isProxyRequest);
-                    vescData->roll = readFloatValueFromBuffer(8 + offset, isProxyRequest);
-                    //vescData->loopTime = readInt32ValueFromBuffer(12 + offset, isProxyRequest); No functional equivilent
-                    //vescData->motorCurrent = readInt32ValueFromBuffer(16 + offset, isProxyRequest) / 1000000.0; Done in COMM_GET_VALUES 0x4
-                    //vescData->motorPosition = readInt32ValueFromBuffer(20 + offset, isProxyRequest) / 1000000.0; Done in COMM_GET_VALUES 0x4
-                    // Reading state (1 byte)
-                    vescData->balanceState = readInt8ValueFromBuffer(12 + offset, isProxyRequest);
-                    // Reading switch_state (1 byte)
-                    uint16_t switchState = readInt8ValueFromBuffer(13 + offset, isProxyRequest);
-                    // Reading adc1 and adc2 (floats)
-                    vescData->adc1 = readFloatValueFromBuffer(14 + offset, isProxyRequest);
-                    vescData->adc2 = readFloatValueFromBuffer(18 + offset, isProxyRequest);
-
-                    switch(switchState)
-                    {
-                        case 0:
-                            vescData->switchState=0;
-                        break;
-                        case 1:
-                            vescData->switchState = (vescData->adc1 > vescData->adc2) ? 1 : 2;
-                        break;
-                        case 2:
-                            vescData->switchState=3;
-                        break;
-                    }
-                    lastBalanceData = millis();
+                    case 0:
+                        vescData->switchState=0;
+                    break;
+                    case 1:
+                        vescData->switchState = (vescData->adc1.raw > vescData->adc2.raw) ? 1 : 2;
+                    break;
+                    case 2:
+                        vescData->switchState=3;
+                    break;
                 }
+                vescData->balanceUpdated = millis();
             }
-        } else if (command == 0x32) { //0x32 = 50 DEC
-            frametype += "COMM_GET_VALUES_SELECTIVE";
-            int offset = 1;
-            vescData->mosfetTemp = readInt16ValueFromBuffer(4 + offset, isProxyRequest) / 10.0;
-            vescData->motorTemp = readInt16ValueFromBuffer(6 + offset, isProxyRequest) / 10.0;
-            vescData->dutyCycle = readInt16ValueFromBuffer(8 + offset, isProxyRequest) / 1000.0;
-            vescData->erpm = readInt32ValueFromBuffer(10 + offset, isProxyRequest);
-            vescData->inputVoltage = readInt16ValueFromBuffer(14 + offset, isProxyRequest) / 10.0;
-            vescData->inputVoltage += AppConfiguration::getInstance()->config.batteryDrift;
-            vescData->tachometer = readInt32ValueFromBuffer(16 + offset, isProxyRequest);
-            vescData->tachometerAbsolut = readInt32ValueFromBuffer(20 + offset, isProxyRequest);
-            vescData->fault = readInt8ValueFromBuffer(24 + offset, isProxyRequest);
-            lastRealtimeData = millis();
-        }  else if (command == 0x33) { //0x33 = 51 DEC
-            frametype += "COMM_GET_VALUES_SETUP_SELECTIVE";
-            int offset = 1;
-            int startbyte = 0;
-            uint32_t bitmask = readInt32ValueFromBuffer(0 + offset, isProxyRequest);
-            startbyte += 4;
-            if(bitmask & ((uint32_t) 1 << 0)) {
-                vescData->mosfetTemp = readInt16ValueFromBuffer(startbyte + offset, isProxyRequest) / 10.0;
-                startbyte += 2;
-            }
-            if(bitmask & ((uint32_t) 1 << 1)) {
-                vescData->motorTemp = readInt16ValueFromBuffer(startbyte + offset, isProxyRequest) / 10.0;
-                startbyte += 2;
-            }
-            if(bitmask & ((uint32_t) 1 << 2)) {
-                // current in
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 3)) {
-                // current in_total
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 4)) {
-                vescData->dutyCycle = readInt16ValueFromBuffer(startbyte + offset, isProxyRequest) / 1000.0;
-                startbyte += 2;
-            }
-            if(bitmask & ((uint32_t) 1 << 5)) {
-                vescData->erpm = readInt32ValueFromBuffer(startbyte + offset, isProxyRequest);
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 6)) {
-                // speed
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 7)) {
-                vescData->inputVoltage = readInt16ValueFromBuffer(startbyte + offset, isProxyRequest) / 10.0;
-                vescData->inputVoltage += AppConfiguration::getInstance()->config.batteryDrift;
-                startbyte += 2;
-            }
-            if(bitmask & ((uint32_t) 1 << 8)) {
-                // battery level
-                startbyte += 2;
-            }
-            if(bitmask & ((uint32_t) 1 << 9)) {
-                // amphours consumed
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 10)) {
-                // amphours charged
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 11)) {
-                // watthours consumed
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 12)) {
-                // watthours charged
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 13)) {
-                vescData->tachometer = readInt32ValueFromBuffer(16 + offset, isProxyRequest);
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 14)) {
-                vescData->tachometerAbsolut = readInt32ValueFromBuffer(20 + offset, isProxyRequest);
-                startbyte += 4;
-            }
-            if(bitmask & ((uint32_t) 1 << 16)) {
-                vescData->fault = readInt8ValueFromBuffer(24 + offset, isProxyRequest);
-                startbyte += 1;
-            }
-            lastRealtimeData = millis();
-        } else if (command == 0x04) {
-            frametype += "COMM_GET_VALUES";
-            int offset = 1;
-            vescData->mosfetTemp = readInt16ValueFromBuffer(0 + offset, isProxyRequest) / 10.0;
-            vescData->motorTemp = readInt16ValueFromBuffer(2 + offset, isProxyRequest) / 10.0;
-            vescData->motorCurrent = readInt32ValueFromBuffer(4 + offset, isProxyRequest) / 100.0;
-            vescData->current = readInt32ValueFromBuffer(8 + offset, isProxyRequest) / 100.0;
-            // id = vescData->readInt32ValueFromBuffer(12 + offset, isProxyRequest) / 100.0;
-            // iq = vescData->readInt32ValueFromBuffer(16 + offset, isProxyRequest) / 100.0;
-            vescData->dutyCycle = readInt16ValueFromBuffer(20 + offset, isProxyRequest) / 1000.0;
-            vescData->erpm = readInt32ValueFromBuffer(22 + offset, isProxyRequest);
-            vescData->inputVoltage = readInt16ValueFromBuffer(26 + offset, isProxyRequest) / 10.0;
-            vescData->inputVoltage += AppConfiguration::getInstance()->config.batteryDrift;
-            vescData->ampHours =  readInt32ValueFromBuffer(28 + offset, isProxyRequest) / 10000.0;
-            vescData->ampHoursCharged = readInt32ValueFromBuffer(32 + offset, isProxyRequest) / 10000.0;
-            vescData->wattHours =  readInt32ValueFromBuffer(46 + offset, isProxyRequest) / 10000.0;
-            vescData->wattHoursCharged = readInt32ValueFromBuffer(40 + offset, isProxyRequest) / 10000.0;
-            vescData->tachometer = readInt32ValueFromBuffer(44 + offset, isProxyRequest);
-            vescData->tachometerAbsolut = readInt32ValueFromBuffer(58 + offset, isProxyRequest);
-            vescData->fault = readInt8ValueFromBuffer(52 + offset, isProxyRequest);
-            lastRealtimeData = millis();
-        } else if (command == 0x0E) {  //0x0E = 14 DEC
-            frametype += "COMM_GET_MCCONF";
-        } else if (command == 0x11) {  //0x11 = 17 DEC
-            frametype += "COMM_GET_APPCONF";
-        } else if (command == 0x2F) { //0x2F = 47 DEC
-            frametype += "COMM_GET_VALUES_SETUP";
-        } else if (command == 0x33) { //0x33 = 51 DEC
-            frametype += "COMM_GET_VALUES_SETUP_SELECTIVE";
-        } else if (command == 0x41) { //0x41 = 65 DEC
-            frametype += "COMM_GET_IMU_DATA";
-        } else if (command == 0x3E) { //0x3E = 62 DEC
-            frametype += "COMM_PING_CAN";
-        } else {
-            frametype += command;
         }
-        if (isProxyRequest) {
-            proxy->proxyOut(proxybuffer.data(), proxybuffer.size(), rx_frame.data[4], rx_frame.data[5]);
-            proxybuffer.clear();    
-        } else {
-            buffer.clear();
+    } else if (command == 0x32 || command == 0x33) { //0x32 = 50 DEC, 0x33 = 51 DEC
+        boolean setup = command == 0x33;
+        uint32_t decoded = setup
+                ? decodeSelective(VALUES_SETUP_SELECTIVE, VALUES_SETUP_SELECTIVE_COUNT, rxBuffer.data() + 1, rxBuffer.size() - 1, vescData)
+                : decodeSelective(VALUES_SELECTIVE, VALUES_SELECTIVE_COUNT, rxBuffer.data() + 1, rxBuffer.size() - 1, vescData);
+        int voltageBit = setup ? VALUES_SETUP_SELECTIVE_INPUT_VOLTAGE_BIT : VALUES_SELECTIVE_INPUT_VOLTAGE_BIT;
+        if (decoded & ((uint32_t) 1 << voltageBit)) {
+            vescData->inputVoltage.raw += batteryDrift();
         }
+        vescData->realtimeUpdated = millis();
+    } else if (command == 0x04) {
+        int offset = 1;
+        vescData->mosfetTemp.raw = readInt16ValueFromBuffer(0 + offset, rxBuffer);
+        vescData->motorTemp.raw = readInt16ValueFromBuffer(2 + offset, rxBuffer);
+        vescData->motorCurrent.raw = readInt32ValueFromBuffer(4 + offset, rxBuffer);
+        vescData->current.raw = readInt32ValueFromBuffer(8 + offset, rxBuffer);
+        // id = vescData->readInt32ValueFromBuffer(12 + offset, rxBuffer) / 100.0;
+        // iq = vescData->readInt32ValueFromBuffer(16 + offset, rxBuffer) / 100.0;
+        vescData->dutyCycle.raw = readInt16ValueFromBuffer(20 + offset, rxBuffer);
+        vescData->erpm.raw = readInt32ValueFromBuffer(22 + offset, rxBuffer);
+        vescData->inputVoltage.raw = readInt16ValueFromBuffer(26 + offset, rxBuffer) + batteryDrift();
+        vescData->ampHours.raw = readInt32ValueFromBuffer(28 + offset, rxBuffer);
+        vescData->ampHoursCharged.raw = readInt32ValueFromBuffer(32 + offset, rxBuffer);
+        vescData->wattHours.raw = readInt32ValueFromBuffer(36 + offset, rxBuffer);
+        vescData->wattHoursCharged.raw = readInt32ValueFromBuffer(40 + offset, rxBuffer);
+        vescData->tachometer.raw = readInt32ValueFromBuffer(44 + offset, rxBuffer);
+        vescData->tachometerAbsolut.raw = readInt32ValueFromBuffer(48 + offset, rxBuffer);
+        vescData->fault = readInt8ValueFromBuffer(52 + offset, rxBuffer);
+        vescData->realtimeUpdated = millis();
     }
-
-    if (Logger::getLogLevel() <= Logger::NOTICE) {
-        snprintf(buf, bufSize, "processed frame #%d, type %s", frameCount, frametype.c_str());
-        Logger::verbose(LOG_TAG_CANBUS, buf);
+    if (isProxyRequest) {
+        proxy->proxyOut(*session, rxBuffer.data(), rxBuffer.size());
     }
+    rxBuffer.clear();
 }
 
 void CanBus::dumpVescValues() {
@@ -707,55 +984,70 @@ void CanBus::dumpVescValues() {
     snprintf(buf, bufSize, "%s, ", vescData->name.c_str());
     bufferString += buf;
     bufferString += "dutycycle=";
-    snprintf(buf, bufSize, "%f", vescData->dutyCycle);
+    snprintf(buf, bufSize, "%f", (double) vescData->dutyCycle);
     bufferString += buf;
     bufferString += ", erpm=";
-    snprintf(buf, bufSize, "%f", vescData->erpm);
+    snprintf(buf, bufSize, "%f", (double) vescData->erpm);
     bufferString += buf;
     bufferString += ", current=";
-    snprintf(buf, bufSize, "%f", vescData->current);
+    snprintf(buf, bufSize, "%f", (double) vescData->current);
     bufferString += buf;
     bufferString += ", ampHours=";
-    snprintf(buf, bufSize, "%f", vescData->ampHours);
+    snprintf(buf, bufSize, "%f", (double) vescData->ampHours);
     bufferString += buf;
     bufferString += ", ampHoursCharged=";
-    snprintf(buf, bufSize, "%f", vescData->ampHoursCharged);
+    snprintf(buf, bufSize, "%f", (double) vescData->ampHoursCharged);
     bufferString += buf;
     bufferString += ", wattHours=";
-    snprintf(buf, bufSize, "%f", vescData->wattHours);
+    snprintf(buf, bufSize, "%f", (double) vescData->wattHours);
     bufferString += buf;
     bufferString += ", wattHoursCharged=";
-    snprintf(buf, bufSize, "%f", vescData->wattHoursCharged);
+    snprintf(buf, bufSize, "%f", (double) vescData->wattHoursCharged);
     bufferString += buf;
     bufferString += ", mosfetTemp=";
-    snprintf(buf, bufSize, "%f", vescData->mosfetTemp);
+    snprintf(buf, bufSize, "%f", (double) vescData->mosfetTemp);
     bufferString += buf;
     bufferString += ", motorTemp=";
-    snprintf(buf, bufSize, "%f", vescData->motorTemp);
+    snprintf(buf, bufSize, "%f", (double) vescData->motorTemp);
     bufferString += buf;
     bufferString += ", inputVoltage=";
-    snprintf(buf, bufSize, "%f", vescData->inputVoltage);
+    snprintf(buf, bufSize, "%f", (double) vescData->inputVoltage);
     bufferString += buf;
     bufferString += ", tachometer=";
-    snprintf(buf, bufSize, "%f", vescData->tachometer);
+    snprintf(buf, bufSize, "%f", (double) vescData->tachometer);
+    bufferString += buf;
+    bufferString += ", controllers=";
+    snprintf(buf, bufSize, "%d", vescData->controllerCount);
+    bufferString += buf;
+    bufferString += ", totalCurrent=";
+    snprintf(buf, bufSize, "%f", (double) vescData->totalCurrent);
+    bufferString += buf;
+    bufferString += ", totalMotorCurrent=";
+    snprintf(buf, bufSize, "%f", (double) vescData->totalMotorCurrent);
+    bufferString += buf;
+    bufferString += ", minInputVoltage=";
+    snprintf(buf, bufSize, "%f", (double) vescData->minInputVoltage);
+    bufferString += buf;
+    bufferString += ", controllerFault=";
+    snprintf(buf, bufSize, "%d", vescData->controllerFault);
     bufferString += buf;
     bufferString += ", pidOutput=";
-    snprintf(buf, bufSize, "%f", vescData->pidOutput);
+    snprintf(buf, bufSize, "%f", (double) vescData->pidOutput);
     bufferString += buf;
     bufferString += ", pitch=";
-    snprintf(buf, bufSize, "%f", vescData->pitch);
+    snprintf(buf, bufSize, "%f", (double) vescData->pitch);
     bufferString += buf;
     bufferString += ", roll=";
-    snprintf(buf, bufSize, "%f", vescData->roll);
+    snprintf(buf, bufSize, "%f", (double) vescData->roll);
     bufferString += buf;
     bufferString += ", loopTime=";
     snprintf(buf, bufSize, "%d", vescData->loopTime);
     bufferString += buf;
     bufferString += ", motorCurrent=";
-    snprintf(buf, bufSize, "%f", vescData->motorCurrent);
+    snprintf(buf, bufSize, "%f", (double) vescData->motorCurrent);
     bufferString += buf;
     bufferString += ", motorPosition=";
-    snprintf(buf, bufSize, "%f", vescData->motorPosition);
+    snprintf(buf, bufSize, "%f", (double) vescData->motorPosition);
     bufferString += buf;
     bufferString += ", balanceState=";
     snprintf(buf, bufSize, "%d", vescData->balanceState);
@@ -764,10 +1056,10 @@ void CanBus::dumpVescValues() {
     snprintf(buf, bufSize, "%d", vescData->switchState);
     bufferString += buf;
     bufferString += ", adc1=";
-    snprintf(buf, bufSize, "%f", vescData->adc1);
+    snprintf(buf, bufSize, "%f", (double) vescData->adc1);
     bufferString += buf;
     bufferString += ", adc2=";
-    snprintf(buf, bufSize, "%f", vescData->adc2);
+    snprintf(buf, bufSize, "%f", (double) vescData->adc2);
     bufferString += buf;
     bufferString += ", fault=";
     snprintf(buf, bufSize, "%d", vescData->fault);
@@ -776,14 +1068,15 @@ void CanBus::dumpVescValues() {
     lastDump = millis();
 }
 
-float CanBus::readFloatValueFromBuffer(int startbyte, boolean isProxyRequest) {
+float CanBus::readFloatValueFromBuffer(int startbyte, const CanRxBuffer &rxBuffer) {
     int32_t index = startbyte;
-    const uint8_t *currBuffer = isProxyRequest ? proxybuffer.data() : buffer.data();
-
-    return buffer_get_float32_auto(currBuffer, &index);
+    if (startbyte + 4 > rxBuffer.size()) {
+        return 0.0f;
+    }
+    return buffer_get_float32_auto(rxBuffer.data(), &index);
 }
 
-int32_t CanBus::readInt32Value(twai_message_t rx_frame, int startbyte) {
+int32_t CanBus::readInt32Value(const twai_message_t &rx_frame, int startbyte) {
     int32_t intVal = (
             ((int32_t) rx_frame.data[startbyte] << 24) +
             ((int32_t) rx_frame.data[startbyte + 1] << 16) +
@@ -792,37 +1085,37 @@ int32_t CanBus::readInt32Value(twai_message_t rx_frame, int startbyte) {
     return intVal;
 }
 
-int16_t CanBus::readInt16Value(twai_message_t rx_frame, int startbyte) {
+int16_t CanBus::readInt16Value(const twai_message_t &rx_frame, int startbyte) {
     int16_t intVal = (
             ((int16_t) rx_frame.data[startbyte] << 8) +
             ((int16_t) rx_frame.data[startbyte + 1]));
     return intVal;
 }
 
-int32_t CanBus::readInt32ValueFromBuffer(int startbyte, boolean isProxyRequest) {
+int32_t CanBus::readInt32ValueFromBuffer(int startbyte, const CanRxBuffer &rxBuffer) {
     int32_t intVal = (
-            ((int32_t) (isProxyRequest ? proxybuffer : buffer).at(startbyte) << 24) +
-            ((int32_t) (isProxyRequest ? proxybuffer : buffer).at(startbyte + 1) << 16) +
-            ((int32_t) (isProxyRequest ? proxybuffer : buffer).at(startbyte + 2) << 8) +
-            ((int32_t) (isProxyRequest ? proxybuffer : buffer).at(startbyte + 3)));
+            ((int32_t) rxBuffer.at(startbyte) << 24) +
+            ((int32_t) rxBuffer.at(startbyte + 1) << 16) +
+            ((int32_t) rxBuffer.at(startbyte + 2) << 8) +
+            ((int32_t) rxBuffer.at(startbyte + 3)));
     return intVal;
 }
 
-int16_t CanBus::readInt16ValueFromBuffer(int startbyte, boolean isProxyRequest) {
+int16_t CanBus::readInt16ValueFromBuffer(int startbyte, const CanRxBuffer &rxBuffer) {
     int16_t intVal = (
-            ((int16_t) (isProxyRequest ? proxybuffer : buffer).at(startbyte) << 8) +
-            ((int16_t) (isProxyRequest ? proxybuffer : buffer).at(startbyte + 1)));
+            ((int16_t) rxBuffer.at(startbyte) << 8) +
+            ((int16_t) rxBuffer.at(startbyte + 1)));
     return intVal;
 }
 
-int8_t CanBus::readInt8ValueFromBuffer(int startbyte, boolean isProxyRequest) {
-    return (isProxyRequest ? proxybuffer : buffer).at(startbyte);
+int8_t CanBus::readInt8ValueFromBuffer(int startbyte, const CanRxBuffer &rxBuffer) {
+    return rxBuffer.at(startbyte);
 }
 
-std::string CanBus::readStringValueFromBuffer(int startbyte, int length, boolean isProxyRequest) {
+std::string CanBus::readStringValueFromBuffer(int startbyte, int length, const CanRxBuffer &rxBuffer) {
     std::string name;
     for (int i = startbyte; i < startbyte + length; i++) {
-        name += (char) (isProxyRequest ? proxybuffer : buffer).at(i);
+        name += (char) rxBuffer.at(i);
     }
     return name;
 }
\ No newline at end of file
@@ -5,29 +5,56 @@
 #include "config.h"
 
 #include "AppConfiguration.h"
-#include <LoopbackStream.h>
 #include <Logger.h>
 #include "VescCanConstants.h"
 #include "BleCanProxy.h"
 #include "CanDevice.h"
+#include "CanFrameQueue.h"
 #include "VescData.h"
-#include <vector>
+#include "CanRxBuffer.h"
+#include "VescControllerRegistry.h"
+#include "VescValuesSchema.h"
+#include "TelemetryScheduler.h"
+#include "RequestTracker.h"
+#include "VescArbiter.h"
+#include "CanMetrics.h"
+#include "StatusBroadcasts.h"
 #include "buffer.h"
-#define B10000001 129
-#define B11000011 195
 
 #define LOG_TAG_CANBUS "CanBus"
 
+#ifndef CAN_LOOP_FRAME_BUDGET
+#define CAN_LOOP_FRAME_BUDGET 100 // frames processed per loop at most, the rest waits for the next one
+#endif //CAN_LOOP_FRAME_BUDGET
+
+#ifndef CAN_LOOP_TIME_BUDGET
+#define CAN_LOOP_TIME_BUDGET 2000 // us per loop spent processing frames at most
+#endif //CAN_LOOP_TIME_BUDGET
+
+#define FLOAT_RTDATA_RESPONSE_SIZE 25 // estimate, depends on the float package version
+#define FW_VERSION_RESPONSE_SIZE 40   // estimate, depends on the firmware version
+
+#ifndef CONTROLLER_PING_INTERVAL
+#define CONTROLLER_PING_INTERVAL 10000 // ms between broadcast pings looking for further controllers
+#endif //CONTROLLER_PING_INTERVAL
+
 class CanBus {
     public:
       CanBus(VescData *vescData);
       VescData *vescData;
-      LoopbackStream *stream;
       BleCanProxy *proxy;
+      VescControllerRegistry controllers;
+      CanMetrics metrics;
+      StatusBroadcasts broadcasts;
+      TelemetryScheduler scheduler;
+      RequestTracker requests;
+      VescArbiter arbiter;
+      unsigned long frameTimestamp = 0; // micros() the frame being processed was received at
       void init();
       void loop();
       void dumpVescValues();
       boolean isInitialized();
+      CanRecorder *getRecorder();
       int getInterval();
       boolean bmsVTOT(float,float);
       boolean bmsVCell(const uint16_t*,int);
@@ -48,39 +75,68 @@ class CanBus {
       boolean requestBalanceData();
       boolean requestFloatPackageData();
       void ping();
+      boolean requestFault(uint8_t controllerId);
+      void pollControllers();
       static void clearFrame(twai_message_t rx_frame);
       static void printFrame(twai_message_t rx_frame, int frameCount);
-      void processFrame(twai_message_t rx_frame, int frameCount);
-      float readFloatValueFromBuffer(int startbyte, boolean isProxyRequest);
-      static int32_t readInt32Value(twai_message_t rx_frame, int startbyte);
-      static int16_t readInt16Value(twai_message_t rx_frame, int startbyte);
-      int32_t readInt32ValueFromBuffer(int startbyte, boolean isProxyRequest);
-      int16_t readInt16ValueFromBuffer(int startbyte, boolean isProxyRequest);
-      int8_t readInt8ValueFromBuffer(int startbyte, boolean isProxyRequest);
-      std::string readStringValueFromBuffer(int startbyte, int length, boolean isProxyRequest);
+      typedef void (CanBus::*FrameHandler)(const twai_message_t &rx_frame);
+      // maps (packet id, controller id) of an incoming frame to its handler, built once in init()
+      struct FrameRoute {
+          uint16_t key;
+          FrameHandler handler;
+          const char *name;
+      };
+      const static int ROUTE_TABLE_SIZE = 64; // power of two, open addressing
+      FrameRoute routes[ROUTE_TABLE_SIZE] = {};
+      static uint8_t routeSlot(uint16_t key) { return (key ^ (key >> 5)) & (ROUTE_TABLE_SIZE - 1); }
+      void addRoute(uint8_t packetId, uint8_t controllerId, FrameHandler handler, const char *name);
+      void addProxyRoutes(uint8_t canId);
+      uint8_t freeCanId();
+      const FrameRoute *findRoute(uint32_t identifier) const;
+      void processFrame(const twai_message_t &rx_frame, int frameCount);
+      void publishTelemetry(int frameCount);
+      boolean isFromPrimary(const twai_message_t &rx_frame) const;
+      void updateBroadcastMode(unsigned long now);
+      void handleStatus1(const twai_message_t &rx_frame);
+      void handleStatus2(const twai_message_t &rx_frame);
+      void handleStatus3(const twai_message_t &rx_frame);
+      void handleStatus4(const twai_message_t &rx_frame);
+      void handleStatus5(const twai_message_t &rx_frame);
+      void handleStatus6(const twai_message_t &rx_frame);
+      void handlePong(const twai_message_t &rx_frame);
+      void handleControllerStatus(const twai_message_t &rx_frame);
+      void handleProcessShortBuffer(const twai_message_t &rx_frame);
+      void handleProcessShortBufferProxy(const twai_message_t &rx_frame);
+      void fillRxBuffer(CanRxBuffer &rxBuffer, const twai_message_t &rx_frame);
+      void handleFillRxBuffer(const twai_message_t &rx_frame);
+      void handleFillRxBufferProxy(const twai_message_t &rx_frame);
+      void handleProcessRxBuffer(const twai_message_t &rx_frame);
+      void handleProcessRxBufferProxy(const twai_message_t &rx_frame);
+      void processRxBuffer(const twai_message_t &rx_frame, boolean isProxyRequest);
+      static const char *commandName(uint8_t command);
+      float readFloatValueFromBuffer(int startbyte, const CanRxBuffer &rxBuffer);
+      static int32_t readInt32Value(const twai_message_t &rx_frame, int startbyte);
+      static int16_t readInt16Value(const twai_message_t &rx_frame, int startbyte);
+      int32_t readInt32ValueFromBuffer(int startbyte, const CanRxBuffer &rxBuffer);
+      int16_t readInt16ValueFromBuffer(int startbyte, const CanRxBuffer &rxBuffer);
+      int8_t readInt8ValueFromBuffer(int startbyte, const CanRxBuffer &rxBuffer);
+      std::string readStringValueFromBuffer(int startbyte, int length, const CanRxBuffer &rxBuffer);
       uint8_t vesc_id;
       uint8_t esp_can_id;
       uint8_t ble_proxy_can_id;
-      int32_t RECV_STATUS_1;
-      int32_t RECV_STATUS_2;
-      int32_t RECV_STATUS_3;
-      int32_t RECV_STATUS_4;
-      int32_t RECV_STATUS_5;
-      uint32_t RECV_FILL_RX_BUFFER;
-      uint32_t RECV_PROCESS_RX_BUFFER;
-      uint32_t RECV_PROCESS_SHORT_BUFFER_PROXY;
-      uint32_t RECV_FILL_RX_BUFFER_PROXY;
-      uint32_t RECV_FILL_RX_BUFFER_LONG_PROXY;
-      uint32_t RECV_PROCESS_RX_BUFFER_PROXY;
       boolean initialized = false;
+      boolean publishedConnected = false;
+      uint32_t realtimeMask = VALUES_SELECTIVE_MASK;
+      uint8_t coveredBroadcasts = 0;
       int interval = 500;
       int initRetryCounter = 5;
       unsigned long lastDump = 0;
       unsigned long lastRetry = 0;
-      unsigned long lastRealtimeData = 0;
-      unsigned long lastBalanceData = 0;
-      std::vector<uint8_t> buffer = {};
-      std::vector<uint8_t> proxybuffer = {};
+      unsigned long lastPing = 0;
+      unsigned long lastFaultPoll = 0;
+      unsigned long lastPrimaryFrame = 0; // millis() of the last status or response of vesc_id
+      CanRxBuffer buffer;
+      CanFrameQueue pending;
 };
 
 #endif //__CANBUS_H__
\ No newline at end of file
@@ -1,11 +1,53 @@
 #include "CanDevice.h"
 
-boolean CanDevice::init() {
+/*
+  The VESC puts the controller id into bits 0-7 and the packet id into bits 8-15 of the
+  extended identifier, everything above is zero. The hardware filter only checks that, the
+  controller ids are left to the bitmap isAccepted() checks in the RX task. Controllers found
+  at runtime (a second VESC, a BMS) are added to the bitmap without touching the driver, a
+  narrower hardware mask would have to be widened by reinstalling the driver, which loses the
+  frames in its queues and pulls the driver away from the TX task while it waits for alerts.
+  Dual filter mode can't be used, for extended frames it only compares identifier bits 13-28.
+*/
+twai_filter_config_t CanDevice::buildFilter() {
+#ifdef CAN_FILTER_ACCEPT_ALL
+    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    for (auto &word : acceptedIds) {
+        word.store(0xFFFFFFFF, std::memory_order_relaxed);
+    }
+#else
+    twai_filter_config_t f_config = {};
+    // register layout for extended frames: ID28..ID0 in bits 31..3, RTR in bit 2, a set mask bit means "don't care"
+    f_config.acceptance_code = 0;
+    f_config.acceptance_mask = ((uint32_t) 0xFFFF << 3) | 0x3;
+    f_config.single_filter = true;
+#endif
+    snprintf(buf, bufSize, "Acceptance filter code 0x%08" PRIx32 ", mask 0x%08" PRIx32,
+             f_config.acceptance_code, f_config.acceptance_mask);
+    Logger::notice(LOG_TAG_CANDEVICE, buf);
+    return f_config;
+}
+
+boolean CanDevice::isAccepted(const twai_message_t &message) const {
+    //VESC only uses ext packages
+    if (!message.extd) {
+        return false;
+    }
+    uint8_t id = message.identifier & 0xFF;
+    return (acceptedIds[id >> 5].load(std::memory_order_relaxed) >> (id & 31)) & 1;
+}
+
+boolean CanDevice::init(const uint8_t *ids, int count) {
     twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(GPIO_CAN_TX_PIN, GPIO_CAN_RX_PIN, TWAI_MODE_NORMAL);
-    g_config.rx_queue_len=1000;
-    g_config.tx_queue_len=10;
+    // frames are moved to rxRing by rxTask right away, the driver queue only has to bridge scheduling gaps
+    g_config.rx_queue_len=64;
+    g_config.tx_queue_len=CAN_DRIVER_TX_QUEUE_LEN;
+    g_config.alerts_enabled = TWAI_ALERT_TX_SUCCESS | TWAI_ALERT_TX_FAILED | TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED;
     twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
-    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    for (int i = 0; i < count; i++) {
+        acceptedIds[ids[i] >> 5].fetch_or((uint32_t) 1 << (ids[i] & 31), std::memory_order_relaxed);
+    }
+    twai_filter_config_t f_config = buildFilter();
 
     // Install TWAI driver
     if (twai_driver_install(&g_config, &t_config, &f_config) == ESP_OK) {
@@ -21,10 +63,81 @@ boolean CanDevice::init() {
         printf("Failed to start driver\n");
         return false;
     }
+    if (xTaskCreatePinnedToCore(rxTask, "can_rx", 4096, this, CAN_RX_TASK_PRIORITY, &rxTaskHandle, CAN_RX_TASK_CORE) != pdPASS) {
+        printf("Failed to start CAN RX task\n");
+        return false;
+    }
+    txQueues[CAN_TX_CONTROL] = xQueueCreate(CAN_TX_CONTROL_QUEUE_LEN, sizeof(CanTxRequest));
+    txQueues[CAN_TX_PROXY] = xQueueCreate(CAN_TX_PROXY_QUEUE_LEN, sizeof(CanTxRequest));
+    txQueues[CAN_TX_BMS] = xQueueCreate(CAN_TX_BMS_QUEUE_LEN, sizeof(CanTxRequest));
+    if (xTaskCreatePinnedToCore(txTask, "can_tx", 4096, this, CAN_TX_TASK_PRIORITY, &txTaskHandle, CAN_RX_TASK_CORE) != pdPASS) {
+        printf("Failed to start CAN TX task\n");
+        return false;
+    }
+    return true;
+}
+
+// lets frames of a controller found at runtime pass, takes effect with the next frame the RX task reads
+void CanDevice::acceptController(uint8_t id) {
+    acceptedIds[id >> 5].fetch_or((uint32_t) 1 << (id & 31), std::memory_order_relaxed);
+}
+
+void CanDevice::rxTask(void *param) {
+    auto *device = static_cast<CanDevice *>(param);
+    for (;;) {
+        device->receiveFromDriver(portMAX_DELAY);
+    }
+}
+
+// one pass of the RX task, false if the driver had no frame
+boolean CanDevice::receiveFromDriver(TickType_t wait) {
+    CanFrame frame = {};
+    esp_err_t result = twai_receive(&frame.message, wait);
+    if (result == ESP_ERR_TIMEOUT) {
+        return false;
+    }
+    if (result != ESP_OK) {
+        // driver stopped or in bus-off, don't spin
+        vTaskDelay(pdMS_TO_TICKS(10));
+        return false;
+    }
+    if (!isAccepted(frame.message)) {
+        return true;
+    }
+    frame.timestamp = micros();
+    rxRing.push(frame);
+    recorder.record(frame, false);
     return true;
 }
 
-boolean CanDevice::sendCanFrame(const twai_message_t *p_frame) {
+#ifdef NATIVE
+// no tasks on the host, the simulation runs their bodies from here
+void CanDevice::service() {
+    while (receiveFromDriver(0)) {
+    }
+    transmitStep();
+}
+#endif //NATIVE
+
+boolean CanDevice::receive(CanFrame *frame) {
+    return rxRing.pop(frame);
+}
+
+uint32_t CanDevice::pendingFrames() const {
+    return rxRing.size();
+}
+
+uint32_t CanDevice::droppedFrames() const {
+    return rxRing.droppedFrames();
+}
+
+/*
+  Only queues the frame, the CAN TX task hands it to the driver. Nothing blocks here except a
+  proxy frame finding its queue full, which waits up to CAN_TX_PROXY_WAIT ms for room so a long
+  VESC Tool packet isn't cut short.
+*/
+boolean CanDevice::sendCanFrame(const twai_message_t *p_frame, CanTxPriority priority,
+                                CanTxCallback callback, void *context) {
     if (Logger::getLogLevel() == Logger::VERBOSE) {
         char buf[128];
         snprintf(buf, 128, "Sending CAN frame %" PRIu32 " DLC %d, [%d, %d, %d, %d, %d, %d, %d, %d]",
@@ -40,14 +153,129 @@ boolean CanDevice::sendCanFrame(const twai_message_t *p_frame) {
                 p_frame->data[7]);
         Logger::verbose(LOG_TAG_CANDEVICE, buf);
     }
-    xSemaphoreTake(mutex_v, portMAX_DELAY);
-    //Queue message for transmission
-    if (twai_transmit(p_frame, pdMS_TO_TICKS(10)) != ESP_OK) {
+    if (txTaskHandle == nullptr) {
+        return false;
+    }
+    CanTxRequest request = {*p_frame, callback, context};
+    TickType_t wait = priority == CAN_TX_PROXY ? pdMS_TO_TICKS(CAN_TX_PROXY_WAIT) : 0;
+    if (xQueueSend(txQueues[priority], &request, wait) != pdTRUE) {
         printf("Failed to queue message for transmission\n");
-        xSemaphoreGive(mutex_v);
         return false;
     }
-    xSemaphoreGive(mutex_v);
-    delay(1); // This is needed, dunno why!
+    xTaskNotifyGive(txTaskHandle);
     return true;
-}
\ No newline at end of file
+}
+
+/*
+  Keeps at most CAN_DRIVER_TX_QUEUE_LEN frames in the driver, which is what the old delay(1)
+  after every frame did by accident: without it the driver queue overflowed and frames got lost.
+  The TX alerts don't say how many frames were sent, so the number still queued in the driver
+  is compared with the number we handed over.
+*/
+void CanDevice::txTask(void *param) {
+    auto *device = static_cast<CanDevice *>(param);
+    for (;;) {
+        device->transmitStep();
+    }
+}
+
+// one pass of the TX task, the only one that reads alerts and recovers the driver. The driver
+// stays installed from init() on, so nothing frees it while this task waits for an alert
+void CanDevice::transmitStep() {
+    fillDriverQueue();
+    uint32_t alerts = 0;
+    TickType_t wait = inFlightCount > 0 ? pdMS_TO_TICKS(10) : 0;
+    if (twai_read_alerts(&alerts, wait) != ESP_OK) {
+        alerts = 0;
+    }
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        busOffEvents++;
+        Logger::warning(LOG_TAG_CANDEVICE, "bus off, starting recovery");
+        xSemaphoreTake(mutex_v, portMAX_DELAY);
+        failInFlight();
+        xSemaphoreGive(mutex_v);
+        twai_initiate_recovery();
+        return;
+    }
+    if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+        Logger::notice(LOG_TAG_CANDEVICE, "bus recovered");
+        twai_start();
+    }
+    if (inFlightCount > 0) {
+        twai_status_info_t status;
+        xSemaphoreTake(mutex_v, portMAX_DELAY);
+        if (twai_get_status_info(&status) == ESP_OK) {
+            completeFrames(status.msgs_to_tx, alerts & TWAI_ALERT_TX_FAILED ? 1 : 0);
+        }
+        xSemaphoreGive(mutex_v);
+    } else if (alerts == 0) {
+        // nothing in flight, sleep until sendCanFrame() queues something
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+}
+
+void CanDevice::fillDriverQueue() {
+    xSemaphoreTake(mutex_v, portMAX_DELAY);
+    while (inFlightCount < CAN_DRIVER_TX_QUEUE_LEN) {
+        CanTxRequest request;
+        int priority = 0;
+        while (priority < CAN_TX_PRIORITY_COUNT && xQueueReceive(txQueues[priority], &request, 0) != pdTRUE) {
+            priority++;
+        }
+        if (priority == CAN_TX_PRIORITY_COUNT) {
+            break;
+        }
+        if (twai_transmit(&request.message, 0) != ESP_OK) {
+            // driver stopped or in bus-off
+            txFailed++;
+            if (request.callback != nullptr) {
+                request.callback(request.context, false);
+            }
+            continue;
+        }
+        inFlight[(inFlightHead + inFlightCount) % (CAN_DRIVER_TX_QUEUE_LEN + 1)] = request;
+        inFlightCount++;
+    }
+    xSemaphoreGive(mutex_v);
+}
+
+/*
+  Called under mutex_v. A TX_FAILED alert only says that some transmission failed since the
+  last read, not which one or how many, so it is counted against the oldest frame that left
+  the driver in this pass and the others count as sent.
+*/
+void CanDevice::completeFrames(uint32_t queuedInDriver, uint32_t failures) {
+    while (inFlightCount > queuedInDriver) {
+        CanTxRequest &request = inFlight[inFlightHead];
+        inFlightHead = (inFlightHead + 1) % (CAN_DRIVER_TX_QUEUE_LEN + 1);
+        inFlightCount--;
+        boolean failed = failures > 0;
+        if (failed) {
+            failures--;
+            txFailed++;
+        } else {
+            txFrames++;
+            txBits += frameBits(request.message.data_length_code);
+            if (recorder.isRecording()) {
+                CanFrame frame = {request.message, micros()};
+                recorder.record(frame, true);
+            }
+        }
+        if (request.callback != nullptr) {
+            request.callback(request.context, !failed);
+        }
+    }
+}
+
+// called under mutex_v, whatever the driver still held is gone
+void CanDevice::failInFlight() {
+    completeFrames(0, inFlightCount);
+}
+
+boolean CanDevice::getStatus(twai_status_info_t *status) {
+    return twai_get_status_info(status) == ESP_OK;
+}
+
+uint32_t CanDevice::failedFrames() const {
+    return txFailed.load();
+}
@@ -4,7 +4,10 @@
 #include "Arduino.h"
 #include "config.h"
 #include <Logger.h>
+#include <atomic>
 #include "driver/twai.h"
+#include "CanFrameRing.h"
+#include "CanRecorder.h"
 
 #define LOG_TAG_CANDEVICE "CanDevice"
 
@@ -16,6 +19,41 @@
 #define CAN_RX_PIN 27
 #endif //CAN_RX_PIN
 
+#ifndef CAN_RX_TASK_CORE
+#define CAN_RX_TASK_CORE 0 // the Arduino loop runs on core 1
+#endif //CAN_RX_TASK_CORE
+
+#ifndef CAN_RX_TASK_PRIORITY
+#define CAN_RX_TASK_PRIORITY 10
+#endif //CAN_RX_TASK_PRIORITY
+
+#ifndef CAN_TX_TASK_PRIORITY
+#define CAN_TX_TASK_PRIORITY 9
+#endif //CAN_TX_TASK_PRIORITY
+
+#define CAN_DRIVER_TX_QUEUE_LEN 10 // frames handed to the driver at a time, the rest waits in our queues
+#define CAN_TX_CONTROL_QUEUE_LEN 16
+#define CAN_TX_PROXY_QUEUE_LEN 128 // a 700 byte proxy packet fits without waiting
+#define CAN_TX_BMS_QUEUE_LEN 32
+#define CAN_TX_PROXY_WAIT 20       // ms a proxy frame may wait for room in a full queue
+
+// served strictly in this order
+enum CanTxPriority {
+    CAN_TX_CONTROL,       // telemetry requests, pings
+    CAN_TX_PROXY,         // VESC Tool traffic from BLE
+    CAN_TX_BMS,           // BMS status broadcasts
+    CAN_TX_PRIORITY_COUNT
+};
+
+// called from the CAN TX task once the frame left the controller (success) or was dropped
+typedef void (*CanTxCallback)(void *context, boolean success);
+
+struct CanTxRequest {
+    twai_message_t message;
+    CanTxCallback callback;
+    void *context;
+};
+
 //Macros to fix actually being able to map the CAN GPIO pins in platformio.ini instead of them being hard coded in init() for TWAI_GENERAL_CONFIG_DEFAULT();
 #ifndef ESP32S3
   #define GPIO_NUM_HELPER(x) GPIO_NUM##x
@@ -34,8 +72,47 @@ class CanDevice {
     const static int bufSize = 128;
     char buf[bufSize];
     SemaphoreHandle_t mutex_v = xSemaphoreCreateMutex();
+    TaskHandle_t rxTaskHandle = nullptr;
+    CanFrameRing rxRing;
+    std::atomic<uint32_t> acceptedIds[8] = {}; // bitmap of controller ids passing the software filter stage
+    TaskHandle_t txTaskHandle = nullptr;
+    QueueHandle_t txQueues[CAN_TX_PRIORITY_COUNT] = {};
+    // callbacks of the frames handed to the driver, in transmit order, only touched under mutex_v
+    CanTxRequest inFlight[CAN_DRIVER_TX_QUEUE_LEN + 1];
+    uint8_t inFlightHead = 0;
+    uint8_t inFlightCount = 0;
+    std::atomic<uint32_t> txFailed{0};
+    std::atomic<uint32_t> txFrames{0};
+    std::atomic<uint32_t> txBits{0};
+    std::atomic<uint32_t> busOffEvents{0};
+    static void rxTask(void *param);
+    static void txTask(void *param);
+    boolean receiveFromDriver(TickType_t wait);
+    void transmitStep();
+    void completeFrames(uint32_t queuedInDriver, uint32_t failures);
+    void failInFlight();
+    void fillDriverQueue();
+    boolean isAccepted(const twai_message_t &message) const;
+    twai_filter_config_t buildFilter();
   public:
-    boolean init();
-    boolean sendCanFrame(const twai_message_t *p_frame);
+    CanRecorder recorder;
+    boolean init(const uint8_t *ids, int count);
+    void acceptController(uint8_t id);
+    boolean sendCanFrame(const twai_message_t *p_frame, CanTxPriority priority = CAN_TX_CONTROL,
+                         CanTxCallback callback = nullptr, void *context = nullptr);
+    boolean receive(CanFrame *frame);
+    uint32_t pendingFrames() const;
+    uint32_t droppedFrames() const;
+    uint32_t failedFrames() const;
+    uint32_t sentFrames() const { return txFrames.load(); }
+    uint32_t sentBits() const { return txBits.load(); }
+    uint32_t busOffCount() const { return busOffEvents.load(); }
+    uint32_t rxHighWaterMark() const { return rxRing.highWaterMark(); }
+    boolean getStatus(twai_status_info_t *status);
+    // bits an extended data frame occupies on the bus, including ~10% stuff bits and the interframe space
+    static uint32_t frameBits(uint8_t dlc) { return 67 + 8 * dlc + (54 + 8 * dlc) / 10; }
+#ifdef NATIVE
+    void service();
+#endif //NATIVE
 };
 #endif //RESCUE_CANDEVICE_H
@@ -0,0 +1,82 @@
+#include "CanFrameQueue.h"
+#include "VescCanConstants.h"
+
+boolean CanFrameQueue::isStatus(uint32_t identifier) {
+    if (identifier > 0xFFFF) {
+        return false;
+    }
+    switch ((identifier >> 8) & 0xFF) {
+        case CAN_PACKET_STATUS:
+        case CAN_PACKET_STATUS_2:
+        case CAN_PACKET_STATUS_3:
+        case CAN_PACKET_STATUS_4:
+        case CAN_PACKET_STATUS_5:
+        case CAN_PACKET_STATUS_6:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void CanFrameQueue::push(const CanFrame &frame) {
+    StatusSlot *slot = isStatus(frame.message.identifier) ? statusSlot(frame.message.identifier) : nullptr;
+    if (slot == nullptr) {
+        pushControl(frame);
+        return;
+    }
+    if (slot->waiting) {
+        coalesced++;
+    } else {
+        slot->waiting = true;
+        statusCount++;
+    }
+    slot->frame = frame;
+}
+
+void CanFrameQueue::pushControl(const CanFrame &frame) {
+    if (full()) {
+        return;
+    }
+    control[(controlHead + controlCount) & (CAN_FRAME_QUEUE_SIZE - 1)] = frame;
+    controlCount++;
+}
+
+boolean CanFrameQueue::pop(CanFrame *frame) {
+    if (controlCount > 0) {
+        *frame = control[controlHead];
+        controlHead = (controlHead + 1) & (CAN_FRAME_QUEUE_SIZE - 1);
+        controlCount--;
+        return true;
+    }
+    if (statusCount == 0) {
+        return false;
+    }
+    for (int i = 0; i < CAN_STATUS_SLOTS; i++) {
+        StatusSlot &slot = status[(nextStatus + i) & (CAN_STATUS_SLOTS - 1)];
+        if (slot.waiting) {
+            *frame = slot.frame;
+            slot.waiting = false;
+            statusCount--;
+            nextStatus = (nextStatus + i + 1) & (CAN_STATUS_SLOTS - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// the slot of a status identifier, slots are never given back, nullptr once all are taken
+CanFrameQueue::StatusSlot *CanFrameQueue::statusSlot(uint16_t key) {
+    uint8_t start = (key ^ (key >> 5)) & (CAN_STATUS_SLOTS - 1);
+    for (int i = 0; i < CAN_STATUS_SLOTS; i++) {
+        StatusSlot &slot = status[(start + i) & (CAN_STATUS_SLOTS - 1)];
+        if (!slot.used) {
+            slot.used = true;
+            slot.key = key;
+            return &slot;
+        }
+        if (slot.key == key) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,49 @@
+#ifndef RESCUE_CANFRAMEQUEUE_H
+#define RESCUE_CANFRAMEQUEUE_H
+
+#include "Arduino.h"
+#include "CanFrameRing.h"
+
+#ifndef CAN_FRAME_QUEUE_SIZE
+#define CAN_FRAME_QUEUE_SIZE 64 // control frames taken from the ring but not processed yet, power of two
+#endif //CAN_FRAME_QUEUE_SIZE
+
+#define CAN_STATUS_SLOTS 32 // (status, controller) pairs that can wait at the same time, power of two
+
+/*
+  Frames CanBus has taken from the CanFrameRing, waiting for their turn. Status broadcasts
+  only ever matter in their newest version, so they are kept in one slot per identifier and a
+  newer frame replaces a waiting one. Everything else (buffer transfers, pongs, proxy traffic)
+  is queued in order and always comes out before the status frames.
+  Only used from CanBus::loop(), no synchronization.
+*/
+class CanFrameQueue {
+  public:
+    static boolean isStatus(uint32_t identifier);
+    void push(const CanFrame &frame);
+    boolean pop(CanFrame *frame);
+    // no room for another control frame, leave the rest in the ring
+    boolean full() const { return controlCount == CAN_FRAME_QUEUE_SIZE; }
+    uint32_t size() const { return controlCount + statusCount; }
+
+    uint32_t coalesced = 0; // status frames replaced by a newer one before they were processed
+
+  private:
+    static_assert((CAN_FRAME_QUEUE_SIZE & (CAN_FRAME_QUEUE_SIZE - 1)) == 0, "CAN_FRAME_QUEUE_SIZE must be a power of two");
+    struct StatusSlot {
+        CanFrame frame;
+        uint16_t key;
+        boolean used;
+        boolean waiting;
+    };
+    CanFrame control[CAN_FRAME_QUEUE_SIZE];
+    uint32_t controlHead = 0;
+    uint32_t controlCount = 0;
+    StatusSlot status[CAN_STATUS_SLOTS] = {};
+    uint32_t statusCount = 0;
+    uint8_t nextStatus = 0; // where the round robin over the status slots continues
+    StatusSlot *statusSlot(uint16_t key);
+    void pushControl(const CanFrame &frame);
+};
+
+#endif //RESCUE_CANFRAMEQUEUE_H
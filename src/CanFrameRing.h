@@ -0,0 +1,73 @@
+#ifndef RESCUE_CANFRAMERING_H
+#define RESCUE_CANFRAMERING_H
+
+#include "Arduino.h"
+#include <atomic>
+#include "driver/twai.h"
+
+#ifndef CAN_RX_RING_SIZE
+#define CAN_RX_RING_SIZE 256 // must be a power of two
+#endif //CAN_RX_RING_SIZE
+
+struct CanFrame {
+    twai_message_t message;
+    unsigned long timestamp; // micros() when the frame was taken from the driver
+};
+
+/*
+  Lock-free single-producer/single-consumer ring for received CAN frames.
+  The CAN RX task is the only producer, CanBus::loop() the only consumer.
+  Neither side ever blocks, a full ring drops the newest frame and counts it.
+*/
+class CanFrameRing {
+  public:
+    boolean push(const CanFrame &frame) {
+        uint32_t head = this->head.load(std::memory_order_relaxed);
+        uint32_t tail = this->tail.load(std::memory_order_acquire);
+        if (head - tail >= CAN_RX_RING_SIZE) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        frames[head & MASK] = frame;
+        this->head.store(head + 1, std::memory_order_release);
+        if (head + 1 - tail > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(head + 1 - tail, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    boolean pop(CanFrame *frame) {
+        uint32_t tail = this->tail.load(std::memory_order_relaxed);
+        uint32_t head = this->head.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+        *frame = frames[tail & MASK];
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    uint32_t droppedFrames() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    // most frames that were waiting at the same time
+    uint32_t highWaterMark() const {
+        return highWater.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static_assert((CAN_RX_RING_SIZE & (CAN_RX_RING_SIZE - 1)) == 0, "CAN_RX_RING_SIZE must be a power of two");
+    const static uint32_t MASK = CAN_RX_RING_SIZE - 1;
+    CanFrame frames[CAN_RX_RING_SIZE];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<uint32_t> highWater{0};
+};
+
+#endif //RESCUE_CANFRAMERING_H
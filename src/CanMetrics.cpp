@@ -0,0 +1,101 @@
+#include "CanMetrics.h"
+
+void CanMetrics::countRx(const twai_message_t &frame) {
+    rxFrames++;
+    rxBits += CanDevice::frameBits(frame.data_length_code);
+    auto key = (uint16_t) frame.identifier;
+    for (int i = 0; i < CAN_METRICS_IDENTIFIERS; i++) {
+        IdentifierCount &entry = identifiers[(key + i) & (CAN_METRICS_IDENTIFIERS - 1)];
+        if (entry.count == 0) {
+            entry.identifier = key;
+        }
+        if (entry.identifier == key) {
+            entry.count++;
+            return;
+        }
+    }
+    otherIdentifiers++;
+}
+
+void CanMetrics::countLoop(int frameCount, uint32_t backlog, uint32_t coalesced) {
+    if ((uint32_t) frameCount > maxFramesPerLoop) {
+        maxFramesPerLoop = frameCount;
+    }
+    if (backlog > 0) {
+        budgetExhausted++;
+    }
+    if (backlog > maxBacklog) {
+        maxBacklog = backlog;
+    }
+    coalescedFrames = coalesced;
+}
+
+// returns true when a new window was sampled
+boolean CanMetrics::sample(CanDevice *device, unsigned long now) {
+    if (now - windowStart < CAN_METRICS_INTERVAL) {
+        return false;
+    }
+    unsigned long elapsed = now - windowStart;
+    uint32_t txFrames = device->sentFrames();
+    uint32_t txBits = device->sentBits();
+    if (windowStart != 0) {
+        rxFramesPerSecond = (rxFrames - windowRxFrames) * 1000 / elapsed;
+        txFramesPerSecond = (txFrames - windowTxFrames) * 1000 / elapsed;
+        uint64_t bits = (uint64_t) (rxBits - windowRxBits) + (txBits - windowTxBits);
+        busLoadPermille = bits * 1000 * 1000 / ((uint64_t) CAN_BITRATE * elapsed);
+    }
+    windowRxFrames = rxFrames;
+    windowRxBits = rxBits;
+    windowTxFrames = txFrames;
+    windowTxBits = txBits;
+    windowStart = now;
+
+    if (device->getStatus(&status) && status.msgs_to_rx > driverRxHighWater) {
+        driverRxHighWater = status.msgs_to_rx;
+    }
+    rxRingHighWater = device->rxHighWaterMark();
+    rxRingDropped = device->droppedFrames();
+    txFailed = device->failedFrames();
+    busOff = device->busOffCount();
+    return true;
+}
+
+/*
+  rx fps;tx fps;load permille;tx error counter;rx error counter;arbitration lost;bus errors;
+  bus off;rx missed (driver queue full);rx overrun (hw fifo);ring high water;ring dropped;
+  tx failed;max frames per loop;max backlog;coalesced status frames
+*/
+int CanMetrics::format(char *out, int size) const {
+    return snprintf(out, size, "%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32
+                               ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32
+                               ";%" PRIu32 ";%" PRIu32,
+                    rxFramesPerSecond, txFramesPerSecond, busLoadPermille,
+                    status.tx_error_counter, status.rx_error_counter, status.arb_lost_count, status.bus_error_count,
+                    busOff, status.rx_missed_count, status.rx_overrun_count, rxRingHighWater, rxRingDropped,
+                    txFailed, maxFramesPerLoop, maxBacklog, coalescedFrames);
+}
+
+void CanMetrics::dump() {
+    snprintf(buf, bufSize, "rx %" PRIu32 "/s, tx %" PRIu32 "/s, load %" PRIu32 ".%" PRIu32 "%%, tec %" PRIu32
+                           ", rec %" PRIu32 ", arb lost %" PRIu32 ", bus errors %" PRIu32 ", bus off %" PRIu32,
+             rxFramesPerSecond, txFramesPerSecond, busLoadPermille / 10, busLoadPermille % 10,
+             status.tx_error_counter, status.rx_error_counter, status.arb_lost_count, status.bus_error_count, busOff);
+    Logger::verbose(LOG_TAG_CANMETRICS, buf);
+    snprintf(buf, bufSize, "rx missed %" PRIu32 ", rx overrun %" PRIu32 ", driver rx high water %" PRIu32
+                           ", ring high water %" PRIu32 ", ring dropped %" PRIu32 ", tx failed %" PRIu32
+                           ", max frames/loop %" PRIu32 ", budget exhausted %" PRIu32 ", max backlog %" PRIu32
+                           ", coalesced %" PRIu32,
+             status.rx_missed_count, status.rx_overrun_count, driverRxHighWater, rxRingHighWater, rxRingDropped,
+             txFailed, maxFramesPerLoop, budgetExhausted, maxBacklog, coalescedFrames);
+    Logger::verbose(LOG_TAG_CANMETRICS, buf);
+    int length = snprintf(buf, bufSize, "frames per identifier:");
+    for (const auto &entry : identifiers) {
+        if (entry.count != 0 && length < bufSize) {
+            length += snprintf(buf + length, bufSize - length, " %04x=%" PRIu32, entry.identifier, entry.count);
+        }
+    }
+    if (otherIdentifiers != 0 && length < bufSize) {
+        snprintf(buf + length, bufSize - length, " other=%" PRIu32, otherIdentifiers);
+    }
+    Logger::verbose(LOG_TAG_CANMETRICS, buf);
+}
@@ -0,0 +1,64 @@
+#ifndef RESCUE_CANMETRICS_H
+#define RESCUE_CANMETRICS_H
+
+#include "Arduino.h"
+#include <Logger.h>
+#include "CanDevice.h"
+
+#define LOG_TAG_CANMETRICS "CanMetrics"
+
+#ifndef CAN_METRICS_INTERVAL
+#define CAN_METRICS_INTERVAL 1000 // ms per sampling window
+#endif //CAN_METRICS_INTERVAL
+
+#define CAN_BITRATE 500000
+#define CAN_METRICS_IDENTIFIERS 32 // distinct identifiers counted, power of two
+
+/*
+  Bus health and throughput, sampled once per CAN_METRICS_INTERVAL. Rates and load refer to the
+  last window, counters are totals since boot. The bus load only covers frames this device sends
+  or lets through its acceptance filter, traffic between other nodes is invisible to us.
+*/
+class CanMetrics {
+  public:
+    void countRx(const twai_message_t &frame);
+    void countLoop(int frameCount, uint32_t backlog, uint32_t coalesced);
+    boolean sample(CanDevice *device, unsigned long now);
+    int format(char *out, int size) const;
+    void dump();
+
+    // last window
+    uint32_t rxFramesPerSecond = 0;
+    uint32_t txFramesPerSecond = 0;
+    uint32_t busLoadPermille = 0;
+    // since boot
+    uint32_t rxFrames = 0;
+    uint32_t maxFramesPerLoop = 0;
+    uint32_t budgetExhausted = 0; // loops that left frames for the next one
+    uint32_t maxBacklog = 0;      // most frames waiting in the ring and CanBus at the end of a loop
+    uint32_t coalescedFrames = 0; // status frames skipped because a newer one of the same kind arrived
+    uint32_t rxRingHighWater = 0;
+    uint32_t rxRingDropped = 0;
+    uint32_t driverRxHighWater = 0;
+    uint32_t txFailed = 0;
+    uint32_t busOff = 0;
+    twai_status_info_t status = {};
+
+  private:
+    const static int bufSize = 256;
+    char buf[bufSize];
+    struct IdentifierCount {
+        uint16_t identifier;
+        uint32_t count;
+    };
+    IdentifierCount identifiers[CAN_METRICS_IDENTIFIERS] = {};
+    uint32_t otherIdentifiers = 0; // frames whose identifier found no free slot
+    uint32_t rxBits = 0;
+    uint32_t windowRxFrames = 0;
+    uint32_t windowRxBits = 0;
+    uint32_t windowTxFrames = 0;
+    uint32_t windowTxBits = 0;
+    unsigned long windowStart = 0;
+};
+
+#endif //RESCUE_CANMETRICS_H
@@ -0,0 +1,88 @@
+#include "CanRecorder.h"
+#include <SPIFFS.h>
+
+void CanRecorder::start() {
+    if (ring == nullptr) {
+        storage = (uint8_t *) malloc(CAN_CAPTURE_SIZE);
+        if (storage == nullptr) {
+            Logger::error(LOG_TAG_CANRECORDER, "not enough memory for the capture buffer");
+            return;
+        }
+        ring = new CanCaptureRing(storage, CAN_CAPTURE_SIZE);
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    ring->clear();
+    xSemaphoreGive(mutex);
+    recording = true;
+    Logger::notice(LOG_TAG_CANRECORDER, "capture started");
+}
+
+void CanRecorder::stop() {
+    recording = false;
+    if (ring == nullptr) {
+        return;
+    }
+    snprintf(buf, bufSize, "capture stopped, %" PRIu32 " frames, %" PRIu32 " evicted, %" PRIu32 " dropped",
+             ring->records(), ring->evicted(), droppedFrames());
+    Logger::notice(LOG_TAG_CANRECORDER, buf);
+}
+
+void CanRecorder::record(const CanFrame &frame, boolean sent) {
+    if (!recording) {
+        return;
+    }
+    CapturedFrame captured = {};
+    captured.timestamp = frame.timestamp;
+    captured.identifier = frame.message.identifier;
+    captured.dlc = frame.message.data_length_code;
+    captured.flags = (frame.message.extd ? CAN_CAPTURE_FLAG_EXTD : 0) |
+                     (frame.message.rtr ? CAN_CAPTURE_FLAG_RTR : 0) |
+                     (sent ? CAN_CAPTURE_FLAG_TX : 0);
+    memcpy(captured.data, frame.message.data, sizeof(captured.data));
+    // the CAN tasks don't wait, a flush copying the ring only takes a moment anyway
+    if (xSemaphoreTake(mutex, 0) != pdTRUE) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring->append(captured);
+    xSemaphoreGive(mutex);
+}
+
+void CanRecorder::loop() {
+    if (flushRequested.exchange(false)) {
+        flush();
+    }
+}
+
+// copies the ring under the lock and writes the copy after releasing it, the CAN tasks keep recording meanwhile
+boolean CanRecorder::flush() {
+    if (ring == nullptr) {
+        Logger::warning(LOG_TAG_CANRECORDER, "nothing captured");
+        return false;
+    }
+    auto *capture = (uint8_t *) malloc(CAN_CAPTURE_HEADER_SIZE + CAN_CAPTURE_SIZE);
+    if (capture == nullptr) {
+        Logger::error(LOG_TAG_CANRECORDER, "not enough memory to copy the capture");
+        return false;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    size_t total = ring->copyTo(capture, CAN_CAPTURE_HEADER_SIZE + CAN_CAPTURE_SIZE);
+    xSemaphoreGive(mutex);
+
+    size_t written = 0;
+    if (!SPIFFS.begin(true)) {
+        Logger::error(LOG_TAG_CANRECORDER, "failed to mount SPIFFS");
+    } else {
+        File file = SPIFFS.open(CAN_CAPTURE_FILE, FILE_WRITE);
+        if (!file) {
+            Logger::error(LOG_TAG_CANRECORDER, "failed to open capture file");
+        } else {
+            written = file.write(capture, total);
+            file.close();
+        }
+    }
+    free(capture);
+    snprintf(buf, bufSize, "wrote %u of %u bytes to %s", (unsigned) written, (unsigned) total, CAN_CAPTURE_FILE);
+    Logger::notice(LOG_TAG_CANRECORDER, buf);
+    return total > 0 && written == total;
+}
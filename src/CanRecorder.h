@@ -0,0 +1,50 @@
+#ifndef RESCUE_CANRECORDER_H
+#define RESCUE_CANRECORDER_H
+
+#include "Arduino.h"
+#include <Logger.h>
+#include <atomic>
+#include "CanCapture.h"
+#include "CanFrameRing.h"
+
+#define LOG_TAG_CANRECORDER "CanRecorder"
+
+#ifndef CAN_CAPTURE_SIZE
+#define CAN_CAPTURE_SIZE 16384 // bytes of RAM for the most recent frames, ~1300 frames
+#endif //CAN_CAPTURE_SIZE
+
+#define CAN_CAPTURE_FILE "/can.rcap"
+
+/*
+  Records the received and sent CAN frames into a RAM ring while enabled and writes the ring to
+  CAN_CAPTURE_FILE on the SPIFFS partition on request. The file can be replayed on the host,
+  see test/test_can_capture. The RAM is only allocated on the first start(), frames come in from
+  the CAN RX and TX tasks, so the ring is guarded by a mutex. The CAN tasks never wait for it:
+  a frame that finds the ring locked is dropped and counted. The flash write happens on the
+  main loop, with a copy of the ring taken under the lock.
+*/
+class CanRecorder {
+  public:
+    void start();
+    void stop();
+    boolean isRecording() const { return recording; }
+    void record(const CanFrame &frame, boolean sent);
+    // asks loop() to write the capture, safe from any task
+    void requestFlush() { flushRequested = true; }
+    // main loop, writes the capture if it was requested
+    void loop();
+    boolean flush();
+    uint32_t droppedFrames() const { return dropped.load(std::memory_order_relaxed); }
+
+  private:
+    const static int bufSize = 128;
+    char buf[bufSize];
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+    uint8_t *storage = nullptr;
+    CanCaptureRing *ring = nullptr;
+    volatile boolean recording = false;
+    std::atomic<bool> flushRequested{false};
+    std::atomic<uint32_t> dropped{0}; // frames that found the ring locked
+};
+
+#endif //RESCUE_CANRECORDER_H
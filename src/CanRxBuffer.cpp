@@ -0,0 +1,54 @@
+#include "CanRxBuffer.h"
+#include "crc.h"
+
+boolean CanRxBuffer::fill(uint16_t offset, const uint8_t *fragment, uint8_t fragmentLength) {
+    if (offset == 0 && (receivedCount > 0 || length > 0)) {
+        // the VESC starts a new transfer, whatever we had was never processed
+        if (length == 0) {
+            abortedPackets++;
+        }
+        clear();
+    }
+    if ((uint32_t) offset + fragmentLength > CAN_RX_BUFFER_SIZE) {
+        overflowErrors++;
+        return false;
+    }
+    boolean duplicate = false;
+    for (uint16_t i = offset; i < offset + fragmentLength; i++) {
+        uint8_t bit = 1 << (i & 7);
+        if (received[i >> 3] & bit) {
+            duplicate = true;
+        } else {
+            received[i >> 3] |= bit;
+            receivedCount++;
+        }
+    }
+    if (duplicate) {
+        duplicateErrors++;
+    }
+    memcpy(bytes + offset, fragment, fragmentLength);
+    if (offset + fragmentLength > highWater) {
+        highWater = offset + fragmentLength;
+    }
+    return true;
+}
+
+boolean CanRxBuffer::process(uint16_t expectedLength, uint16_t expectedCrc) {
+    if (expectedLength == 0 || highWater != expectedLength || receivedCount != expectedLength) {
+        gapErrors++;
+        return false;
+    }
+    if (crc16(bytes, expectedLength) != expectedCrc) {
+        crcErrors++;
+        return false;
+    }
+    length = expectedLength;
+    return true;
+}
+
+void CanRxBuffer::clear() {
+    memset(received, 0, (highWater + 7) / 8);
+    highWater = 0;
+    receivedCount = 0;
+    length = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef RESCUE_CANRXBUFFER_H
+#define RESCUE_CANRXBUFFER_H
+
+#include "Arduino.h"
+
+#ifndef CAN_RX_BUFFER_SIZE
+#define CAN_RX_BUFFER_SIZE 4096 // PACKET_MAX_PL_LEN of the VESC firmware
+#endif //CAN_RX_BUFFER_SIZE
+
+/*
+  Preallocated reassembly buffer for responses the VESC sends as a sequence of
+  CAN_PACKET_FILL_RX_BUFFER(_LONG) frames followed by CAN_PACKET_PROCESS_RX_BUFFER.
+  Every fragment is written at the offset it declares, a bitmap of received bytes
+  detects gaps and duplicates, and process() only accepts the packet if length and
+  CRC16 match what the VESC announced.
+*/
+class CanRxBuffer {
+  public:
+    boolean fill(uint16_t offset, const uint8_t *fragment, uint8_t fragmentLength);
+    boolean process(uint16_t expectedLength, uint16_t expectedCrc);
+    void clear();
+
+    const uint8_t *data() const { return bytes; }
+    uint16_t size() const { return length; }
+    boolean empty() const { return length == 0; }
+    uint8_t at(uint16_t index) const { return index < length ? bytes[index] : 0; }
+
+    uint32_t overflowErrors = 0;
+    uint32_t duplicateErrors = 0;
+    uint32_t gapErrors = 0;
+    uint32_t crcErrors = 0;
+    uint32_t abortedPackets = 0;
+
+  private:
+    uint8_t bytes[CAN_RX_BUFFER_SIZE];
+    uint8_t received[CAN_RX_BUFFER_SIZE / 8] = {};
+    uint16_t highWater = 0;     // one past the highest byte written
+    uint16_t receivedCount = 0; // number of distinct bytes written
+    uint16_t length = 0;        // length of the validated packet, 0 until process() succeeded
+};
+
+#endif //RESCUE_CANRXBUFFER_H
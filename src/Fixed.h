@@ -0,0 +1,56 @@
+#ifndef RESCUE_FIXED_H
+#define RESCUE_FIXED_H
+
+#include "Arduino.h"
+#include <cmath>
+
+/*
+  Scaled integer in the representation the VESC puts on the wire, e.g. Fixed<int16_t, 10> for an
+  input voltage of 58.6 V sent as 586. Decoders store the wire value as is, the division only
+  happens when a consumer converts to double or float for presentation. The ESP32 FPU has no
+  double precision, so keeping doubles out of the CAN path saves the software emulation on every
+  frame and halves the size of VescTelemetry.
+*/
+template<typename T, int32_t Scale>
+struct Fixed {
+    static constexpr int32_t SCALE = Scale;
+    T raw = 0;
+
+    static Fixed fromRaw(int32_t raw) {
+        Fixed value;
+        value.raw = (T) raw;
+        return value;
+    }
+
+    // the wire value of a field that is sent with another scale, e.g. the current of status 1 in 1/10 A
+    template<int32_t From>
+    static Fixed fromRaw(int32_t raw) {
+        return fromRaw(Scale >= From ? raw * (Scale / From) : raw / (From / Scale));
+    }
+
+    // for values that don't come from the wire as integers (float package, aggregates, configuration)
+    void set(float value) {
+        raw = (T) lroundf(value * Scale);
+    }
+
+    float toFloat() const {
+        return (float) raw / Scale;
+    }
+
+    operator double() const {
+        return (double) raw / Scale;
+    }
+};
+
+// scale of a VescTelemetry member, 1 for plain integers
+template<typename T>
+struct FixedScale {
+    static constexpr int32_t value = 1;
+};
+
+template<typename T, int32_t Scale>
+struct FixedScale<Fixed<T, Scale>> {
+    static constexpr int32_t value = Scale;
+};
+
+#endif //RESCUE_FIXED_H
@@ -0,0 +1,164 @@
+#include "ProxyResponseCache.h"
+#include "VescCanConstants.h"
+
+// requests whose response only changes with the configuration or firmware of the VESC
+boolean ProxyResponseCache::cacheable(const uint8_t *request, uint16_t length) {
+    if (length == 0 || length > PROXY_CACHE_KEY_SIZE) {
+        return false;
+    }
+    switch (request[0]) {
+        case COMM_FW_VERSION:
+        case COMM_GET_MCCONF:
+        case COMM_GET_MCCONF_DEFAULT:
+        case COMM_GET_APPCONF:
+        case COMM_GET_APPCONF_DEFAULT:
+            return length == 1;
+        case COMM_CUSTOM_APP_DATA:
+            return length == 3 && request[1] == FLOAT_PACKAGE_MAGIC && request[2] == FLOAT_COMMAND_GET_INFO;
+        default:
+            return false;
+    }
+}
+
+// requests that read from the VESC without changing anything a cached response depends on
+boolean ProxyResponseCache::query(const uint8_t *request, uint16_t length) {
+    if (cacheable(request, length)) {
+        return true;
+    }
+    switch (request[0]) {
+        case COMM_GET_VALUES:
+        case COMM_ALIVE:
+        case COMM_GET_VALUES_SETUP:
+        case COMM_GET_VALUES_SELECTIVE:
+        case COMM_GET_VALUES_SETUP_SELECTIVE:
+        case COMM_PING_CAN:
+        case COMM_GET_IMU_DATA:
+        case COMM_GET_DECODED_BALANCE:
+            return true;
+        case COMM_CUSTOM_APP_DATA:
+            return length >= 3 && request[1] == FLOAT_PACKAGE_MAGIC &&
+                   (request[2] == FLOAT_COMMAND_GET_RTDATA || request[2] == FLOAT_COMMAND_GET_ALLDATA);
+        default:
+            return false;
+    }
+}
+
+// the bytes a response repeats from its request: the command, for the float package also magic and command
+uint8_t ProxyResponseCache::commandLength(const uint8_t *packet, uint16_t length) {
+    uint8_t command = packet[0] == COMM_CUSTOM_APP_DATA ? 3 : 1;
+    return command <= length ? command : 0;
+}
+
+const uint8_t *ProxyResponseCache::find(const uint8_t *request, uint16_t length, uint16_t *responseLength) {
+    if (!cacheable(request, length)) {
+        return nullptr;
+    }
+    for (Entry &entry : entries) {
+        if (entry.used && entry.key.length == length && memcmp(entry.key.bytes, request, length) == 0) {
+            entry.lastUsed = ++useCounter;
+            *responseLength = entry.length;
+            hits++;
+            return data + entry.offset;
+        }
+    }
+    misses++;
+    return nullptr;
+}
+
+void ProxyResponseCache::requested(const uint8_t *request, uint16_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (!query(request, length)) {
+        if (dataUsed > 0 || pendingCount > 0) {
+            invalidations++;
+        }
+        clear();
+        return;
+    }
+    if (!cacheable(request, length)) {
+        return;
+    }
+    if (pendingCount == PROXY_CACHE_PENDING) {
+        // the oldest one was most likely never answered
+        memmove(&pending[0], &pending[1], sizeof(Key) * (PROXY_CACHE_PENDING - 1));
+        pendingCount--;
+    }
+    Key &key = pending[pendingCount++];
+    memcpy(key.bytes, request, length);
+    key.length = length;
+}
+
+void ProxyResponseCache::responded(const uint8_t *response, uint16_t length) {
+    uint8_t command = commandLength(response, length);
+    if (command == 0) {
+        return;
+    }
+    for (int i = 0; i < pendingCount; i++) {
+        if (pending[i].length >= command && memcmp(pending[i].bytes, response, command) == 0) {
+            Key key = pending[i];
+            memmove(&pending[i], &pending[i + 1], sizeof(Key) * (pendingCount - i - 1));
+            pendingCount--;
+            store(key, response, length);
+            return;
+        }
+    }
+}
+
+void ProxyResponseCache::clear() {
+    for (Entry &entry : entries) {
+        entry.used = false;
+    }
+    dataUsed = 0;
+    pendingCount = 0;
+}
+
+void ProxyResponseCache::store(const Key &key, const uint8_t *response, uint16_t length) {
+    if (length > PROXY_CACHE_SIZE) {
+        return;
+    }
+    for (int i = 0; i < PROXY_CACHE_ENTRIES; i++) {
+        if (entries[i].used && entries[i].key.length == key.length && memcmp(entries[i].key.bytes, key.bytes, key.length) == 0) {
+            remove(i);
+        }
+    }
+    // evict the least recently used until the response and its entry fit
+    int slot;
+    while (true) {
+        int oldest = -1;
+        slot = -1;
+        for (int i = 0; i < PROXY_CACHE_ENTRIES; i++) {
+            if (!entries[i].used) {
+                slot = slot < 0 ? i : slot;
+            } else if (oldest < 0 || entries[i].lastUsed < entries[oldest].lastUsed) {
+                oldest = i;
+            }
+        }
+        if (slot >= 0 && PROXY_CACHE_SIZE - dataUsed >= length) {
+            break;
+        }
+        remove(oldest);
+    }
+    Entry &entry = entries[slot];
+    entry.key = key;
+    entry.offset = dataUsed;
+    entry.length = length;
+    entry.lastUsed = ++useCounter;
+    entry.used = true;
+    memcpy(data + dataUsed, response, length);
+    dataUsed += length;
+}
+
+// drops an entry and moves the responses stored behind it down, so free space stays in one piece
+void ProxyResponseCache::remove(int index) {
+    Entry &removed = entries[index];
+    uint16_t end = removed.offset + removed.length;
+    memmove(data + removed.offset, data + end, dataUsed - end);
+    for (Entry &entry : entries) {
+        if (entry.used && entry.offset >= end) {
+            entry.offset -= removed.length;
+        }
+    }
+    dataUsed -= removed.length;
+    removed.used = false;
+}
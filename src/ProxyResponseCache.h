@@ -0,0 +1,61 @@
+#ifndef RESCUE_PROXYRESPONSECACHE_H
+#define RESCUE_PROXYRESPONSECACHE_H
+
+#include "Arduino.h"
+
+#ifndef PROXY_CACHE_SIZE
+#define PROXY_CACHE_SIZE 3072 // bytes for cached responses, GET_MCCONF alone is ~700
+#endif //PROXY_CACHE_SIZE
+
+#define PROXY_CACHE_ENTRIES 8
+#define PROXY_CACHE_KEY_SIZE 6  // cacheable requests fit into a PROCESS_SHORT_BUFFER frame
+#define PROXY_CACHE_PENDING 4   // cacheable requests on their way to the VESC at the same time
+
+/*
+  Responses to the requests apps repeat on every connect (firmware version, motor and app
+  configuration, float package info) keyed by the request bytes, so BleCanProxy can answer
+  them without a round trip over CAN. A request is only remembered on its way out, its
+  response is stored when it comes back. Every request that isn't a known query, SET_MCCONF
+  and friends in particular, clears the cache, as does a VESC that reconnects.
+  Least recently used responses make room for new ones.
+*/
+class ProxyResponseCache {
+  public:
+    static boolean cacheable(const uint8_t *request, uint16_t length);
+    // the cached response to request, nullptr on a miss
+    const uint8_t *find(const uint8_t *request, uint16_t length, uint16_t *responseLength);
+    // a request the proxy forwards to the VESC
+    void requested(const uint8_t *request, uint16_t length);
+    // a response from the VESC to the proxy
+    void responded(const uint8_t *response, uint16_t length);
+    void clear();
+
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t invalidations = 0;
+
+  private:
+    struct Key {
+        uint8_t bytes[PROXY_CACHE_KEY_SIZE];
+        uint8_t length;
+    };
+    struct Entry {
+        Key key;
+        uint16_t offset;
+        uint16_t length;
+        uint32_t lastUsed;
+        boolean used;
+    };
+    Entry entries[PROXY_CACHE_ENTRIES] = {};
+    uint8_t data[PROXY_CACHE_SIZE];
+    uint16_t dataUsed = 0;
+    Key pending[PROXY_CACHE_PENDING] = {};
+    uint8_t pendingCount = 0;
+    uint32_t useCounter = 0;
+    static boolean query(const uint8_t *request, uint16_t length);
+    static uint8_t commandLength(const uint8_t *packet, uint16_t length);
+    void store(const Key &key, const uint8_t *response, uint16_t length);
+    void remove(int index);
+};
+
+#endif //RESCUE_PROXYRESPONSECACHE_H
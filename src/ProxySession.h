@@ -0,0 +1,52 @@
+#ifndef RESCUE_PROXYSESSION_H
+#define RESCUE_PROXYSESSION_H
+
+#include "Arduino.h"
+#include <atomic>
+#include "ByteRing.h"
+#include "CanRxBuffer.h"
+#include "VescPacketFramer.h"
+
+#ifndef PROXY_SESSIONS
+#define PROXY_SESSIONS 2 // BLE clients proxied at the same time, e.g. a companion app and VESC Tool
+#endif //PROXY_SESSIONS
+
+#ifndef PROXY_RX_RING_SIZE
+#define PROXY_RX_RING_SIZE 4096 // BLE writes waiting for CanBus::loop(), a few at the largest MTU, power of two
+#endif //PROXY_RX_RING_SIZE
+
+#ifndef PROXY_TX_RING_SIZE
+#define PROXY_TX_RING_SIZE 8192 // framed responses waiting for a notification, power of two
+#endif //PROXY_TX_RING_SIZE
+
+static_assert(PROXY_TX_RING_SIZE >= VESC_PACKET_MAX_PAYLOAD + 6, "PROXY_TX_RING_SIZE must hold a packet of the maximum size");
+
+enum ProxySessionState : uint8_t {
+    PROXY_SESSION_FREE,
+    PROXY_SESSION_OPEN,    // a BLE client is connected
+    PROXY_SESSION_CLOSING, // the client is gone, the loop task hasn't cleaned up yet
+};
+
+/*
+  The proxy state of one BLE connection. Every session sends its requests with its own CAN id
+  as the sender, so the VESC addresses the responses to that id and they are reassembled apart
+  from those of other clients. The BLE task opens and closes sessions and fills the inbound
+  ring, everything else is only touched on the loop task.
+*/
+struct ProxySession {
+    std::atomic<uint8_t> state{PROXY_SESSION_FREE};
+    uint16_t connection = 0; // BLE connection handle
+    uint8_t canId = 0;
+    ByteRing<PROXY_RX_RING_SIZE> in;
+    ByteRing<PROXY_TX_RING_SIZE> out;
+    VescPacketFramer framer;
+    CanRxBuffer response;    // a response the VESC sends in FILL_RX_BUFFER frames
+    uint32_t streaming = 0;  // framer.started of the packet whose payload is being sent
+    uint16_t sent = 0;       // payload bytes of that packet already in FILL_RX_BUFFER frames
+    boolean sendFailed = false;
+    boolean waiting = false; // a complete packet waits for the VESC's rx buffer
+
+    boolean open() const { return state.load(std::memory_order_acquire) == PROXY_SESSION_OPEN; }
+};
+
+#endif //RESCUE_PROXYSESSION_H
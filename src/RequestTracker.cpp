@@ -0,0 +1,146 @@
+#include "RequestTracker.h"
+
+PendingRequest *RequestTracker::find(uint8_t controllerId, uint8_t command) {
+    for (auto &request : pending) {
+        if (request.active && request.controllerId == controllerId && request.command == command) {
+            return &request;
+        }
+    }
+    return nullptr;
+}
+
+CommandStats *RequestTracker::statsFor(uint8_t controllerId, uint8_t command) {
+    CommandStats *free = nullptr;
+    for (auto &entry : commands) {
+        if (entry.used && entry.controllerId == controllerId && entry.command == command) {
+            return &entry;
+        }
+        if (!entry.used && free == nullptr) {
+            free = &entry;
+        }
+    }
+    if (free != nullptr) {
+        free->used = true;
+        free->controllerId = controllerId;
+        free->command = command;
+    }
+    return free;
+}
+
+const CommandStats *RequestTracker::stats(uint8_t controllerId, uint8_t command) const {
+    for (const auto &entry : commands) {
+        if (entry.used && entry.controllerId == controllerId && entry.command == command) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+uint8_t RequestTracker::consecutiveTimeouts(uint8_t controllerId, uint8_t command) const {
+    const CommandStats *entry = stats(controllerId, command);
+    return entry != nullptr ? entry->consecutiveTimeouts : 0;
+}
+
+boolean RequestTracker::canSend(uint8_t controllerId, uint8_t command, unsigned long now) {
+    if (find(controllerId, command) != nullptr) {
+        return false;
+    }
+    const CommandStats *entry = stats(controllerId, command);
+    if (entry != nullptr && entry->consecutiveTimeouts > 0 && (long) (now - entry->retryAt) < 0) {
+        return false;
+    }
+    for (const auto &request : pending) {
+        if (!request.active) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RequestTracker::sent(uint8_t controllerId, uint8_t command, unsigned long now, unsigned long timeout) {
+    for (auto &request : pending) {
+        if (!request.active) {
+            request.active = true;
+            request.controllerId = controllerId;
+            request.command = command;
+            request.sentAt = micros();
+            request.deadline = now + timeout;
+            break;
+        }
+    }
+    CommandStats *entry = statsFor(controllerId, command);
+    if (entry != nullptr) {
+        entry->sent++;
+    }
+}
+
+// timestamp is the micros() the last frame of the response was received at
+boolean RequestTracker::answered(uint8_t controllerId, uint8_t command, unsigned long timestamp) {
+    PendingRequest *request = find(controllerId, command);
+    if (request == nullptr) {
+        // unsolicited or already timed out
+        return false;
+    }
+    request->active = false;
+    CommandStats *entry = statsFor(controllerId, command);
+    if (entry == nullptr) {
+        return true;
+    }
+    uint32_t rtt = timestamp - request->sentAt;
+    entry->answered++;
+    entry->lastRtt = rtt;
+    entry->averageRtt = entry->averageRtt == 0 ? rtt : (entry->averageRtt * 7 + rtt) / 8;
+    if (rtt > entry->maxRtt) {
+        entry->maxRtt = rtt;
+    }
+    entry->consecutiveTimeouts = 0;
+    return true;
+}
+
+// drops requests past their deadline, returns how many timed out
+int RequestTracker::expire(unsigned long now) {
+    int expired = 0;
+    for (auto &request : pending) {
+        if (!request.active || (long) (now - request.deadline) < 0) {
+            continue;
+        }
+        request.active = false;
+        expired++;
+        CommandStats *entry = statsFor(request.controllerId, request.command);
+        if (entry == nullptr) {
+            continue;
+        }
+        entry->timeouts++;
+        if (entry->consecutiveTimeouts < 255) {
+            entry->consecutiveTimeouts++;
+        }
+        unsigned long backoff = (unsigned long) REQUEST_TIMEOUT << (entry->consecutiveTimeouts < 5 ? entry->consecutiveTimeouts : 5);
+        entry->retryAt = now + (backoff > REQUEST_BACKOFF_MAX ? REQUEST_BACKOFF_MAX : backoff);
+        snprintf(buf, bufSize, "request 0x%02x to controller %d timed out (%d in a row)",
+                 request.command, request.controllerId, entry->consecutiveTimeouts);
+        Logger::warning(LOG_TAG_REQUESTTRACKER, buf);
+    }
+    return expired;
+}
+
+int RequestTracker::pendingCount() const {
+    int count = 0;
+    for (const auto &request : pending) {
+        if (request.active) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void RequestTracker::dumpStats() {
+    for (const auto &entry : commands) {
+        if (!entry.used) {
+            continue;
+        }
+        snprintf(buf, bufSize, "controller %d command 0x%02x: sent %" PRIu32 ", answered %" PRIu32 ", timeouts %" PRIu32
+                 ", rtt last %" PRIu32 "us avg %" PRIu32 "us max %" PRIu32 "us",
+                 entry.controllerId, entry.command, entry.sent, entry.answered, entry.timeouts, entry.lastRtt, entry.averageRtt, entry.maxRtt);
+        Logger::verbose(LOG_TAG_REQUESTTRACKER, buf);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef RESCUE_REQUESTTRACKER_H
+#define RESCUE_REQUESTTRACKER_H
+
+#include "Arduino.h"
+#include <Logger.h>
+
+#define LOG_TAG_REQUESTTRACKER "RequestTracker"
+
+#ifndef MAX_PENDING_REQUESTS
+#define MAX_PENDING_REQUESTS 8
+#endif //MAX_PENDING_REQUESTS
+
+#ifndef MAX_TRACKED_COMMANDS
+#define MAX_TRACKED_COMMANDS 8 // (controller, command) pairs with statistics
+#endif //MAX_TRACKED_COMMANDS
+
+#define REQUEST_TIMEOUT 250       // ms until an unanswered request counts as lost
+#define REQUEST_BACKOFF_MAX 5000  // ms, upper limit for the pause after repeated timeouts
+
+struct PendingRequest {
+    unsigned long sentAt;   // micros()
+    unsigned long deadline; // millis()
+    uint8_t controllerId;
+    uint8_t command;
+    boolean active;
+};
+
+// round trip statistics per controller and command byte
+struct CommandStats {
+    uint32_t sent;
+    uint32_t answered;
+    uint32_t timeouts;
+    uint32_t lastRtt;    // us
+    uint32_t averageRtt; // us, exponential moving average
+    uint32_t maxRtt;     // us
+    unsigned long retryAt;    // millis(), no new request before this after a timeout
+    uint8_t consecutiveTimeouts;
+    uint8_t controllerId;
+    uint8_t command;
+    boolean used;
+};
+
+/*
+  Keeps track of the requests CanBus has sent to the VESCs. A request is identified by the
+  controller it was sent to and its command byte, responses are matched by the sender id and
+  the command byte they start with. Requests for different commands may be in flight at the
+  same time, a second one for the same command and controller is refused until the first one
+  is answered or timed out. After a timeout the command pauses with exponential backoff, for
+  that controller only: a dead secondary controller doesn't hold up the polls of the primary.
+*/
+class RequestTracker {
+  public:
+    boolean canSend(uint8_t controllerId, uint8_t command, unsigned long now);
+    void sent(uint8_t controllerId, uint8_t command, unsigned long now, unsigned long timeout = REQUEST_TIMEOUT);
+    boolean answered(uint8_t controllerId, uint8_t command, unsigned long timestamp);
+    int expire(unsigned long now);
+    int pendingCount() const;
+    const CommandStats *stats(uint8_t controllerId, uint8_t command) const;
+    uint8_t consecutiveTimeouts(uint8_t controllerId, uint8_t command) const;
+    void dumpStats();
+
+  private:
+    const static int bufSize = 128;
+    char buf[bufSize];
+    PendingRequest pending[MAX_PENDING_REQUESTS] = {};
+    CommandStats commands[MAX_TRACKED_COMMANDS] = {};
+    PendingRequest *find(uint8_t controllerId, uint8_t command);
+    CommandStats *statsFor(uint8_t controllerId, uint8_t command);
+};
+
+#endif //RESCUE_REQUESTTRACKER_H
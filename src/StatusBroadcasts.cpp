@@ -0,0 +1,67 @@
+#include "StatusBroadcasts.h"
+
+void StatusBroadcasts::seen(uint8_t status, unsigned long timestamp) {
+    if (status < 1 || status > STATUS_BROADCAST_COUNT) {
+        return;
+    }
+    StatusRate &rate = rates[status - 1];
+    uint32_t elapsed = timestamp - rate.lastSeen;
+    if (rate.streak > 0 && rate.interval > 0 && elapsed > rate.interval * STATUS_BROADCAST_MISSED) {
+        // the broadcast paused, measure its rate from scratch instead of averaging the gap in
+        rate.streak = 0;
+        rate.interval = 0;
+    }
+    if (rate.streak > 0) {
+        rate.interval = rate.interval == 0 ? elapsed : (rate.interval * 7 + elapsed) / 8;
+    }
+    if (rate.streak < STATUS_BROADCAST_SETTLE) {
+        rate.streak++;
+    }
+    rate.lastSeen = timestamp;
+    rate.count++;
+}
+
+/*
+  Statuses that arrive every maxInterval ms or faster and are still coming, now in micros().
+  A status covers nothing until it arrived STATUS_BROADCAST_SETTLE times without a pause.
+*/
+uint8_t StatusBroadcasts::covered(unsigned long now, unsigned long maxInterval) const {
+    uint8_t mask = 0;
+    for (int i = 0; i < STATUS_BROADCAST_COUNT; i++) {
+        const StatusRate &rate = rates[i];
+        if (rate.streak < STATUS_BROADCAST_SETTLE || rate.interval > maxInterval * 1000) {
+            continue;
+        }
+        if (now - rate.lastSeen <= rate.interval * STATUS_BROADCAST_MISSED) {
+            mask |= STATUS_BIT(i + 1);
+        }
+    }
+    return mask;
+}
+
+uint32_t StatusBroadcasts::interval(uint8_t status) const {
+    return status >= 1 && status <= STATUS_BROADCAST_COUNT ? rates[status - 1].interval : 0;
+}
+
+uint32_t StatusBroadcasts::count(uint8_t status) const {
+    return status >= 1 && status <= STATUS_BROADCAST_COUNT ? rates[status - 1].count : 0;
+}
+
+// observed interval of status 1-6 in ms, 0 for a status that isn't broadcast
+int StatusBroadcasts::format(char *out, int size) const {
+    return snprintf(out, size, "%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32 ";%" PRIu32,
+                    rates[0].interval / 1000, rates[1].interval / 1000, rates[2].interval / 1000,
+                    rates[3].interval / 1000, rates[4].interval / 1000, rates[5].interval / 1000);
+}
+
+void StatusBroadcasts::dump() {
+    for (int i = 0; i < STATUS_BROADCAST_COUNT; i++) {
+        if (rates[i].count == 0) {
+            continue;
+        }
+        uint32_t hertz = rates[i].interval > 0 ? 1000000 / rates[i].interval : 0;
+        snprintf(buf, bufSize, "status %d: %" PRIu32 " frames, every %" PRIu32 "us (%" PRIu32 "Hz)",
+                 i + 1, rates[i].count, rates[i].interval, hertz);
+        Logger::verbose(LOG_TAG_STATUSBROADCASTS, buf);
+    }
+}
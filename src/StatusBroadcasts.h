@@ -0,0 +1,50 @@
+#ifndef RESCUE_STATUSBROADCASTS_H
+#define RESCUE_STATUSBROADCASTS_H
+
+#include "Arduino.h"
+#include <Logger.h>
+
+#define LOG_TAG_STATUSBROADCASTS "StatusBroadcasts"
+
+#define STATUS_BROADCAST_COUNT 6 // CAN_PACKET_STATUS .. CAN_PACKET_STATUS_6
+
+#ifndef STATUS_BROADCAST_MISSED
+#define STATUS_BROADCAST_MISSED 3 // intervals without a status frame until its fields are polled again
+#endif //STATUS_BROADCAST_MISSED
+
+#ifndef STATUS_BROADCAST_SETTLE
+#define STATUS_BROADCAST_SETTLE 4 // frames of a status until its interval is trusted
+#endif //STATUS_BROADCAST_SETTLE
+
+// status n is bit n - 1 in the coverage masks
+#define STATUS_BIT(status) ((uint8_t) (1 << ((status) - 1)))
+
+/*
+  Observes the CAN_PACKET_STATUS 1-6 broadcasts of the primary controller. A status covers its
+  fields as long as it arrives at least as often as CanBus would poll them and hasn't missed
+  STATUS_BROADCAST_MISSED of its own intervals, so polling resumes on its own when the VESC
+  stops broadcasting or is reconfigured to a slower rate.
+*/
+class StatusBroadcasts {
+  public:
+    void seen(uint8_t status, unsigned long timestamp);
+    uint8_t covered(unsigned long now, unsigned long maxInterval) const;
+    // smoothed time between two frames of a status in us, 0 until it was received twice
+    uint32_t interval(uint8_t status) const;
+    uint32_t count(uint8_t status) const;
+    int format(char *out, int size) const;
+    void dump();
+
+  private:
+    const static int bufSize = 128;
+    char buf[bufSize];
+    struct StatusRate {
+        unsigned long lastSeen; // micros()
+        uint32_t interval;      // us, exponential moving average
+        uint32_t count;
+        uint8_t streak;         // frames since the broadcast (re)started, up to STATUS_BROADCAST_SETTLE
+    };
+    StatusRate rates[STATUS_BROADCAST_COUNT] = {};
+};
+
+#endif //RESCUE_STATUSBROADCASTS_H
@@ -0,0 +1,126 @@
+#include "TelemetryFrame.h"
+#include "buffer.h"
+
+// wire value of a Fixed in another scale, saturated to 16 bits
+static int16_t rescale16(int32_t raw, int32_t divisor) {
+    int32_t value = raw / divisor;
+    return (int16_t) (value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value);
+}
+
+// bytes of each TelemetryFrameField on the wire
+static const uint8_t fieldSizes[TELEMETRY_FIELD_COUNT] = {4, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 4, 2};
+
+static uint8_t saturate8(uint16_t value) {
+    return (uint8_t) (value > UINT8_MAX ? UINT8_MAX : value);
+}
+
+boolean TelemetryFrame::configure(const uint8_t *request, size_t length) {
+    if (length < 4) {
+        return false;
+    }
+    int32_t index = 0;
+    uint16_t interval = buffer_get_uint16(request, &index);
+    uint16_t mask = buffer_get_uint16(request, &index);
+    if (interval > 0 && interval < TELEMETRY_FRAME_MIN_INTERVAL) {
+        interval = TELEMETRY_FRAME_MIN_INTERVAL;
+    }
+    fieldMask.store(mask, std::memory_order_relaxed);
+    intervalMs.store(interval, std::memory_order_relaxed);
+    return true;
+}
+
+boolean TelemetryFrame::due(unsigned long now) const {
+    uint16_t interval = intervalMs.load(std::memory_order_relaxed);
+    return interval > 0 && now - lastFrame >= interval;
+}
+
+size_t TelemetryFrame::next(const VescTelemetry &telemetry, unsigned long now, uint8_t *out, size_t maxLength) {
+    uint16_t mask = fit(fieldMask.load(std::memory_order_relaxed), maxLength);
+    size_t length = pack(telemetry, mask, sequence++, now, out);
+    lastFrame = now;
+    return length;
+}
+
+uint16_t TelemetryFrame::fit(uint16_t mask, size_t maxLength) {
+    size_t length = TELEMETRY_FRAME_HEADER_SIZE;
+    for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+        if ((mask & (1 << field)) == 0) {
+            continue;
+        }
+        length += fieldSizes[field];
+        if (length > maxLength) {
+            // everything from this field on
+            return mask & ((1 << field) - 1);
+        }
+    }
+    return mask;
+}
+
+size_t TelemetryFrame::pack(const VescTelemetry &telemetry, uint16_t mask, uint8_t sequence, unsigned long now,
+                            uint8_t *out) {
+    int32_t index = 0;
+    out[index++] = TELEMETRY_FRAME_VERSION;
+    out[index++] = sequence;
+    buffer_append_uint16(out, mask, &index);
+    for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+        if ((mask & (1 << field)) == 0) {
+            continue;
+        }
+        switch (field) {
+            case TELEMETRY_FIELD_ERPM:
+                buffer_append_int32(out, telemetry.erpm.raw, &index);
+                break;
+            case TELEMETRY_FIELD_DUTY:
+                buffer_append_int16(out, telemetry.dutyCycle.raw, &index);
+                break;
+            case TELEMETRY_FIELD_MOTOR_CURRENT:
+                buffer_append_int16(out, rescale16(telemetry.motorCurrent.raw, 10), &index);
+                break;
+            case TELEMETRY_FIELD_INPUT_CURRENT:
+                buffer_append_int16(out, rescale16(telemetry.current.raw, 10), &index);
+                break;
+            case TELEMETRY_FIELD_INPUT_VOLTAGE:
+                buffer_append_int16(out, telemetry.inputVoltage.raw, &index);
+                break;
+            case TELEMETRY_FIELD_MOSFET_TEMP:
+                buffer_append_int16(out, telemetry.mosfetTemp.raw, &index);
+                break;
+            case TELEMETRY_FIELD_MOTOR_TEMP:
+                buffer_append_int16(out, telemetry.motorTemp.raw, &index);
+                break;
+            case TELEMETRY_FIELD_PITCH:
+                buffer_append_int16(out, rescale16(telemetry.pitch.raw, 10000), &index);
+                break;
+            case TELEMETRY_FIELD_ROLL:
+                buffer_append_int16(out, rescale16(telemetry.roll.raw, 10000), &index);
+                break;
+            case TELEMETRY_FIELD_SWITCH_STATE:
+                out[index++] = saturate8(telemetry.switchState);
+                break;
+            case TELEMETRY_FIELD_BALANCE_STATE:
+                out[index++] = saturate8(telemetry.balanceState);
+                break;
+            case TELEMETRY_FIELD_FAULT:
+                out[index++] = telemetry.fault;
+                break;
+            case TELEMETRY_FIELD_CELL_MIN:
+                buffer_append_uint16(out, telemetry.cellMinMillivolts, &index);
+                break;
+            case TELEMETRY_FIELD_CELL_MAX:
+                buffer_append_uint16(out, telemetry.cellMaxMillivolts, &index);
+                break;
+            case TELEMETRY_FIELD_TACHOMETER:
+                buffer_append_int32(out, telemetry.tachometerAbsolut.raw, &index);
+                break;
+            case TELEMETRY_FIELD_AGE: {
+                unsigned long age = now - telemetry.realtimeUpdated;
+                buffer_append_uint16(out, telemetry.connected ? (uint16_t) (age < 0xFFFE ? age : 0xFFFE) : 0xFFFF,
+                                     &index);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return index;
+}
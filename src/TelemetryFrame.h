@@ -0,0 +1,75 @@
+#ifndef RESCUE_TELEMETRYFRAME_H
+#define RESCUE_TELEMETRYFRAME_H
+
+#include "Arduino.h"
+#include <atomic>
+#include "VescData.h"
+
+#define TELEMETRY_FRAME_VERSION 1
+#define TELEMETRY_FRAME_MAX_SIZE 40 // header and every field
+#define TELEMETRY_FRAME_HEADER_SIZE 4
+
+#ifndef TELEMETRY_FRAME_INTERVAL
+#define TELEMETRY_FRAME_INTERVAL 200 // ms between two frames until the client sets its own rate
+#endif //TELEMETRY_FRAME_INTERVAL
+
+#ifndef TELEMETRY_FRAME_MIN_INTERVAL
+#define TELEMETRY_FRAME_MIN_INTERVAL 20 // ms, faster than CanBus polls would only repeat the same sample
+#endif //TELEMETRY_FRAME_MIN_INTERVAL
+
+// bit n of the field mask, the fields follow the header in this order, big endian like the VESC protocol
+enum TelemetryFrameField {
+    TELEMETRY_FIELD_ERPM,           // int32
+    TELEMETRY_FIELD_DUTY,           // int16, 1/1000
+    TELEMETRY_FIELD_MOTOR_CURRENT,  // int16, 1/10 A
+    TELEMETRY_FIELD_INPUT_CURRENT,  // int16, 1/10 A
+    TELEMETRY_FIELD_INPUT_VOLTAGE,  // int16, 1/10 V
+    TELEMETRY_FIELD_MOSFET_TEMP,    // int16, 1/10 °C
+    TELEMETRY_FIELD_MOTOR_TEMP,     // int16, 1/10 °C
+    TELEMETRY_FIELD_PITCH,          // int16, 1/100 °
+    TELEMETRY_FIELD_ROLL,           // int16, 1/100 °
+    TELEMETRY_FIELD_SWITCH_STATE,   // uint8, 0 off, 1 left, 2 right, 3 both
+    TELEMETRY_FIELD_BALANCE_STATE,  // uint8
+    TELEMETRY_FIELD_FAULT,          // uint8, mc_fault_code of the primary controller
+    TELEMETRY_FIELD_CELL_MIN,       // uint16, mV, 0 without a BMS
+    TELEMETRY_FIELD_CELL_MAX,       // uint16, mV, 0 without a BMS
+    TELEMETRY_FIELD_TACHOMETER,     // int32, absolute tachometer
+    TELEMETRY_FIELD_AGE,            // uint16, ms since the realtime values were sampled, 0xFFFF while disconnected
+    TELEMETRY_FIELD_COUNT
+};
+
+#define TELEMETRY_FIELDS_ALL 0xFFFF
+
+/*
+  Packed binary frames of the telemetry snapshot for the rESCue telemetry characteristic, so
+  an app gets the values of several proxied VESC requests in one notification. A frame is
+  [version][sequence][field mask, 2 bytes] followed by the fields of the mask in bit order.
+  Clients write [interval ms, 2 bytes][field mask, 2 bytes] to choose rate and fields, interval 0
+  stops the frames. A notification carries at most MTU - 3 bytes, so the frame only holds the
+  fields of the mask that fit the smallest MTU of the connected clients, in bit order, and its
+  mask says which ones these are. At the default MTU of 23 that is 16 bytes of fields.
+*/
+class TelemetryFrame {
+  public:
+    // the settings a client wrote, false if they are malformed. BLE task
+    boolean configure(const uint8_t *request, size_t length);
+    // time for the next frame
+    boolean due(unsigned long now) const;
+    // writes the next frame of at most maxLength bytes into out (TELEMETRY_FRAME_MAX_SIZE bytes) and returns its length
+    size_t next(const VescTelemetry &telemetry, unsigned long now, uint8_t *out,
+                size_t maxLength = TELEMETRY_FRAME_MAX_SIZE);
+    // the fields of mask that fit into a frame of maxLength bytes, the later ones are dropped
+    static uint16_t fit(uint16_t mask, size_t maxLength);
+    static size_t pack(const VescTelemetry &telemetry, uint16_t mask, uint8_t sequence, unsigned long now,
+                       uint8_t *out);
+    uint16_t interval() const { return intervalMs.load(std::memory_order_relaxed); }
+    uint16_t mask() const { return fieldMask.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint16_t> intervalMs{TELEMETRY_FRAME_INTERVAL};
+    std::atomic<uint16_t> fieldMask{TELEMETRY_FIELDS_ALL};
+    uint8_t sequence = 0;
+    unsigned long lastFrame = 0;
+};
+
+#endif //RESCUE_TELEMETRYFRAME_H
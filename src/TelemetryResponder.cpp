@@ -0,0 +1,98 @@
+#include "TelemetryResponder.h"
+#include "AppConfiguration.h"
+#include "VescCanConstants.h"
+#include "buffer.h"
+
+// payload bytes of the last field overwritten: fault in COMM_GET_VALUES, adc2 in the RT data
+#define VALUES_PATCHED_LENGTH 54
+#define FLOAT_RTDATA_PATCHED_LENGTH 25
+
+TelemetryResponder::TelemetryResponder(const VescSnapshot<VescTelemetry> *telemetry) {
+    this->telemetry = telemetry;
+}
+
+int TelemetryResponder::kind(const uint8_t *packet, uint16_t length) {
+    if (length >= 1 && packet[0] == COMM_GET_VALUES) {
+        return VALUES;
+    }
+    if (length >= 3 && packet[0] == COMM_CUSTOM_APP_DATA && packet[1] == FLOAT_PACKAGE_MAGIC &&
+        packet[2] == FLOAT_COMMAND_GET_RTDATA) {
+        return FLOAT_RTDATA;
+    }
+    return -1;
+}
+
+void TelemetryResponder::learn(const uint8_t *response, uint16_t length, unsigned long now) {
+    int responseKind = kind(response, length);
+    uint16_t patched = responseKind == VALUES ? VALUES_PATCHED_LENGTH : FLOAT_RTDATA_PATCHED_LENGTH;
+    if (responseKind < 0 || length < patched || length > TELEMETRY_RESPONSE_SIZE) {
+        return;
+    }
+    Layout layout;
+    memcpy(layout.bytes, response, length);
+    layout.length = length;
+    layout.learned = now;
+    layouts[responseKind].publish(layout);
+}
+
+uint16_t TelemetryResponder::answer(const uint8_t *request, uint16_t length, unsigned long now, uint8_t *out) {
+    int requestKind = kind(request, length);
+    // the polls carry nothing but their command
+    if (requestKind < 0 || length != (requestKind == VALUES ? 1 : 3)) {
+        return 0;
+    }
+    VescTelemetry values;
+    if (telemetry->read(&values) == 0 || !values.connected) {
+        return 0;
+    }
+    unsigned long sampled = requestKind == VALUES ? values.realtimeUpdated : values.balanceUpdated;
+    if (sampled == 0 || now - sampled > PROXY_TELEMETRY_MAX_AGE) {
+        return 0;
+    }
+    Layout layout;
+    if (layouts[requestKind].read(&layout) == 0 || now - layout.learned > PROXY_TELEMETRY_LAYOUT_MAX_AGE) {
+        return 0;
+    }
+    memcpy(out, layout.bytes, layout.length);
+    if (requestKind == VALUES) {
+        writeValues(out, values);
+    } else {
+        writeFloatRtData(out, values);
+    }
+    answered++;
+    return layout.length;
+}
+
+// the fields CanBus decodes from COMM_GET_VALUES, at the same offsets
+void TelemetryResponder::writeValues(uint8_t *out, const VescTelemetry &values) {
+    decltype(VescTelemetry::inputVoltage) drift;
+    drift.set(AppConfiguration::getInstance()->config.batteryDrift);
+    int32_t index = 1;
+    buffer_append_int16(out, values.mosfetTemp.raw, &index);
+    buffer_append_int16(out, values.motorTemp.raw, &index);
+    buffer_append_int32(out, values.motorCurrent.raw, &index);
+    buffer_append_int32(out, values.current.raw, &index);
+    index += 8; // id, iq
+    buffer_append_int16(out, values.dutyCycle.raw, &index);
+    buffer_append_int32(out, values.erpm.raw, &index);
+    buffer_append_int16(out, values.inputVoltage.raw - drift.raw, &index);
+    buffer_append_int32(out, values.ampHours.raw, &index);
+    buffer_append_int32(out, values.ampHoursCharged.raw, &index);
+    buffer_append_int32(out, values.wattHours.raw, &index);
+    buffer_append_int32(out, values.wattHoursCharged.raw, &index);
+    buffer_append_int32(out, values.tachometer.raw, &index);
+    buffer_append_int32(out, values.tachometerAbsolut.raw, &index);
+    out[index++] = values.fault;
+}
+
+// FLOAT_COMMAND_GET_RTDATA up to adc2, the switch state back in the float package's encoding
+void TelemetryResponder::writeFloatRtData(uint8_t *out, const VescTelemetry &values) {
+    int32_t index = 3;
+    buffer_append_float32_auto(out, values.pidOutput.toFloat(), &index);
+    buffer_append_float32_auto(out, values.pitch.toFloat(), &index);
+    buffer_append_float32_auto(out, values.roll.toFloat(), &index);
+    out[index++] = values.balanceState;
+    out[index++] = values.switchState == 0 ? 0 : values.switchState == 3 ? 2 : 1;
+    buffer_append_float32_auto(out, values.adc1.toFloat(), &index);
+    buffer_append_float32_auto(out, values.adc2.toFloat(), &index);
+}
@@ -0,0 +1,54 @@
+#ifndef RESCUE_TELEMETRYRESPONDER_H
+#define RESCUE_TELEMETRYRESPONDER_H
+
+#include "Arduino.h"
+#include "VescData.h"
+#include "VescSnapshot.h"
+
+#ifndef PROXY_TELEMETRY_MAX_AGE
+#define PROXY_TELEMETRY_MAX_AGE 250 // ms a sample may be old to answer an app's telemetry poll with it
+#endif //PROXY_TELEMETRY_MAX_AGE
+
+#ifndef PROXY_TELEMETRY_LAYOUT_MAX_AGE
+#define PROXY_TELEMETRY_LAYOUT_MAX_AGE 1000 // ms until a poll goes to the VESC again to refresh the fields CanBus doesn't track
+#endif //PROXY_TELEMETRY_LAYOUT_MAX_AGE
+
+#define TELEMETRY_RESPONSE_SIZE 128 // longest COMM_GET_VALUES or float RT data response kept as layout
+
+/*
+  Answers the telemetry polls of phone apps, COMM_GET_VALUES and the float package RT data,
+  from the VescData snapshot CanBus keeps for the lights, as long as its sample is younger than
+  PROXY_TELEMETRY_MAX_AGE. The last real response of each kind is the layout: the fields
+  CanBus tracks are written over it in wire format, the rest (id/iq, vd/vq, the fields newer
+  float packages append) stays as the VESC sent it. Without a layout, with an old sample or
+  once the layout is PROXY_TELEMETRY_LAYOUT_MAX_AGE old the poll goes to the VESC like any
+  other request, so those fields are never older than that.
+*/
+class TelemetryResponder {
+  public:
+    explicit TelemetryResponder(const VescSnapshot<VescTelemetry> *telemetry);
+    // a response from the VESC, the newest one of each kind becomes the layout
+    void learn(const uint8_t *response, uint16_t length, unsigned long now);
+    // writes the answer to request into out (TELEMETRY_RESPONSE_SIZE bytes), 0 if the VESC has to answer
+    uint16_t answer(const uint8_t *request, uint16_t length, unsigned long now, uint8_t *out);
+
+    uint32_t answered = 0;
+
+  private:
+    struct Layout {
+        uint8_t bytes[TELEMETRY_RESPONSE_SIZE];
+        uint16_t length;
+        unsigned long learned; // millis()
+    };
+    enum Kind {
+        VALUES, FLOAT_RTDATA, KIND_COUNT
+    };
+    const VescSnapshot<VescTelemetry> *telemetry;
+    // written by the CanBus loop, read wherever BLE writes arrive
+    VescSnapshot<Layout> layouts[KIND_COUNT];
+    static int kind(const uint8_t *packet, uint16_t length);
+    static void writeValues(uint8_t *out, const VescTelemetry &values);
+    static void writeFloatRtData(uint8_t *out, const VescTelemetry &values);
+};
+
+#endif //RESCUE_TELEMETRYRESPONDER_H
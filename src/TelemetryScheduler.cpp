@@ -0,0 +1,104 @@
+#include "TelemetryScheduler.h"
+
+// ms between two requests, rows are ride states, columns data classes
+const uint16_t TelemetryScheduler::BASE_INTERVALS[RIDE_STATE_COUNT][TELEMETRY_CLASS_COUNT] = {
+    // realtime, float package, slow
+    {5000, 1000, 60000}, // parked, the float package keeps polling to notice the footpad
+    {500, 100, 60000},   // ready
+    {50, 25, 0},         // riding, 20Hz values and 40Hz attitude
+    {100, 100, 0},       // fault
+};
+
+void TelemetryScheduler::init(int framesPerSecond) {
+    budget = framesPerSecond;
+    applyBudget();
+}
+
+void TelemetryScheduler::setFrameCost(TelemetryClass telemetryClass, uint8_t frames) {
+    frameCost[telemetryClass] = frames;
+    applyBudget();
+}
+
+void TelemetryScheduler::update(const VescData *vescData, unsigned long now) {
+    RideState newState;
+    boolean moving = abs(vescData->erpm.raw) > TELEMETRY_RIDING_ERPM;
+    if (vescData->fault != 0 || vescData->controllerFault != 0) {
+        newState = RIDE_FAULT;
+    } else if (moving) {
+        newState = RIDE_RIDING;
+    } else if (vescData->switchState != 0 || now - lastActive < TELEMETRY_PARK_DELAY) {
+        newState = RIDE_READY;
+    } else {
+        newState = RIDE_PARKED;
+    }
+    if (moving || vescData->switchState != 0) {
+        lastActive = now;
+    }
+    if (newState == rideState) {
+        return;
+    }
+    snprintf(buf, bufSize, "ride state %s -> %s", stateName(rideState), stateName(newState));
+    Logger::notice(LOG_TAG_TELEMETRY, buf);
+    rideState = newState;
+    applyBudget();
+    expedite(now);
+}
+
+void TelemetryScheduler::setBroadcastMode(boolean enabled, unsigned long now) {
+    if (enabled == broadcast) {
+        return;
+    }
+    broadcast = enabled;
+    applyBudget();
+    expedite(now);
+}
+
+// a faster rate takes effect right away instead of after the old, longer interval
+void TelemetryScheduler::expedite(unsigned long now) {
+    for (int i = 0; i < TELEMETRY_CLASS_COUNT; i++) {
+        if (intervals[i] != 0 && (long) (nextDue[i] - (now + intervals[i])) > 0) {
+            nextDue[i] = now;
+        }
+    }
+}
+
+void TelemetryScheduler::applyBudget() {
+    uint32_t load = 0; // frames per second at the base intervals
+    for (int i = 0; i < TELEMETRY_CLASS_COUNT; i++) {
+        intervals[i] = BASE_INTERVALS[rideState][i];
+        if (broadcast && i == TELEMETRY_REALTIME && intervals[i] != 0 && intervals[i] < TELEMETRY_BROADCAST_INTERVAL) {
+            intervals[i] = TELEMETRY_BROADCAST_INTERVAL;
+        }
+        if (intervals[i] != 0) {
+            load += frameCost[i] * 1000 / intervals[i];
+        }
+    }
+    if (budget <= 0 || load <= (uint32_t) budget) {
+        return;
+    }
+    for (int i = 0; i < TELEMETRY_CLASS_COUNT; i++) {
+        intervals[i] = intervals[i] * load / budget;
+    }
+}
+
+boolean TelemetryScheduler::due(TelemetryClass telemetryClass, unsigned long now) const {
+    return intervals[telemetryClass] != 0 && (long) (now - nextDue[telemetryClass]) >= 0;
+}
+
+void TelemetryScheduler::sent(TelemetryClass telemetryClass, unsigned long now) {
+    nextDue[telemetryClass] = now + intervals[telemetryClass];
+}
+
+void TelemetryScheduler::backoff(TelemetryClass telemetryClass, unsigned long now, unsigned long delay) {
+    nextDue[telemetryClass] = now + (delay > intervals[telemetryClass] ? delay : intervals[telemetryClass]);
+}
+
+const char *TelemetryScheduler::stateName(RideState state) {
+    switch (state) {
+        case RIDE_PARKED: return "parked";
+        case RIDE_READY: return "ready";
+        case RIDE_RIDING: return "riding";
+        case RIDE_FAULT: return "fault";
+        default: return "unknown";
+    }
+}
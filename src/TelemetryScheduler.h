@@ -0,0 +1,75 @@
+#ifndef RESCUE_TELEMETRYSCHEDULER_H
+#define RESCUE_TELEMETRYSCHEDULER_H
+
+#include "Arduino.h"
+#include <Logger.h>
+#include "VescData.h"
+
+#define LOG_TAG_TELEMETRY "TelemetryScheduler"
+
+#ifndef TELEMETRY_RIDING_ERPM
+#define TELEMETRY_RIDING_ERPM 50 // above this the board counts as moving
+#endif //TELEMETRY_RIDING_ERPM
+
+#ifndef TELEMETRY_PARK_DELAY
+#define TELEMETRY_PARK_DELAY 10000 // ms standing still with released footpads until the board counts as parked
+#endif //TELEMETRY_PARK_DELAY
+
+#ifndef TELEMETRY_BROADCAST_INTERVAL
+#define TELEMETRY_BROADCAST_INTERVAL 250 // ms, realtime polls for what status broadcasts don't carry (fault)
+#endif //TELEMETRY_BROADCAST_INTERVAL
+
+enum TelemetryClass {
+    TELEMETRY_REALTIME,      // COMM_GET_VALUES_SELECTIVE: duty, erpm, voltage, temperatures, fault
+    TELEMETRY_FLOAT_PACKAGE, // float package RT data: pitch, roll, footpad
+    TELEMETRY_SLOW,          // firmware version
+    TELEMETRY_CLASS_COUNT
+};
+
+enum RideState {
+    RIDE_PARKED,
+    RIDE_READY,  // footpad engaged or recently moved, but not riding
+    RIDE_RIDING,
+    RIDE_FAULT,
+    RIDE_STATE_COUNT
+};
+
+/*
+  Decides when CanBus polls which kind of data. Every data class has a base interval per ride
+  state (0 = don't poll), the intervals are stretched evenly if the CAN frames they cause would
+  exceed the configured budget of frames per second. In broadcast mode the VESC sends the
+  realtime values as status frames on its own, realtime polls only fetch the rest and are
+  spaced at least TELEMETRY_BROADCAST_INTERVAL apart.
+*/
+class TelemetryScheduler {
+  public:
+    void init(int framesPerSecond);
+    void setFrameCost(TelemetryClass telemetryClass, uint8_t frames);
+    void update(const VescData *vescData, unsigned long now);
+    boolean due(TelemetryClass telemetryClass, unsigned long now) const;
+    void sent(TelemetryClass telemetryClass, unsigned long now);
+    void backoff(TelemetryClass telemetryClass, unsigned long now, unsigned long delay);
+    void setBroadcastMode(boolean enabled, unsigned long now);
+    boolean broadcastMode() const { return broadcast; }
+    RideState state() const { return rideState; }
+    unsigned long interval(TelemetryClass telemetryClass) const { return intervals[telemetryClass]; }
+    // interval of the current ride state before budget and broadcast mode are applied
+    unsigned long baseInterval(TelemetryClass telemetryClass) const { return BASE_INTERVALS[rideState][telemetryClass]; }
+    static const char *stateName(RideState state);
+
+  private:
+    const static int bufSize = 128;
+    char buf[bufSize];
+    static const uint16_t BASE_INTERVALS[RIDE_STATE_COUNT][TELEMETRY_CLASS_COUNT];
+    uint8_t frameCost[TELEMETRY_CLASS_COUNT] = {1, 1, 1};
+    unsigned long intervals[TELEMETRY_CLASS_COUNT] = {};
+    unsigned long nextDue[TELEMETRY_CLASS_COUNT] = {};
+    int budget = 0;
+    RideState rideState = RIDE_READY;
+    boolean broadcast = false;
+    unsigned long lastActive = 0;
+    void applyBudget();
+    void expedite(unsigned long now);
+};
+
+#endif //RESCUE_TELEMETRYSCHEDULER_H
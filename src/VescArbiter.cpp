@@ -0,0 +1,68 @@
+#include "VescArbiter.h"
+#include "VescCanConstants.h"
+
+// the commands commands_process_packet() hands to its blocking thread, plus the configuration
+boolean VescArbiter::isBlocking(uint8_t command) {
+    switch (command) {
+        case COMM_SET_MCCONF:
+        case COMM_GET_MCCONF:
+        case COMM_GET_MCCONF_DEFAULT:
+        case COMM_SET_APPCONF:
+        case COMM_GET_APPCONF:
+        case COMM_GET_APPCONF_DEFAULT:
+        case COMM_DETECT_MOTOR_PARAM:
+        case COMM_DETECT_MOTOR_R_L:
+        case COMM_DETECT_MOTOR_FLUX_LINKAGE:
+        case COMM_DETECT_ENCODER:
+        case COMM_DETECT_HALL_FOC:
+        case COMM_DETECT_MOTOR_FLUX_LINKAGE_OPENLOOP:
+        case COMM_DETECT_APPLY_ALL_FOC:
+        case COMM_PING_CAN:
+        case COMM_BM_MEM_READ:
+        case COMM_BM_WRITE_FLASH_LZO:
+        case COMM_GET_IMU_CALIBRATION:
+            return true;
+        default:
+            return command >= COMM_BM_CONNECT && command <= COMM_BM_MAP_PINS_NRF5X;
+    }
+}
+
+boolean VescArbiter::canSend(uint8_t sender, unsigned long now) {
+    if (!holding || sender == owner) {
+        return true;
+    }
+    if ((long) (now - deadline) >= 0) {
+        timeouts++;
+        snprintf(buf, bufSize, "command 0x%02x of %d unanswered, releasing the VESC", command, owner);
+        Logger::warning(LOG_TAG_VESCARBITER, buf);
+        holding = false;
+        return true;
+    }
+    refused++;
+    return false;
+}
+
+void VescArbiter::sent(uint8_t sender, uint8_t command, unsigned long now) {
+    if (!isBlocking(command)) {
+        return;
+    }
+    blockingCommands++;
+    holding = true;
+    owner = sender;
+    this->command = command;
+    boolean detection = (command >= COMM_DETECT_MOTOR_PARAM && command <= COMM_DETECT_HALL_FOC) ||
+                        command == COMM_DETECT_MOTOR_FLUX_LINKAGE_OPENLOOP || command == COMM_DETECT_APPLY_ALL_FOC;
+    deadline = now + (detection ? VESC_DETECT_TIMEOUT : VESC_BLOCKING_TIMEOUT);
+}
+
+void VescArbiter::answered(uint8_t sender, uint8_t command) {
+    if (holding && sender == owner && command == this->command) {
+        holding = false;
+    }
+}
+
+void VescArbiter::release(uint8_t sender) {
+    if (holding && sender == owner) {
+        holding = false;
+    }
+}
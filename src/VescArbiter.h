@@ -0,0 +1,52 @@
+#ifndef RESCUE_VESCARBITER_H
+#define RESCUE_VESCARBITER_H
+
+#include "Arduino.h"
+#include <Logger.h>
+
+#define LOG_TAG_VESCARBITER "VescArbiter"
+
+#ifndef VESC_BLOCKING_TIMEOUT
+#define VESC_BLOCKING_TIMEOUT 5000 // ms a configuration or bootloader command holds the VESC at most
+#endif //VESC_BLOCKING_TIMEOUT
+
+#ifndef VESC_DETECT_TIMEOUT
+#define VESC_DETECT_TIMEOUT 60000 // ms a motor detection holds the VESC at most
+#endif //VESC_DETECT_TIMEOUT
+
+/*
+  Decides who may send a request to the VESC, for the ESP's own polls and every proxy session.
+  The VESC answers a request to whatever sender id the last PROCESS_SHORT_BUFFER or
+  PROCESS_RX_BUFFER carried. Most commands are answered right away, so that is the sender.
+  Blocking commands (configuration, detection, bootloader) are copied to a worker thread and
+  answered when it is done. A request from anyone else meanwhile would get that answer, so all
+  other senders are held back until the blocking command is answered or its timeout runs out.
+  Requests of the sender that holds the VESC go through, their answers come back to it anyway.
+*/
+class VescArbiter {
+  public:
+    // false while a blocking command of another sender is outstanding
+    boolean canSend(uint8_t sender, unsigned long now);
+    // a request of sender went out, a blocking command holds the VESC from now on
+    void sent(uint8_t sender, uint8_t command, unsigned long now);
+    // the response to a request of sender arrived
+    void answered(uint8_t sender, uint8_t command);
+    // the sender is gone (a BLE client disconnected), it doesn't hold the VESC anymore
+    void release(uint8_t sender);
+    boolean held() const { return holding; }
+    static boolean isBlocking(uint8_t command);
+
+    uint32_t blockingCommands = 0; // blocking commands sent
+    uint32_t refused = 0;          // canSend() calls that had to wait
+    uint32_t timeouts = 0;         // blocking commands that were never answered
+
+  private:
+    const static int bufSize = 64;
+    char buf[bufSize];
+    boolean holding = false;
+    uint8_t owner = 0;
+    uint8_t command = 0;
+    unsigned long deadline = 0; // millis()
+};
+
+#endif //RESCUE_VESCARBITER_H
@@ -1,8 +1,6 @@
 #ifndef RESCUE_VESCCANCONSTANTS_H
 #define RESCUE_VESCCANCONSTANTS_H
 
-#define BUFFER_SIZE 65535
-
 // CAN commands
 typedef enum {
 	CAN_PACKET_SET_DUTY = 0,
@@ -72,6 +70,47 @@ typedef enum {
 	CAN_PACKET_MAKE_ENUM_32_BITS = 0xFFFFFFFF,
 } CAN_PACKET_ID;
 
+// the COMM_PACKET_ID values this firmware sends, decodes or answers itself
+typedef enum {
+	COMM_FW_VERSION = 0x00,
+	COMM_GET_VALUES = 0x04,
+	COMM_SET_MCCONF = 0x0D,
+	COMM_GET_MCCONF = 0x0E,
+	COMM_GET_MCCONF_DEFAULT = 0x0F,
+	COMM_SET_APPCONF = 0x10,
+	COMM_GET_APPCONF = 0x11,
+	COMM_GET_APPCONF_DEFAULT = 0x12,
+	COMM_DETECT_MOTOR_PARAM = 0x18,
+	COMM_DETECT_MOTOR_R_L = 0x19,
+	COMM_DETECT_MOTOR_FLUX_LINKAGE = 0x1A,
+	COMM_DETECT_ENCODER = 0x1B,
+	COMM_DETECT_HALL_FOC = 0x1C,
+	COMM_ALIVE = 0x1E,
+	COMM_CUSTOM_APP_DATA = 0x24,
+	COMM_GET_VALUES_SETUP = 0x2F,
+	COMM_GET_VALUES_SELECTIVE = 0x32,
+	COMM_GET_VALUES_SETUP_SELECTIVE = 0x33,
+	COMM_DETECT_MOTOR_FLUX_LINKAGE_OPENLOOP = 0x39,
+	COMM_DETECT_APPLY_ALL_FOC = 0x3A,
+	COMM_PING_CAN = 0x3E,
+	COMM_GET_IMU_DATA = 0x41,
+	COMM_BM_CONNECT = 0x42,
+	COMM_BM_MAP_PINS_NRF5X = 0x48,
+	COMM_GET_DECODED_BALANCE = 0x4F,
+	COMM_BM_MEM_READ = 0x50,
+	COMM_BM_WRITE_FLASH_LZO = 0x53,
+	COMM_GET_IMU_CALIBRATION = 0x5A,
+} COMM_COMMAND;
+
+// first payload byte after COMM_CUSTOM_APP_DATA for the float package, the command follows
+#define FLOAT_PACKAGE_MAGIC 101
+
+typedef enum {
+	FLOAT_COMMAND_GET_INFO = 0,
+	FLOAT_COMMAND_GET_RTDATA = 1,
+	FLOAT_COMMAND_GET_ALLDATA = 10,
+} FLOAT_COMMAND;
+
 typedef enum {
 	BMS_FAULT_CODE_NONE = 0,
 	BMS_FAULT_CODE_PACK_OVER_VOLTAGE,
@@ -0,0 +1,127 @@
+#include "VescControllerRegistry.h"
+
+ControllerTelemetry *VescControllerRegistry::find(uint8_t id) {
+    for (int i = 0; i < controllerCount; i++) {
+        if (controllers[i].id == id) {
+            return &controllers[i];
+        }
+    }
+    return nullptr;
+}
+
+ControllerTelemetry *VescControllerRegistry::add(uint8_t id) {
+    ControllerTelemetry *controller = find(id);
+    if (controller != nullptr || controllerCount >= MAX_VESC_CONTROLLERS) {
+        return controller;
+    }
+    controller = &controllers[controllerCount++];
+    controller->id = id;
+    controller->active = true;
+    controller->lastSeen = millis();
+    return controller;
+}
+
+void VescControllerRegistry::updateFromVescData(uint8_t id, const VescData *vescData) {
+    ControllerTelemetry *controller = find(id);
+    if (controller == nullptr) {
+        return;
+    }
+    controller->erpm = vescData->erpm.toFloat();
+    controller->current = vescData->current.toFloat();
+    controller->motorCurrent = vescData->motorCurrent.toFloat();
+    controller->dutyCycle = vescData->dutyCycle.toFloat();
+    controller->inputVoltage = vescData->inputVoltage.toFloat();
+    controller->mosfetTemp = vescData->mosfetTemp.toFloat();
+    controller->motorTemp = vescData->motorTemp.toFloat();
+    controller->totalCurrentIn = vescData->totalCurrentIn.toFloat();
+    controller->fault = vescData->fault;
+    controller->active = vescData->connected;
+    if (vescData->connected) {
+        controller->lastSeen = millis();
+    }
+}
+
+boolean VescControllerRegistry::isActive(const ControllerTelemetry &controller) const {
+    return controller.active && millis() - controller.lastSeen < CONTROLLER_TIMEOUT;
+}
+
+int VescControllerRegistry::activeCount() const {
+    int active = 0;
+    for (int i = 0; i < controllerCount; i++) {
+        if (isActive(controllers[i])) {
+            active++;
+        }
+    }
+    return active;
+}
+
+float VescControllerRegistry::totalCurrent() const {
+    float sum = 0.0f;
+    for (int i = 0; i < controllerCount; i++) {
+        if (isActive(controllers[i])) {
+            sum += controllers[i].current;
+        }
+    }
+    return sum;
+}
+
+float VescControllerRegistry::totalMotorCurrent() const {
+    float sum = 0.0f;
+    for (int i = 0; i < controllerCount; i++) {
+        if (isActive(controllers[i])) {
+            sum += controllers[i].motorCurrent;
+        }
+    }
+    return sum;
+}
+
+float VescControllerRegistry::minInputVoltage() const {
+    float min = 0.0f;
+    for (int i = 0; i < controllerCount; i++) {
+        // a controller that hasn't reported its voltage yet must not pull the minimum to 0
+        if (isActive(controllers[i]) && controllers[i].inputVoltage > 0.0f &&
+            (min == 0.0f || controllers[i].inputVoltage < min)) {
+            min = controllers[i].inputVoltage;
+        }
+    }
+    return min;
+}
+
+float VescControllerRegistry::maxMosfetTemp() const {
+    float max = 0.0f;
+    for (int i = 0; i < controllerCount; i++) {
+        if (isActive(controllers[i]) && controllers[i].mosfetTemp > max) {
+            max = controllers[i].mosfetTemp;
+        }
+    }
+    return max;
+}
+
+float VescControllerRegistry::maxMotorTemp() const {
+    float max = 0.0f;
+    for (int i = 0; i < controllerCount; i++) {
+        if (isActive(controllers[i]) && controllers[i].motorTemp > max) {
+            max = controllers[i].motorTemp;
+        }
+    }
+    return max;
+}
+
+uint8_t VescControllerRegistry::firstFault() const {
+    for (int i = 0; i < controllerCount; i++) {
+        if (isActive(controllers[i]) && controllers[i].fault != 0) {
+            return controllers[i].fault;
+        }
+    }
+    return 0;
+}
+
+void VescControllerRegistry::refreshAggregates(VescData *vescData) {
+    vescData->controllerCount = activeCount();
+    vescData->totalCurrent.set(totalCurrent());
+    vescData->totalMotorCurrent.set(totalMotorCurrent());
+    vescData->minInputVoltage.set(minInputVoltage());
+    vescData->maxMosfetTemp.set(maxMosfetTemp());
+    vescData->maxMotorTemp.set(maxMotorTemp());
+    vescData->controllerFault = firstFault();
+}
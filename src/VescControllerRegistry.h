@@ -0,0 +1,52 @@
+#ifndef RESCUE_VESCCONTROLLERREGISTRY_H
+#define RESCUE_VESCCONTROLLERREGISTRY_H
+
+#include "Arduino.h"
+#include "VescData.h"
+
+#ifndef MAX_VESC_CONTROLLERS
+#define MAX_VESC_CONTROLLERS 4
+#endif //MAX_VESC_CONTROLLERS
+
+#define CONTROLLER_TIMEOUT 3000 // ms without a frame until a controller no longer counts for the aggregates
+
+// compact per-controller record, floats only, hot fields first
+struct ControllerTelemetry {
+    float erpm;
+    float current; // input current
+    float motorCurrent;
+    float dutyCycle;
+    float inputVoltage;
+    float mosfetTemp;
+    float motorTemp;
+    float totalCurrentIn;
+    unsigned long lastSeen;
+    uint8_t id;
+    uint8_t fault;
+    boolean active;
+};
+
+class VescControllerRegistry {
+  public:
+    ControllerTelemetry *find(uint8_t id);
+    ControllerTelemetry *add(uint8_t id);
+    void updateFromVescData(uint8_t id, const VescData *vescData);
+    void refreshAggregates(VescData *vescData);
+    int count() const { return controllerCount; }
+    const ControllerTelemetry &at(int index) const { return controllers[index]; }
+
+    float totalCurrent() const;
+    float totalMotorCurrent() const;
+    float minInputVoltage() const;
+    float maxMosfetTemp() const;
+    float maxMotorTemp() const;
+    uint8_t firstFault() const;
+    int activeCount() const;
+
+  private:
+    ControllerTelemetry controllers[MAX_VESC_CONTROLLERS] = {};
+    int controllerCount = 0;
+    boolean isActive(const ControllerTelemetry &controller) const;
+};
+
+#endif //RESCUE_VESCCONTROLLERREGISTRY_H
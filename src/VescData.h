@@ -6,40 +6,77 @@
 #define RESCUE_VESCDATA_H
 
 #include <cstdint>
+#include <string>
+#include "Fixed.h"
+#include "VescSnapshot.h"
 
-struct VescData {
-    uint8_t majorVersion;
-    uint8_t minorVersion;
-    std::string name;
-    std::string uuid;
+// everything but the strings, trivially copyable so it can be published through a VescSnapshot.
+// Scaled fields keep the VESC wire representation, see Fixed.h
+struct VescTelemetry {
+    uint8_t majorVersion = 0;
+    uint8_t minorVersion = 0;
 
     boolean connected = false;
-    double dutyCycle = 0.0;
-    double erpm = 0.0;
-    double current = 0.0;
-    double ampHours = 0.0;
-    double ampHoursCharged= 0.0;
-    double wattHours = 0.0;
-    double wattHoursCharged = 0.0;
-    double mosfetTemp = 0.0;
-    double motorTemp = 0.0;
-    double totalCurrentIn = 0.0;
-    double pidPosition = 0.0;
-    double inputVoltage = 0.0;
-    double tachometer = 0.0;
-    double tachometerAbsolut = 0.0;
-
-    double pidOutput = 0.0;
-    double pitch = 0.0;
-    double roll = 0.0;
+    Fixed<int16_t, 1000> dutyCycle;
+    Fixed<int32_t, 1> erpm;
+    Fixed<int32_t, 100> current; // input current
+    Fixed<int32_t, 10000> ampHours;
+    Fixed<int32_t, 10000> ampHoursCharged;
+    Fixed<int32_t, 10000> wattHours;
+    Fixed<int32_t, 10000> wattHoursCharged;
+    Fixed<int16_t, 10> mosfetTemp;
+    Fixed<int16_t, 10> motorTemp;
+    Fixed<int16_t, 10> totalCurrentIn;
+    Fixed<int16_t, 50> pidPosition;
+    Fixed<int16_t, 10> inputVoltage;
+    Fixed<int32_t, 1> tachometer;
+    Fixed<int32_t, 1> tachometerAbsolut;
+
+    Fixed<int32_t, 1000000> pidOutput;
+    Fixed<int32_t, 1000000> pitch;
+    Fixed<int32_t, 1000000> roll;
     uint32_t loopTime = 0;
-    double motorCurrent = 0.0;
-    double motorPosition = 0.0;
+    Fixed<int32_t, 100> motorCurrent;
+    Fixed<int32_t, 1000000> motorPosition;
     uint16_t balanceState = 0;
     uint16_t switchState = 0;
-    double adc1 = 0.0;
-    double adc2 = 0.0;
+    Fixed<int32_t, 1000000> adc1;
+    Fixed<int32_t, 1000000> adc2;
     uint8_t fault = 0;
+    // millis() when CanBus last decoded a realtime values or float package / balance response
+    unsigned long realtimeUpdated = 0;
+    unsigned long balanceUpdated = 0;
+
+    // aggregated over all active controllers on the bus, see VescControllerRegistry
+    uint8_t controllerCount = 0;
+    Fixed<int32_t, 100> totalCurrent;
+    Fixed<int32_t, 100> totalMotorCurrent;
+    Fixed<int16_t, 10> minInputVoltage;
+    Fixed<int16_t, 10> maxMosfetTemp;
+    Fixed<int16_t, 10> maxMotorTemp;
+    uint8_t controllerFault = 0;
+
+    // lowest and highest cell of the BMS, 0 without one, see BMSController
+    uint16_t cellMinMillivolts = 0;
+    uint16_t cellMaxMillivolts = 0;
+
+    // fall back to the primary controller as long as the registry hasn't reported (e.g. UART builds)
+    double batteryVoltage() const { return minInputVoltage.raw > 0 ? minInputVoltage : inputVoltage; }
+    // input current, what the battery delivers
+    double boardCurrent() const { return controllerCount > 0 ? totalCurrent : current; }
+    // motor current, negative while braking even at low speed where little flows back into the battery
+    double boardMotorCurrent() const { return controllerCount > 0 ? totalMotorCurrent : motorCurrent; }
+};
+
+/*
+  Working copy of the telemetry, written field by field by CanBus on the loop task. Readers
+  outside of CanBus use snapshot.read(), which always returns the state of one whole CanBus::loop().
+*/
+struct VescData : VescTelemetry {
+    std::string name;
+    std::string uuid;
+
+    VescSnapshot<VescTelemetry> snapshot;
 };
 
 #endif //RESCUE_VESCDATA_H
@@ -0,0 +1,60 @@
+#ifndef RESCUE_VESCSNAPSHOT_H
+#define RESCUE_VESCSNAPSHOT_H
+
+#include "Arduino.h"
+#include <atomic>
+#include <type_traits>
+
+/*
+  Double-buffered seqlock for telemetry that one task writes and any task reads.
+  publish() bumps the sequence to odd, updates copy 0, bumps it to even and updates
+  copy 1, so there is always one copy that isn't being written: readers pick it by
+  the low bit of the sequence and only copy again if the sequence moved meanwhile.
+  Neither side ever takes a lock, readers never wait for the writer.
+  T has to be trivially copyable, there must be only one writer.
+*/
+template<typename T>
+class VescSnapshot {
+  public:
+    void publish(const T &value) {
+        uint32_t sequence = this->sequence.load(std::memory_order_relaxed);
+        // release: readers seeing the odd value pick copy 1, which the previous call wrote last
+        this->sequence.store(sequence + 1, std::memory_order_release);
+        // and the odd value has to be visible before copy 0 changes
+        std::atomic_thread_fence(std::memory_order_release);
+        copies[0] = value;
+        this->sequence.store(sequence + 2, std::memory_order_release);
+        copies[1] = value;
+    }
+
+    // copies a consistent snapshot into value and returns its version, 0 if nothing was published yet
+    uint32_t read(T *value) const {
+        uint32_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            *value = copies[before & 1];
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while (after != before);
+        return before / 2;
+    }
+
+    T read() const {
+        T value;
+        read(&value);
+        return value;
+    }
+
+    // number of publish() calls so far, consumers can compare it to skip work on unchanged data
+    uint32_t version() const {
+        return sequence.load(std::memory_order_acquire) / 2;
+    }
+
+  private:
+    static_assert(std::is_trivially_copyable<T>::value, "VescSnapshot needs a trivially copyable type");
+
+    std::atomic<uint32_t> sequence{0};
+    T copies[2];
+};
+
+#endif //RESCUE_VESCSNAPSHOT_H
@@ -0,0 +1,78 @@
+#include "VescValuesSchema.h"
+#include "buffer.h"
+
+// writes the wire value into the member at its own width, members keep the wire scaling
+static void store(const TelemetryField &destination, int32_t raw, VescTelemetry *telemetry) {
+    uint8_t *member = (uint8_t *) telemetry + destination.offset;
+    if (destination.size == 1) {
+        uint8_t value = (uint8_t) raw;
+        memcpy(member, &value, 1);
+    } else if (destination.size == 2) {
+        int16_t value = (int16_t) raw;
+        memcpy(member, &value, 2);
+    } else if (destination.size == 4) {
+        memcpy(member, &raw, 4);
+    }
+}
+
+uint32_t decodeSelective(const SelectiveField *fields, int count, const uint8_t *payload, int length, VescData *vescData) {
+    if (length < 4) {
+        return 0;
+    }
+    int32_t index = 0;
+    uint32_t mask = buffer_get_uint32(payload, &index);
+    uint32_t decoded = 0;
+    for (int i = 0; i < count; i++) {
+        const SelectiveField &field = fields[i];
+        if (!(mask & ((uint32_t) 1 << field.bit))) {
+            continue;
+        }
+        if (index + wireSize(field.type) > length) {
+            break;
+        }
+        int32_t raw;
+        switch (field.type) {
+            case WireType::UINT8:
+                raw = payload[index];
+                break;
+            case WireType::INT16:
+            case WireType::INT16X3:
+                raw = (int16_t) ((payload[index] << 8) | payload[index + 1]);
+                break;
+            case WireType::UINT32: {
+                int32_t pos = index;
+                raw = (int32_t) buffer_get_uint32(payload, &pos);
+                break;
+            }
+            default: {
+                int32_t pos = index;
+                raw = buffer_get_int32(payload, &pos);
+                break;
+            }
+        }
+        index += wireSize(field.type);
+        store(field.destination, raw, vescData);
+        decoded |= (uint32_t) 1 << field.bit;
+    }
+    return decoded;
+}
+
+uint32_t pollMask(const SelectiveField *fields, int count, uint8_t coveredBroadcasts) {
+    uint32_t mask = 0;
+    for (int i = 0; i < count; i++) {
+        if (fields[i].destination.size != 0 && (fields[i].broadcast & coveredBroadcasts) == 0) {
+            mask |= (uint32_t) 1 << fields[i].bit;
+        }
+    }
+    return mask;
+}
+
+int payloadSize(const SelectiveField *fields, int count, uint32_t mask) {
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        if (mask & ((uint32_t) 1 << fields[i].bit)) {
+            size += wireSize(fields[i].type);
+        }
+    }
+    return size;
+}
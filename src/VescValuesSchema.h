@@ -0,0 +1,142 @@
+#ifndef RESCUE_VESCVALUESSCHEMA_H
+#define RESCUE_VESCVALUESSCHEMA_H
+
+#include "Arduino.h"
+#include <cstddef>
+#include "VescData.h"
+#include "StatusBroadcasts.h"
+
+/*
+  Field layout of the COMM_GET_VALUES_SELECTIVE (0x32) and COMM_GET_VALUES_SETUP_SELECTIVE (0x33)
+  responses. The VESC sends the request mask back after the command byte, followed by every field
+  whose bit is set, in bit order. Each table lists all fields up to the last one we know of, so the
+  decoder can skip the ones without a destination. The request mask is derived from the same
+  table: a field with a destination member is requested, all others are not.
+*/
+enum class WireType : uint8_t {
+    UINT8,
+    INT16,
+    INT32,
+    UINT32,
+    INT16X3, // three consecutive int16 (mosfet temperatures 1-3)
+};
+
+// where a field ends up in VescTelemetry, size 0 if the field is only skipped
+struct TelemetryField {
+    uint16_t offset;
+    uint8_t size;
+};
+
+/*
+  Destinations store the wire value as is, so the scale of the wire field has to be the one
+  of the member (see Fixed.h). A mismatch doesn't compile, the throw stops constant evaluation.
+*/
+template<typename Member>
+constexpr TelemetryField telemetryField(uint16_t offset, int32_t wireScale) {
+    return FixedScale<Member>::value == wireScale
+           ? TelemetryField{offset, sizeof(Member)}
+           : throw "wire scale differs from the scale of the VescTelemetry member";
+}
+
+#define TELEMETRY_FIELD(member, wireScale) \
+    telemetryField<decltype(VescTelemetry::member)>(offsetof(VescTelemetry, member), wireScale)
+#define SKIPPED_FIELD TelemetryField{0, 0}
+
+struct SelectiveField {
+    uint8_t bit;
+    WireType type;
+    TelemetryField destination;
+    uint8_t broadcast; // STATUS_BIT() of the CAN status broadcast that carries the field as well, 0 if none
+};
+
+constexpr int wireSize(WireType type) {
+    return type == WireType::UINT8 ? 1 :
+           type == WireType::INT16 ? 2 :
+           type == WireType::INT16X3 ? 6 : 4;
+}
+
+constexpr uint32_t requestMask(const SelectiveField *fields, int count) {
+    return count == 0 ? 0 :
+           (fields[0].destination.size != 0 ? (uint32_t) 1 << fields[0].bit : 0) |
+           requestMask(fields + 1, count - 1);
+}
+
+// bytes the requested fields take in the response, mask excluded
+constexpr int requestedPayloadSize(const SelectiveField *fields, int count) {
+    return count == 0 ? 0 :
+           (fields[0].destination.size != 0 ? wireSize(fields[0].type) : 0) +
+           requestedPayloadSize(fields + 1, count - 1);
+}
+
+constexpr SelectiveField VALUES_SELECTIVE[] = {
+    {0, WireType::INT16, TELEMETRY_FIELD(mosfetTemp, 10), STATUS_BIT(4)},
+    {1, WireType::INT16, TELEMETRY_FIELD(motorTemp, 10), STATUS_BIT(4)},
+    {2, WireType::INT32, TELEMETRY_FIELD(motorCurrent, 100), STATUS_BIT(1)},
+    {3, WireType::INT32, TELEMETRY_FIELD(current, 100), STATUS_BIT(4)},
+    {4, WireType::INT32, SKIPPED_FIELD},                             // id (x100)
+    {5, WireType::INT32, SKIPPED_FIELD},                             // iq (x100)
+    {6, WireType::INT16, TELEMETRY_FIELD(dutyCycle, 1000), STATUS_BIT(1)},
+    {7, WireType::INT32, TELEMETRY_FIELD(erpm, 1), STATUS_BIT(1)},
+    {8, WireType::INT16, TELEMETRY_FIELD(inputVoltage, 10), STATUS_BIT(5)},
+    {9, WireType::INT32, TELEMETRY_FIELD(ampHours, 10000), STATUS_BIT(2)},
+    {10, WireType::INT32, TELEMETRY_FIELD(ampHoursCharged, 10000), STATUS_BIT(2)},
+    {11, WireType::INT32, TELEMETRY_FIELD(wattHours, 10000), STATUS_BIT(3)},
+    {12, WireType::INT32, TELEMETRY_FIELD(wattHoursCharged, 10000), STATUS_BIT(3)},
+    {13, WireType::INT32, TELEMETRY_FIELD(tachometer, 1), STATUS_BIT(5)},
+    {14, WireType::INT32, TELEMETRY_FIELD(tachometerAbsolut, 1)},
+    {15, WireType::UINT8, TELEMETRY_FIELD(fault, 1)},
+    {16, WireType::INT32, SKIPPED_FIELD},                            // pid position (x1000000)
+    {17, WireType::UINT8, SKIPPED_FIELD},                            // controller id
+    {18, WireType::INT16X3, SKIPPED_FIELD},                          // mosfet temperatures 1-3 (x10)
+    {19, WireType::INT32, SKIPPED_FIELD},                            // vd (x1000)
+    {20, WireType::INT32, SKIPPED_FIELD},                            // vq (x1000)
+    {21, WireType::UINT8, SKIPPED_FIELD},                            // status
+};
+
+constexpr SelectiveField VALUES_SETUP_SELECTIVE[] = {
+    {0, WireType::INT16, TELEMETRY_FIELD(mosfetTemp, 10), STATUS_BIT(4)},
+    {1, WireType::INT16, TELEMETRY_FIELD(motorTemp, 10), STATUS_BIT(4)},
+    {2, WireType::INT32, SKIPPED_FIELD},                             // motor current, summed over all VESCs (x100)
+    {3, WireType::INT32, SKIPPED_FIELD},                             // input current, summed over all VESCs (x100)
+    {4, WireType::INT16, TELEMETRY_FIELD(dutyCycle, 1000), STATUS_BIT(1)},
+    {5, WireType::INT32, TELEMETRY_FIELD(erpm, 1), STATUS_BIT(1)},
+    {6, WireType::INT32, SKIPPED_FIELD},                             // speed (x1000)
+    {7, WireType::INT16, TELEMETRY_FIELD(inputVoltage, 10), STATUS_BIT(5)},
+    {8, WireType::INT16, SKIPPED_FIELD},                             // battery level (x1000)
+    {9, WireType::INT32, TELEMETRY_FIELD(ampHours, 10000)},                // energy counters are summed over all
+    {10, WireType::INT32, TELEMETRY_FIELD(ampHoursCharged, 10000)},        // VESCs, unlike status 2 and 3
+    {11, WireType::INT32, TELEMETRY_FIELD(wattHours, 10000)},
+    {12, WireType::INT32, TELEMETRY_FIELD(wattHoursCharged, 10000)},
+    {13, WireType::INT32, SKIPPED_FIELD},                            // distance (x1000)
+    {14, WireType::INT32, SKIPPED_FIELD},                            // absolute distance (x1000)
+    {15, WireType::INT32, SKIPPED_FIELD},                            // pid position (x1000000)
+    {16, WireType::UINT8, TELEMETRY_FIELD(fault, 1)},
+    {17, WireType::UINT8, SKIPPED_FIELD},                            // controller id
+    {18, WireType::UINT8, SKIPPED_FIELD},                            // number of VESCs
+    {19, WireType::INT32, SKIPPED_FIELD},                            // watt hours left (x1000)
+    {20, WireType::UINT32, SKIPPED_FIELD},                           // odometer
+    {21, WireType::UINT32, SKIPPED_FIELD},                           // uptime
+};
+
+constexpr int VALUES_SELECTIVE_COUNT = sizeof(VALUES_SELECTIVE) / sizeof(SelectiveField);
+constexpr int VALUES_SETUP_SELECTIVE_COUNT = sizeof(VALUES_SETUP_SELECTIVE) / sizeof(SelectiveField);
+constexpr uint32_t VALUES_SELECTIVE_MASK = requestMask(VALUES_SELECTIVE, VALUES_SELECTIVE_COUNT);
+// command byte + mask + requested fields
+constexpr int VALUES_SELECTIVE_RESPONSE_SIZE = 5 + requestedPayloadSize(VALUES_SELECTIVE, VALUES_SELECTIVE_COUNT);
+
+constexpr int VALUES_SELECTIVE_INPUT_VOLTAGE_BIT = 8;
+
+// the request mask without the fields that the covered status broadcasts deliver anyway
+uint32_t pollMask(const SelectiveField *fields, int count, uint8_t coveredBroadcasts);
+// bytes the fields in mask take in the response, mask excluded
+int payloadSize(const SelectiveField *fields, int count, uint32_t mask);
+constexpr int VALUES_SETUP_SELECTIVE_INPUT_VOLTAGE_BIT = 7;
+
+/*
+  Decodes a selective response (payload starts with the echoed mask, the command byte is already
+  stripped) into vescData. Returns the mask of the fields that were actually present, fields that
+  would run past the end of the payload are not decoded.
+*/
+uint32_t decodeSelective(const SelectiveField *fields, int count, const uint8_t *payload, int length, VescData *vescData);
+
+#endif //RESCUE_VESCVALUESSCHEMA_H
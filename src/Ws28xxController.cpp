@@ -424,7 +424,7 @@ void Ws28xxController::batteryIndicator(uint16_t timeinterval) {
 }
 
 void Ws28xxController::batteryIndicatorUpdate() {
-    double voltage = vescData->inputVoltage;
+    double voltage = vescData->snapshot.read().batteryVoltage();
     int min_voltage = (int) AppConfiguration::getInstance()->config.minBatteryVoltage * 100;
     int max_voltage = (int) AppConfiguration::getInstance()->config.maxBatteryVoltage * 100;
     int voltage_range = max_voltage - min_voltage;
@@ -109,7 +109,8 @@ Serial.println("after BMS init\n");
     batMonitor->init();
     // initialize the UART bridge from VESC to BLE and the BLE support for Blynk (https://blynk.io)
 #ifdef CANBUS_ONLY
-    bleServer->init(canbus->stream, canbus);
+    // no UART to the VESC, BLE traffic goes through the CAN proxy
+    bleServer->init(nullptr, canbus);
 #else
     bleServer->init(&vesc);
 #endif
@@ -146,8 +147,10 @@ void loop() {
     }
 
     if (AppConfiguration::getInstance()->config.sendConfig) {
-        BleServer::sendConfig();
-        AppConfiguration::getInstance()->config.sendConfig = false;
+        // as many values per loop as the notification queue takes
+        if (BleServer::sendConfig()) {
+            AppConfiguration::getInstance()->config.sendConfig = false;
+        }
     }
     if (AppConfiguration::getInstance()->config.saveConfig) {
         AppConfiguration::getInstance()->savePreferences();
@@ -155,12 +158,15 @@ void loop() {
         AppConfiguration::getInstance()->config.saveConfig = false;
     }
 
+    // one consistent view of what CanBus published, no matter which task wrote it
+    VescTelemetry telemetry = vescData.snapshot.read();
+
 #ifdef CANBUS_ENABLED
-    new_forward = vescData.erpm > idle_erpm ? HIGH : LOW;
-    new_backward = vescData.erpm < -idle_erpm ? HIGH : LOW;
-    idle = (abs(vescData.erpm) < idle_erpm && vescData.switchState == 0) ? HIGH : LOW;
-    new_brake = (abs(vescData.erpm) > idle_erpm && vescData.current < -4.0) ? HIGH : LOW;
-    mall_grab = (vescData.pitch > 70.0) ? HIGH : LOW;
+    new_forward = telemetry.erpm > idle_erpm ? HIGH : LOW;
+    new_backward = telemetry.erpm < -idle_erpm ? HIGH : LOW;
+    idle = (abs(telemetry.erpm) < idle_erpm && telemetry.switchState == 0) ? HIGH : LOW;
+    new_brake = (abs(telemetry.erpm) > idle_erpm && telemetry.boardMotorCurrent() < -4.0) ? HIGH : LOW;
+    mall_grab = (telemetry.pitch > 70.0) ? HIGH : LOW;
 #else
     new_forward  = digitalRead(PIN_FORWARD);
     new_backward = digitalRead(PIN_BACKWARD);
@@ -183,7 +189,7 @@ void loop() {
     // measure and check voltage
     batMonitor->checkValues();
 
-    lightbar->updateLightBar(vescData.inputVoltage, vescData.switchState, vescData.adc1, vescData.adc2, vescData.erpm);  // update the WS28xx battery bar
+    lightbar->updateLightBar(telemetry.batteryVoltage(), telemetry.switchState, telemetry.adc1, telemetry.adc2, telemetry.erpm);  // update the WS28xx battery bar
 
     // call the VESC UART-to-Bluetooth bridge
     bleServer->loop(&vescData, loopTime, maxLoopTime);
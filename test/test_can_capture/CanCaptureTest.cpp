@@ -0,0 +1,121 @@
+#include <unity.h>
+#include <string.h>
+#include "../../lib/can-capture/src/CanCapture.h"
+
+
+void setUp(void) {
+    // set stuff up here
+}
+
+void tearDown(void) {
+    // clean stuff up here
+}
+
+static CapturedFrame statusFrame(uint32_t timestamp, uint8_t controllerId, uint8_t fill) {
+    CapturedFrame frame = {};
+    frame.timestamp = timestamp;
+    frame.identifier = (9 << 8) | controllerId; // CAN_PACKET_STATUS
+    frame.flags = CAN_CAPTURE_FLAG_EXTD;
+    frame.dlc = 8;
+    memset(frame.data, fill, 8);
+    return frame;
+}
+
+void testRoundTrip() {
+    uint8_t storage[256];
+    CanCaptureRing ring(storage, sizeof(storage));
+    ring.append(statusFrame(1000, 10, 1));
+    ring.append(statusFrame(1500, 10, 2));
+    CapturedFrame sent = statusFrame(2000000, 11, 3);
+    sent.identifier = (uint32_t(0x8000) << 16) | (8 << 8) | 10;
+    sent.flags |= CAN_CAPTURE_FLAG_TX;
+    sent.dlc = 3;
+    ring.append(sent);
+
+    uint8_t capture[512];
+    size_t length = ring.copyTo(capture, sizeof(capture));
+    TEST_ASSERT_EQUAL(ring.captureSize(), length);
+
+    CanCaptureReader reader(capture, length);
+    TEST_ASSERT_TRUE(reader.valid());
+    CapturedFrame frame;
+    TEST_ASSERT_TRUE(reader.next(&frame));
+    TEST_ASSERT_EQUAL(1000, frame.timestamp);
+    TEST_ASSERT_EQUAL(0x090A, frame.identifier);
+    TEST_ASSERT_EQUAL(8, frame.dlc);
+    TEST_ASSERT_EQUAL(1, frame.data[7]);
+    TEST_ASSERT_TRUE(reader.next(&frame));
+    TEST_ASSERT_EQUAL(1500, frame.timestamp);
+    TEST_ASSERT_TRUE(reader.next(&frame));
+    TEST_ASSERT_EQUAL(2000000, frame.timestamp);
+    TEST_ASSERT_EQUAL(sent.identifier, frame.identifier);
+    TEST_ASSERT_EQUAL(CAN_CAPTURE_FLAG_EXTD | CAN_CAPTURE_FLAG_TX, frame.flags);
+    TEST_ASSERT_EQUAL(3, frame.dlc);
+    TEST_ASSERT_EQUAL(0, frame.data[3]);
+    TEST_ASSERT_FALSE(reader.next(&frame));
+}
+
+void testRingEvictsOldestAndKeepsTimestamps() {
+    uint8_t storage[48]; // room for 4 records of 12 bytes
+    CanCaptureRing ring(storage, sizeof(storage));
+    for (uint32_t i = 0; i < 10; i++) {
+        ring.append(statusFrame(100 + i * 50, 10, i));
+    }
+    TEST_ASSERT_EQUAL(4, ring.records());
+    TEST_ASSERT_EQUAL(6, ring.evicted());
+
+    uint8_t capture[128];
+    size_t length = ring.copyTo(capture, sizeof(capture));
+    CanCaptureReader reader(capture, length);
+    CapturedFrame frame;
+    for (uint32_t i = 6; i < 10; i++) {
+        TEST_ASSERT_TRUE(reader.next(&frame));
+        TEST_ASSERT_EQUAL(100 + i * 50, frame.timestamp);
+        TEST_ASSERT_EQUAL(i, frame.data[0]);
+    }
+    TEST_ASSERT_FALSE(reader.next(&frame));
+}
+
+void testCopyInChunks() {
+    uint8_t storage[64];
+    CanCaptureRing ring(storage, sizeof(storage));
+    for (uint32_t i = 0; i < 7; i++) {
+        ring.append(statusFrame(i * 10, 10, i));
+    }
+    uint8_t whole[128];
+    uint8_t chunked[128];
+    size_t length = ring.copyTo(whole, sizeof(whole));
+    size_t offset = 0;
+    while (offset < length) {
+        offset += ring.copyTo(chunked + offset, 5, offset);
+    }
+    TEST_ASSERT_EQUAL(length, offset);
+    TEST_ASSERT_EQUAL_MEMORY(whole, chunked, length);
+}
+
+void testRejectsTruncatedAndForeignData() {
+    uint8_t storage[64];
+    CanCaptureRing ring(storage, sizeof(storage));
+    ring.append(statusFrame(10, 10, 1));
+    uint8_t capture[64];
+    size_t length = ring.copyTo(capture, sizeof(capture));
+
+    CapturedFrame frame;
+    CanCaptureReader truncated(capture, length - 1);
+    TEST_ASSERT_TRUE(truncated.valid());
+    TEST_ASSERT_FALSE(truncated.next(&frame));
+
+    capture[0] = 'X';
+    CanCaptureReader foreign(capture, length);
+    TEST_ASSERT_FALSE(foreign.valid());
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(testRoundTrip);
+    RUN_TEST(testRingEvictsOldestAndKeepsTimestamps);
+    RUN_TEST(testCopyInChunks);
+    RUN_TEST(testRejectsTruncatedAndForeignData);
+    UNITY_END();
+    return 0;
+}
@@ -0,0 +1,896 @@
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "../../src/CanBus.h"
+#include "../../src/TelemetryFrame.h"
+#include "SimulatedBus.h"
+#include "SimulatedVesc.h"
+#include "SimulatedReplay.h"
+#include "SPIFFS.h"
+#include "crc.h"
+#include "buffer.h"
+
+/*
+  CanBus, CanDevice and BleCanProxy against fake VESCs on a simulated bus. Time only passes in
+  simulate(), so the tests run many times faster than the real bus while bit timing,
+  arbitration and fragmentation stay realistic.
+*/
+
+static SimulatedBus &bus = SimulatedBus::instance();
+static VescData *vescData = nullptr;
+static CanBus *canBus = nullptr;
+static const uint16_t APP = 1; // BLE connection handle of the app the tests play
+
+static void startCanBus() {
+    bus.reset();
+    delete vescData;
+    vescData = new VescData();
+    Config &config = AppConfiguration::getInstance()->config;
+    config.vescId = 25;
+    config.canPollBudget = 500;
+    config.batteryDrift = 0;
+    canBus = new CanBus(vescData);
+    canBus->init();
+    canBus->proxy->open(APP);
+}
+
+// one firmware loop per simulated millisecond
+static void simulate(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        bus.run(1000);
+        canBus->loop();
+    }
+}
+
+// framing of the VESC packets VESC Tool sends over BLE
+static std::string vescPacket(const std::string &payload) {
+    std::string packet;
+    if (payload.size() <= 255) {
+        packet += (char) 2;
+        packet += (char) payload.size();
+    } else {
+        packet += (char) 3;
+        packet += (char) (payload.size() >> 8);
+        packet += (char) (payload.size() & 0xFF);
+    }
+    packet += payload;
+    uint16_t crc = crc16((const uint8_t *) payload.data(), payload.size());
+    packet += (char) (crc >> 8);
+    packet += (char) (crc & 0xFF);
+    packet += (char) 3;
+    return packet;
+}
+
+// hands a packet to the proxy in pieces of one BLE write each, CanBus::loop() forwards them
+static void proxyWrite(const std::string &packet, size_t mtu = 20, uint16_t connection = APP) {
+    for (size_t i = 0; i < packet.size(); i += mtu) {
+        std::string write = packet.substr(i, mtu);
+        TEST_ASSERT_TRUE(canBus->proxy->receive(connection, (const uint8_t *) write.data(), write.size()));
+    }
+}
+
+static ByteRing<PROXY_TX_RING_SIZE> &proxyOut(uint16_t connection = APP) {
+    for (ProxySession &session : canBus->proxy->sessions) {
+        if (session.open() && session.connection == connection) {
+            return session.out;
+        }
+    }
+    TEST_FAIL_MESSAGE("no proxy session for the connection");
+    return canBus->proxy->sessions[0].out;
+}
+
+// one byte of what the proxy has for a BLE client, -1 if there is nothing
+static int proxyReadByte(ByteRing<PROXY_TX_RING_SIZE> &out) {
+    const uint8_t *data;
+    if (out.peek(&data) == 0) {
+        return -1;
+    }
+    uint8_t value = *data;
+    out.consume(1);
+    return value;
+}
+
+// takes one packet from what the proxy wrote back to a client, checks framing and CRC
+static std::string proxyRead(uint16_t connection = APP) {
+    ByteRing<PROXY_TX_RING_SIZE> &out = proxyOut(connection);
+    int type = proxyReadByte(out);
+    size_t length = 0;
+    if (type == 2) {
+        length = proxyReadByte(out);
+    } else if (type == 3) {
+        length = proxyReadByte(out) << 8;
+        length |= proxyReadByte(out);
+    } else {
+        TEST_FAIL_MESSAGE("no packet from the proxy");
+    }
+    std::string payload;
+    for (size_t i = 0; i < length; i++) {
+        payload += (char) proxyReadByte(out);
+    }
+    uint16_t crc = proxyReadByte(out) << 8;
+    crc |= proxyReadByte(out);
+    TEST_ASSERT_EQUAL(3, proxyReadByte(out));
+    TEST_ASSERT_EQUAL_HEX16(crc16((const uint8_t *) payload.data(), payload.size()), crc);
+    return payload;
+}
+
+void setUp(void) {
+    Logger::setLogLevel(Logger::WARNING);
+    startCanBus();
+}
+
+void tearDown(void) {
+    // CanBus has no way to shut down, the bus reset in setUp() detaches its driver
+}
+
+void testPollsTelemetryFromSimulatedVesc() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(2000);
+
+    TEST_ASSERT_TRUE(vescData->connected);
+    TEST_ASSERT_EQUAL(6, vescData->majorVersion);
+    TEST_ASSERT_EQUAL(2, vescData->minorVersion);
+    TEST_ASSERT_EQUAL_STRING("60_MK6", vescData->name.c_str());
+    // COMM_GET_VALUES_SELECTIVE
+    TEST_ASSERT_EQUAL(8450, vescData->erpm);
+    TEST_ASSERT_FLOAT_WITHIN(0.11, 58.6, vescData->inputVoltage);
+    TEST_ASSERT_FLOAT_WITHIN(0.11, 35.5, vescData->mosfetTemp);
+    TEST_ASSERT_FLOAT_WITHIN(0.0011, 0.35, vescData->dutyCycle);
+    TEST_ASSERT_EQUAL(123456, vescData->tachometer);
+    // float package
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 1.5, vescData->pitch);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, -2.25, vescData->roll);
+    TEST_ASSERT_EQUAL(3, vescData->switchState); // switch state 2: both pads pressed
+
+    const CommandStats *realtime = canBus->requests.stats(25, COMM_GET_VALUES_SELECTIVE);
+    TEST_ASSERT_NOT_NULL(realtime);
+    TEST_ASSERT_GREATER_THAN(20, realtime->answered);
+    TEST_ASSERT_EQUAL(0, realtime->timeouts);
+    // ~3.5 ms on the bus, timestamps have the 1 ms resolution of the simulated loop
+    TEST_ASSERT_LESS_OR_EQUAL(5000, realtime->maxRtt);
+}
+
+void testSnapshotFollowsCanBusLoop() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    TEST_ASSERT_EQUAL(0, vescData->snapshot.version());
+    simulate(2000);
+
+    VescTelemetry telemetry;
+    uint32_t version = vescData->snapshot.read(&telemetry);
+    TEST_ASSERT_GREATER_THAN(0, version);
+    TEST_ASSERT_TRUE(telemetry.connected);
+    TEST_ASSERT_EQUAL(vescData->erpm, telemetry.erpm);
+    TEST_ASSERT_EQUAL(vescData->switchState, telemetry.switchState);
+    TEST_ASSERT_EQUAL(vescData->controllerCount, telemetry.controllerCount);
+
+    // loops without any frame don't publish
+    vesc.answering = false;
+    simulate(5);
+    version = vescData->snapshot.version();
+    for (int i = 0; i < 10; i++) {
+        canBus->loop();
+    }
+    TEST_ASSERT_EQUAL(version, vescData->snapshot.version());
+}
+
+void testTelemetryFramePacksSnapshot() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(2000);
+
+    TelemetryFrame telemetryFrame;
+    uint8_t frame[TELEMETRY_FRAME_MAX_SIZE];
+    TEST_ASSERT_TRUE(telemetryFrame.due(millis()));
+    size_t length = telemetryFrame.next(vescData->snapshot.read(), millis(), frame);
+    TEST_ASSERT_EQUAL(37, length);
+    TEST_ASSERT_EQUAL(TELEMETRY_FRAME_VERSION, frame[0]);
+    TEST_ASSERT_EQUAL(0, frame[1]);
+    int32_t index = 2;
+    TEST_ASSERT_EQUAL_HEX16(TELEMETRY_FIELDS_ALL, buffer_get_uint16(frame, &index));
+    TEST_ASSERT_EQUAL(8450, buffer_get_int32(frame, &index));
+    TEST_ASSERT_EQUAL(350, buffer_get_int16(frame, &index));
+    TEST_ASSERT_EQUAL(125, buffer_get_int16(frame, &index));
+    TEST_ASSERT_EQUAL(82, buffer_get_int16(frame, &index));
+    TEST_ASSERT_EQUAL(586, buffer_get_int16(frame, &index));
+    TEST_ASSERT_EQUAL(355, buffer_get_int16(frame, &index));
+    index = 20;
+    TEST_ASSERT_EQUAL(150, buffer_get_int16(frame, &index));
+    TEST_ASSERT_EQUAL(-225, buffer_get_int16(frame, &index));
+    TEST_ASSERT_EQUAL(3, frame[index]);
+    index = 31;
+    TEST_ASSERT_EQUAL(234567, buffer_get_int32(frame, &index));
+    TEST_ASSERT_LESS_THAN(100, buffer_get_uint16(frame, &index));
+    TEST_ASSERT_FALSE(telemetryFrame.due(millis()));
+
+    // a client with the default MTU among the connected ones: the fields up to the motor temperature fit 20 bytes
+    simulate(TELEMETRY_FRAME_INTERVAL);
+    length = telemetryFrame.next(vescData->snapshot.read(), millis(), frame, 20);
+    TEST_ASSERT_EQUAL(20, length);
+    index = 2;
+    TEST_ASSERT_EQUAL_HEX16(0x007F, buffer_get_uint16(frame, &index));
+    TEST_ASSERT_EQUAL(8450, buffer_get_int32(frame, &index));
+    TEST_ASSERT_EQUAL_HEX16(0x0200, TelemetryFrame::fit(0x4200, 8));
+
+    // 50 ms, erpm and switch state: the frame of a client with the default MTU
+    const uint8_t settings[] = {0, 50, 0x02, 0x01};
+    TEST_ASSERT_TRUE(telemetryFrame.configure(settings, sizeof(settings)));
+    TEST_ASSERT_EQUAL(50, telemetryFrame.interval());
+    simulate(50);
+    TEST_ASSERT_TRUE(telemetryFrame.due(millis()));
+    length = telemetryFrame.next(vescData->snapshot.read(), millis(), frame);
+    TEST_ASSERT_EQUAL(9, length);
+    TEST_ASSERT_EQUAL(2, frame[1]);
+    TEST_ASSERT_EQUAL(3, frame[8]);
+
+    // too fast is limited, interval 0 stops the frames, short writes are refused
+    const uint8_t fast[] = {0, 1, 0xFF, 0xFF};
+    TEST_ASSERT_TRUE(telemetryFrame.configure(fast, sizeof(fast)));
+    TEST_ASSERT_EQUAL(TELEMETRY_FRAME_MIN_INTERVAL, telemetryFrame.interval());
+    const uint8_t off[] = {0, 0, 0xFF, 0xFF};
+    TEST_ASSERT_TRUE(telemetryFrame.configure(off, sizeof(off)));
+    simulate(100);
+    TEST_ASSERT_FALSE(telemetryFrame.due(millis()));
+    TEST_ASSERT_FALSE(telemetryFrame.configure(off, 2));
+}
+
+void testUnansweredRequestsTimeOut() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1500);
+    vesc.answering = false;
+    simulate(4000);
+
+    TEST_ASSERT_FALSE(vescData->connected);
+    TEST_ASSERT_GREATER_OR_EQUAL(3, canBus->requests.stats(25, COMM_GET_VALUES_SELECTIVE)->timeouts);
+}
+
+// the fault polls of a dead secondary controller time out on their own, the primary stays connected
+void testDeadSecondaryKeepsPrimaryConnected() {
+    SimulatedVesc front(25);
+    SimulatedVesc rear(40);
+    bus.attach(&front);
+    bus.attach(&rear);
+    simulate(11000);
+    TEST_ASSERT_EQUAL(2, canBus->controllers.count());
+    rear.answering = false;
+    simulate(5000);
+
+    TEST_ASSERT_TRUE(vescData->connected);
+    TEST_ASSERT_GREATER_OR_EQUAL(3, canBus->requests.stats(40, COMM_GET_VALUES_SELECTIVE)->timeouts);
+    const CommandStats *realtime = canBus->requests.stats(25, COMM_GET_VALUES_SELECTIVE);
+    TEST_ASSERT_EQUAL(0, realtime->timeouts);
+    uint32_t polls = realtime->answered;
+    simulate(1000);
+    TEST_ASSERT_GREATER_THAN(polls + 10, realtime->answered);
+}
+
+// the status of a secondary controller doesn't bring back a primary that stopped talking
+void testSilentPrimaryStaysDisconnected() {
+    SimulatedVesc front(25);
+    SimulatedVesc rear(40);
+    rear.statusInterval = 20000;
+    bus.attach(&front);
+    bus.attach(&rear);
+    simulate(CONTROLLER_PING_INTERVAL + 1000);
+    TEST_ASSERT_EQUAL(2, canBus->controllers.count());
+    proxyWrite(vescPacket(std::string(1, (char) COMM_FW_VERSION)));
+    simulate(20);
+    proxyRead();
+
+    front.answering = false;
+    simulate(5000);
+    for (int i = 0; i < 1000; i++) {
+        simulate(1);
+        TEST_ASSERT_FALSE(vescData->connected);
+    }
+    TEST_ASSERT_FALSE(vescData->snapshot.read().connected);
+
+    // back again, the cache starts over once
+    front.answering = true;
+    simulate(CONTROLLER_TIMEOUT);
+    TEST_ASSERT_TRUE(vescData->connected);
+    uint32_t hits = canBus->proxy->cache.hits;
+    proxyWrite(vescPacket(std::string(1, (char) COMM_FW_VERSION)));
+    simulate(20);
+    TEST_ASSERT_EQUAL(COMM_FW_VERSION, proxyRead()[0]);
+    TEST_ASSERT_EQUAL(hits, canBus->proxy->cache.hits);
+    proxyWrite(vescPacket(std::string(1, (char) COMM_FW_VERSION)));
+    simulate(20);
+    TEST_ASSERT_EQUAL(COMM_FW_VERSION, proxyRead()[0]);
+    TEST_ASSERT_EQUAL(hits + 1, canBus->proxy->cache.hits);
+}
+
+void testProxyLongPacketsWhilePolling() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1000);
+
+    std::string configuration;
+    for (int i = 0; i < 600; i++) {
+        configuration += (char) (i * 13);
+    }
+    // COMM_SET_MCCONF, 600 bytes need FILL_RX_BUFFER and FILL_RX_BUFFER_LONG
+    proxyWrite(vescPacket(std::string(1, (char) 13) + configuration));
+    simulate(100);
+    TEST_ASSERT_TRUE(vesc.mcconf == configuration);
+    // the acknowledgement is a short buffer
+    TEST_ASSERT_EQUAL_STRING("\x0d", proxyRead().c_str());
+
+    // COMM_GET_MCCONF
+    proxyWrite(vescPacket(std::string(1, (char) 14)));
+    simulate(100);
+    std::string response = proxyRead();
+    TEST_ASSERT_EQUAL(601, response.size());
+    TEST_ASSERT_EQUAL(14, response[0]);
+    TEST_ASSERT_TRUE(response.substr(1) == configuration);
+
+    // COMM_GET_VALUES, decoded on the way through
+    proxyWrite(vescPacket(std::string(1, (char) 4)));
+    simulate(20);
+    response = proxyRead();
+    TEST_ASSERT_EQUAL(4, response[0]);
+    TEST_ASSERT_FLOAT_WITHIN(0.0011, 70.25, vescData->wattHours);
+    TEST_ASSERT_EQUAL(234567, vescData->tachometerAbsolut);
+
+    TEST_ASSERT_EQUAL(0, canBus->requests.stats(25, COMM_GET_VALUES_SELECTIVE)->timeouts);
+}
+
+static CanFrame statusFrame(uint8_t packetId, uint8_t controllerId, int32_t value) {
+    CanFrame frame = {};
+    frame.message.extd = 1;
+    frame.message.identifier = ((uint32_t) packetId << 8) | controllerId;
+    frame.message.data_length_code = 8;
+    int32_t index = 0;
+    buffer_append_int32(frame.message.data, value, &index);
+    return frame;
+}
+
+void testFrameQueuePrioritizesAndCoalesces() {
+    CanFrameQueue queue;
+    queue.push(statusFrame(CAN_PACKET_STATUS, 25, 1000));
+    queue.push(statusFrame(CAN_PACKET_FILL_RX_BUFFER, 26, 1));
+    queue.push(statusFrame(CAN_PACKET_STATUS, 25, 2000));
+    queue.push(statusFrame(CAN_PACKET_STATUS_4, 25, 3000));
+    queue.push(statusFrame(CAN_PACKET_PROCESS_RX_BUFFER, 26, 2));
+    TEST_ASSERT_EQUAL(4, queue.size());
+    TEST_ASSERT_EQUAL(1, queue.coalesced);
+
+    CanFrame frame;
+    int32_t index;
+    // buffer transfers in their order first
+    TEST_ASSERT_TRUE(queue.pop(&frame));
+    TEST_ASSERT_EQUAL_HEX32(CAN_PACKET_FILL_RX_BUFFER << 8 | 26, frame.message.identifier);
+    TEST_ASSERT_TRUE(queue.pop(&frame));
+    TEST_ASSERT_EQUAL_HEX32(CAN_PACKET_PROCESS_RX_BUFFER << 8 | 26, frame.message.identifier);
+    // only the newest status 1
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_TRUE(queue.pop(&frame));
+        index = 0;
+        if (frame.message.identifier == (CAN_PACKET_STATUS << 8 | 25)) {
+            TEST_ASSERT_EQUAL(2000, buffer_get_int32(frame.message.data, &index));
+        } else {
+            TEST_ASSERT_EQUAL(3000, buffer_get_int32(frame.message.data, &index));
+        }
+    }
+    TEST_ASSERT_FALSE(queue.pop(&frame));
+}
+
+// VESC Tool batches packets into one write at a large MTU, a small MTU splits them anywhere
+void testProxyFramesBatchedAndSplitWrites() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1000);
+
+    std::string configuration;
+    for (int i = 0; i < 200; i++) {
+        configuration += (char) (i * 7);
+    }
+    std::string batch = std::string("\x00\xff", 2) + vescPacket(std::string(1, (char) 13) + configuration)
+                        + vescPacket(std::string(1, (char) 0));
+    proxyWrite(batch, 512);
+    TEST_ASSERT_FALSE(canBus->proxy->processing);
+    simulate(100);
+    TEST_ASSERT_TRUE(vesc.mcconf == configuration);
+    // the acknowledgement is a short buffer
+    TEST_ASSERT_EQUAL_STRING("\x0d", proxyRead().c_str());
+    TEST_ASSERT_EQUAL(0, proxyRead()[0]);
+
+    proxyWrite(vescPacket(std::string(1, (char) 14)) + vescPacket(std::string(1, (char) 4)), 512);
+    simulate(100);
+    std::string response = proxyRead();
+    TEST_ASSERT_EQUAL(14, response[0]);
+    TEST_ASSERT_TRUE(response.substr(1) == configuration);
+    TEST_ASSERT_EQUAL(4, proxyRead()[0]);
+
+    // COMM_GET_APPCONF and COMM_GET_VALUES_SELECTIVE for the erpm
+    proxyWrite(vescPacket(std::string(1, (char) 17)) + vescPacket(std::string("\x32\x00\x00\x00\x80", 5)), 1);
+    simulate(100);
+    TEST_ASSERT_TRUE(proxyRead().substr(1) == vesc.appconf);
+    TEST_ASSERT_EQUAL(50, proxyRead()[0]);
+    TEST_ASSERT_EQUAL(0, proxyOut().available());
+}
+
+// an upload at the 4 KB limit of a VESC packet, in BLE writes at MTU 512 as fast as the bus takes them
+void testProxyStreamsUploadsToPacketLimit() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1000);
+
+    std::string configuration;
+    for (int i = 0; i < 4000; i++) {
+        configuration += (char) (i * 11);
+    }
+    std::string packet = vescPacket(std::string(1, (char) 13) + configuration);
+    const size_t mtu = 509; // less the ATT header
+    uint64_t start = NativeClock::now();
+    uint64_t frames = bus.framesTransmitted;
+    for (size_t i = 0; i < packet.size(); i += mtu) {
+        std::string write = packet.substr(i, mtu);
+        canBus->proxy->receive(APP, (const uint8_t *) write.data(), write.size());
+        simulate(25);
+        if (i == 0) {
+            // the first write is on the bus before the second one arrives
+            TEST_ASSERT_GREATER_THAN(70, bus.framesTransmitted - frames);
+        }
+    }
+    for (int i = 0; i < 100 && proxyOut().available() == 0; i++) {
+        simulate(1);
+    }
+    double ms = (NativeClock::now() - start) / 1000.0;
+    printf("proxy upload: %d bytes in %.0f ms, %.1f KB/s at %d bit/s\n", (int) configuration.size(), ms,
+           configuration.size() / ms, SIMULATED_BUS_BITRATE);
+
+    TEST_ASSERT_TRUE(vesc.mcconf == configuration);
+    TEST_ASSERT_EQUAL_STRING("\x0d", proxyRead().c_str());
+    TEST_ASSERT_EQUAL(0, canBus->proxy->txFailed);
+    TEST_ASSERT_EQUAL(0, vesc.crcErrors);
+}
+
+// apps read version and configuration on every connect, only the first time goes over CAN
+void testProxyAnswersRepeatedQueriesFromCache() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1000);
+
+    proxyWrite(vescPacket(std::string(1, (char) 14)));
+    proxyWrite(vescPacket(std::string(1, (char) 0)));
+    canBus->proxy->service();
+    TEST_ASSERT_EQUAL(0, proxyOut().available());
+    simulate(100);
+    std::string mcconf = proxyRead();
+    TEST_ASSERT_TRUE(mcconf.substr(1) == vesc.mcconf);
+    std::string version = proxyRead();
+
+    // straight from the cache, no simulated time passes
+    proxyWrite(vescPacket(std::string(1, (char) 0)));
+    canBus->proxy->service();
+    TEST_ASSERT_TRUE(proxyRead() == version);
+    proxyWrite(vescPacket(std::string(1, (char) 14)));
+    canBus->proxy->service();
+    TEST_ASSERT_TRUE(proxyRead() == mcconf);
+    TEST_ASSERT_EQUAL(2, canBus->proxy->cache.hits);
+
+    // a new configuration replaces what was cached
+    std::string configuration(300, (char) 0x2a);
+    proxyWrite(vescPacket(std::string(1, (char) 13) + configuration));
+    simulate(100);
+    TEST_ASSERT_EQUAL_STRING("\x0d", proxyRead().c_str());
+    proxyWrite(vescPacket(std::string(1, (char) 14)));
+    canBus->proxy->service();
+    TEST_ASSERT_EQUAL(0, proxyOut().available());
+    simulate(100);
+    TEST_ASSERT_TRUE(proxyRead().substr(1) == configuration);
+    TEST_ASSERT_EQUAL(1, canBus->proxy->cache.invalidations);
+}
+
+// app telemetry polls are answered from what CanBus polls anyway, in the same bytes the VESC would send
+void testProxySynthesizesTelemetryPolls() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1000);
+    const std::string getValues(1, (char) 4);
+    const std::string getRtData("\x24\x65\x01", 3);
+
+    // the first ones go to the VESC, their responses are the layout
+    proxyWrite(vescPacket(getValues));
+    proxyWrite(vescPacket(getRtData));
+    canBus->proxy->service();
+    TEST_ASSERT_EQUAL(0, proxyOut().available());
+    simulate(50);
+    std::string values = proxyRead();
+    std::string rtData = proxyRead();
+
+    simulate(20);
+    proxyWrite(vescPacket(getValues));
+    proxyWrite(vescPacket(getRtData));
+    canBus->proxy->service();
+    TEST_ASSERT_TRUE(proxyRead() == values);
+    TEST_ASSERT_TRUE(proxyRead() == rtData);
+    TEST_ASSERT_EQUAL(2, canBus->proxy->responder.answered);
+
+    // every patched field has to follow the VESC, not just the first layout
+    vesc.values.mosfetTemp = 40.5;
+    vesc.values.motorTemp = 50.5;
+    vesc.values.motorCurrent = 20.5;
+    vesc.values.inputCurrent = 15.5;
+    vesc.values.dutyCycle = 0.5;
+    vesc.values.erpm = 5555;
+    vesc.values.inputVoltage = 55.5;
+    vesc.values.ampHours = 2.5;
+    vesc.values.ampHoursCharged = 0.5;
+    vesc.values.wattHours = 150.5;
+    vesc.values.wattHoursCharged = 15.5;
+    vesc.values.tachometer = 200000;
+    vesc.values.tachometerAbs = 300000;
+    vesc.values.fault = 3;
+    simulate(300);
+    proxyWrite(vescPacket(getValues));
+    canBus->proxy->service();
+    std::string synthesized = proxyRead();
+    TEST_ASSERT_EQUAL(values.size(), synthesized.size());
+    const auto *patched = (const uint8_t *) synthesized.data();
+    int32_t index = 1;
+    TEST_ASSERT_EQUAL(405, buffer_get_int16(patched, &index));
+    TEST_ASSERT_EQUAL(505, buffer_get_int16(patched, &index));
+    TEST_ASSERT_EQUAL(2050, buffer_get_int32(patched, &index));
+    TEST_ASSERT_EQUAL(1550, buffer_get_int32(patched, &index));
+    index += 8; // id, iq are passed through
+    TEST_ASSERT_EQUAL(500, buffer_get_int16(patched, &index));
+    TEST_ASSERT_EQUAL(5555, buffer_get_int32(patched, &index));
+    TEST_ASSERT_EQUAL(555, buffer_get_int16(patched, &index));
+    TEST_ASSERT_EQUAL(25000, buffer_get_int32(patched, &index));
+    TEST_ASSERT_EQUAL(5000, buffer_get_int32(patched, &index));
+    TEST_ASSERT_EQUAL(1505000, buffer_get_int32(patched, &index));
+    TEST_ASSERT_EQUAL(155000, buffer_get_int32(patched, &index));
+    TEST_ASSERT_EQUAL(200000, buffer_get_int32(patched, &index));
+    TEST_ASSERT_EQUAL(300000, buffer_get_int32(patched, &index));
+    TEST_ASSERT_EQUAL(3, patched[index]);
+
+    // the rest of the layout is refreshed by a poll the VESC answers now and then
+    vesc.values.pidPosition = 12.5;
+    uint32_t answered = canBus->proxy->responder.answered;
+    std::string pidPosition;
+    for (int i = 0; i < PROXY_TELEMETRY_LAYOUT_MAX_AGE / 50 + 2; i++) {
+        proxyWrite(vescPacket(getValues));
+        simulate(50);
+        pidPosition = proxyRead().substr(54, 4);
+    }
+    index = 0;
+    TEST_ASSERT_EQUAL(12500000, buffer_get_int32((const uint8_t *) pidPosition.data(), &index));
+    TEST_ASSERT_GREATER_THAN(answered + 10, canBus->proxy->responder.answered);
+    answered = canBus->proxy->responder.answered;
+
+    // an old sample isn't good enough, the poll goes to the (silent) VESC
+    vesc.answering = false;
+    simulate(PROXY_TELEMETRY_MAX_AGE + 500);
+    proxyWrite(vescPacket(getValues));
+    simulate(50);
+    TEST_ASSERT_EQUAL(0, proxyOut().available());
+    TEST_ASSERT_EQUAL(answered, canBus->proxy->responder.answered);
+}
+
+// packets damaged between the app and the proxy never reach the VESC
+void testProxyDropsCorruptPackets() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1000);
+    std::string mcconf = vesc.mcconf;
+
+    std::string configuration(100, (char) 0x55);
+    std::string packet = vescPacket(std::string(1, (char) 13) + configuration);
+    packet[50] ^= 0x10;
+    proxyWrite(packet);
+    packet = vescPacket(std::string(1, (char) 4));
+    packet[packet.size() - 2] ^= 0x01;
+    proxyWrite(packet);
+    simulate(100);
+
+    TEST_ASSERT_TRUE(vesc.mcconf == mcconf);
+    TEST_ASSERT_EQUAL(0, proxyOut().available());
+    char metrics[64];
+    canBus->proxy->format(metrics, sizeof(metrics));
+    TEST_ASSERT_EQUAL_STRING("0;0;2;0;0;0;0;0;0;0;0", metrics);
+
+    proxyWrite(vescPacket(std::string(1, (char) 4)));
+    simulate(20);
+    TEST_ASSERT_EQUAL(4, proxyRead()[0]);
+}
+
+// a companion app and VESC Tool write long packets at the same time, each on its own connection
+void testProxySessionsKeepClientsApart() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1000);
+    const uint16_t vescTool = 2;
+    TEST_ASSERT_NOT_NULL(canBus->proxy->open(vescTool));
+    TEST_ASSERT_NULL(canBus->proxy->open(3));
+
+    std::string mcconf, appconf;
+    for (int i = 0; i < 900; i++) {
+        mcconf += (char) (i * 13);
+    }
+    for (int i = 0; i < 400; i++) {
+        appconf += (char) (i * 5 + 1);
+    }
+    std::string upload = vescPacket(std::string(1, (char) 13) + mcconf) + vescPacket(std::string(1, (char) 14));
+    std::string app = vescPacket(std::string(1, (char) 16) + appconf) + vescPacket(std::string(1, (char) 4));
+    for (size_t i = 0; i < upload.size() || i < app.size(); i += 20) {
+        if (i < upload.size()) {
+            proxyWrite(upload.substr(i, 20), 20, vescTool);
+        }
+        if (i < app.size()) {
+            proxyWrite(app.substr(i, 20), 20, APP);
+        }
+        simulate(1);
+    }
+    simulate(200);
+
+    TEST_ASSERT_TRUE(vesc.mcconf == mcconf);
+    TEST_ASSERT_TRUE(vesc.appconf == appconf);
+    TEST_ASSERT_EQUAL(0, vesc.crcErrors);
+    TEST_ASSERT_EQUAL_STRING("\x0d", proxyRead(vescTool).c_str());
+    TEST_ASSERT_TRUE(proxyRead(vescTool).substr(1) == mcconf);
+    TEST_ASSERT_EQUAL_STRING("\x10", proxyRead(APP).c_str());
+    TEST_ASSERT_EQUAL(4, proxyRead(APP)[0]);
+    TEST_ASSERT_EQUAL(0, proxyOut(vescTool).available());
+    TEST_ASSERT_EQUAL(0, proxyOut(APP).available());
+
+    // the session of a client that left is free again after the next loop
+    canBus->proxy->close(vescTool);
+    simulate(1);
+    TEST_ASSERT_NOT_NULL(canBus->proxy->open(3));
+}
+
+// a client that stops in the middle of a long packet doesn't keep the rx buffer of the VESC
+void testProxyStalledSessionReleasesRxBuffer() {
+    SimulatedVesc vesc(25);
+    bus.attach(&vesc);
+    simulate(1000);
+    const uint16_t vescTool = 2;
+    TEST_ASSERT_NOT_NULL(canBus->proxy->open(vescTool));
+
+    std::string mcconf(600, (char) 0x5A), appconf(400, (char) 0x21);
+    std::string upload = vescPacket(std::string(1, (char) COMM_SET_MCCONF) + mcconf);
+    proxyWrite(upload.substr(0, 100), 20, vescTool);
+    simulate(5);
+    TEST_ASSERT_TRUE(canBus->proxy->processing);
+    proxyWrite(vescPacket(std::string(1, (char) COMM_SET_APPCONF) + appconf));
+    simulate(200);
+    TEST_ASSERT_TRUE(vesc.appconf != appconf);
+    TEST_ASSERT_EQUAL(0, proxyOut(APP).available());
+
+    simulate(VESC_PACKET_TIMEOUT);
+    TEST_ASSERT_TRUE(vesc.appconf == appconf);
+    TEST_ASSERT_EQUAL(COMM_SET_APPCONF, proxyRead(APP)[0]);
+    TEST_ASSERT_FALSE(canBus->proxy->processing);
+    TEST_ASSERT_EQUAL(1, canBus->proxy->sessions[1].framer.timeouts);
+
+    // the client tries again
+    proxyWrite(upload, 20, vescTool);
+    simulate(100);
+    TEST_ASSERT_TRUE(vesc.mcconf == mcconf);
+    TEST_ASSERT_EQUAL(COMM_SET_MCCONF, proxyRead(vescTool)[0]);
+    TEST_ASSERT_EQUAL(0, vesc.crcErrors);
+}
+
+/*
+  The VESC answers a configuration read from its blocking thread, to whoever sent the last
+  request by then. Requests of the other session and the ESP's polls wait until it is answered.
+*/
+void testBlockingCommandHoldsOtherSenders() {
+    SimulatedVesc vesc(25);
+    vesc.blockingDelay = 40000;
+    bus.attach(&vesc);
+    simulate(1000);
+    const uint16_t vescTool = 2;
+    TEST_ASSERT_NOT_NULL(canBus->proxy->open(vescTool));
+    const CommandStats *realtime = canBus->requests.stats(25, COMM_GET_VALUES_SELECTIVE);
+    const CommandStats *balance = canBus->requests.stats(25, COMM_CUSTOM_APP_DATA);
+    uint32_t polled = realtime->sent;
+    uint32_t balancePolled = balance->sent;
+
+    proxyWrite(vescPacket(std::string(1, (char) COMM_GET_MCCONF)), 20, vescTool);
+    simulate(5);
+    TEST_ASSERT_TRUE(canBus->arbiter.held());
+    std::string selective("\x32\x00\x00\x00\x80", 5);
+    proxyWrite(vescPacket(selective));
+    simulate(20);
+    TEST_ASSERT_EQUAL(0, proxyOut(APP).available());
+    TEST_ASSERT_UINT32_WITHIN(1, polled, realtime->sent);
+    TEST_ASSERT_UINT32_WITHIN(1, balancePolled, balance->sent);
+    simulate(100);
+
+    TEST_ASSERT_FALSE(canBus->arbiter.held());
+    TEST_ASSERT_GREATER_THAN(0, canBus->arbiter.refused);
+    TEST_ASSERT_TRUE(proxyRead(vescTool).substr(1) == vesc.mcconf);
+    TEST_ASSERT_EQUAL(COMM_GET_VALUES_SELECTIVE, proxyRead(APP)[0]);
+    TEST_ASSERT_EQUAL(0, proxyOut(vescTool).available());
+    TEST_ASSERT_EQUAL(0, vesc.blockingDropped);
+    TEST_ASSERT_GREATER_THAN(polled + 1, realtime->sent);
+    TEST_ASSERT_GREATER_THAN(balancePolled + 1, balance->sent);
+    TEST_ASSERT_EQUAL(0, realtime->timeouts);
+    TEST_ASSERT_EQUAL(0, balance->timeouts);
+}
+
+// a second VESC answering the ping with the CAN id of a proxy session pushes the session aside
+void testProxySessionMovesOffControllerIds() {
+    SimulatedVesc front(25);
+    SimulatedVesc rear(27);
+    bus.attach(&front);
+    bus.attach(&rear);
+    TEST_ASSERT_NOT_NULL(canBus->proxy->session(27));
+    simulate(CONTROLLER_PING_INTERVAL + 1000);
+
+    TEST_ASSERT_EQUAL(2, vescData->controllerCount);
+    TEST_ASSERT_NULL(canBus->proxy->session(27));
+    uint8_t moved = canBus->proxy->sessions[0].canId;
+    TEST_ASSERT_TRUE(moved != 25 && moved != 26 && moved != 27 && moved != canBus->proxy->sessions[1].canId);
+    proxyWrite(vescPacket(std::string(1, (char) COMM_GET_VALUES)));
+    simulate(50);
+    std::string values = proxyRead();
+    TEST_ASSERT_EQUAL(COMM_GET_VALUES, values[0]);
+    TEST_ASSERT_EQUAL(0, proxyOut().available());
+}
+
+// the loop stalls while the VESC floods the bus with status frames
+void testStalledLoopCatchesUp() {
+    SimulatedVesc vesc(25);
+    vesc.statusInterval = 2000; // ~3000 frames per second
+    bus.attach(&vesc);
+    simulate(1000);
+    TEST_ASSERT_TRUE(vescData->connected);
+
+    vesc.values.erpm = 4321;
+    bus.run(10000);
+    simulate(20);
+    TEST_ASSERT_GREATER_THAN(0, canBus->metrics.coalescedFrames);
+    TEST_ASSERT_LESS_OR_EQUAL(CAN_LOOP_FRAME_BUDGET, canBus->metrics.maxFramesPerLoop);
+    TEST_ASSERT_EQUAL(0, canBus->metrics.status.rx_missed_count);
+    TEST_ASSERT_EQUAL(4321, vescData->erpm);
+
+    // responses still make it through the flood in one piece
+    proxyWrite(vescPacket(std::string(1, (char) 4)));
+    simulate(50);
+    std::string response = proxyRead();
+    TEST_ASSERT_EQUAL(4, response[0]);
+    TEST_ASSERT_EQUAL(234567, vescData->tachometerAbsolut);
+    TEST_ASSERT_TRUE(vescData->connected);
+}
+
+// two controllers broadcasting status 1-5 at 200 Hz, the bus is more than half loaded
+void testLoadWithTwoControllers() {
+    SimulatedVesc front(25);
+    SimulatedVesc rear(40);
+    front.statusInterval = 5000;
+    rear.statusInterval = 5000;
+    rear.values.motorCurrent = 10.0;
+    rear.values.inputVoltage = 58.2;
+    bus.attach(&front);
+    bus.attach(&rear);
+
+    auto started = std::chrono::steady_clock::now();
+    simulate(12000);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    double speedup = 12000000.0 / (elapsed.count() > 0 ? elapsed.count() : 1);
+    char message[160];
+    snprintf(message, sizeof(message), "%" PRIu64 " frames, bus load %d%%, %.1f times real time",
+             bus.framesTransmitted, (int) (bus.busyTime * 100 / 12000000), speedup);
+    TEST_MESSAGE(message);
+
+    // the rear controller was found by the broadcast ping
+    TEST_ASSERT_EQUAL(2, vescData->controllerCount);
+    TEST_ASSERT_FLOAT_WITHIN(0.11, 58.2, vescData->minInputVoltage);
+    // status 1 and the selective values both send the duty cycle in 1/1000
+    TEST_ASSERT_FLOAT_WITHIN(0.0011, 0.35, vescData->dutyCycle);
+    // status 1 carries the motor current, status 4 the input current
+    TEST_ASSERT_FLOAT_WITHIN(0.11, 12.5, vescData->motorCurrent);
+    TEST_ASSERT_FLOAT_WITHIN(0.11, 8.25, vescData->current);
+    // the brake light follows the motor current of both, the battery monitor their input current
+    TEST_ASSERT_FLOAT_WITHIN(0.21, 22.5, vescData->boardMotorCurrent());
+    TEST_ASSERT_FLOAT_WITHIN(0.21, 16.5, vescData->boardCurrent());
+    TEST_ASSERT_EQUAL(0, canBus->metrics.rxRingDropped);
+    TEST_ASSERT_EQUAL(0, canBus->metrics.status.rx_missed_count);
+    TEST_ASSERT_EQUAL(0, canBus->metrics.txFailed);
+    const CommandStats *realtime = canBus->requests.stats(25, COMM_GET_VALUES_SELECTIVE);
+    TEST_ASSERT_EQUAL(0, realtime->timeouts);
+    // responses queue up behind status broadcasts of the same controller
+    TEST_ASSERT_LESS_OR_EQUAL(10000, realtime->maxRtt);
+    TEST_ASSERT_TRUE(speedup > 1.0);
+}
+
+void testBroadcastModeReplacesPolling() {
+    SimulatedVesc vesc(25);
+    vesc.statusInterval = 20000; // the VESC default of 50Hz
+    bus.attach(&vesc);
+    simulate(2000);
+
+    TEST_ASSERT_TRUE(canBus->scheduler.broadcastMode());
+    TEST_ASSERT_UINT32_WITHIN(1000, 20000, canBus->broadcasts.interval(1));
+    TEST_ASSERT_UINT32_WITHIN(1000, 20000, canBus->broadcasts.interval(6));
+    // only what status 1-5 don't carry is still polled
+    TEST_ASSERT_EQUAL_HEX32(((uint32_t) 1 << 14) | ((uint32_t) 1 << 15), vesc.lastSelectiveMask);
+    uint32_t polls = canBus->requests.stats(25, COMM_GET_VALUES_SELECTIVE)->sent;
+    vesc.values.erpm = 9100;
+    vesc.values.adc1 = 2.5;
+    simulate(1000);
+    TEST_ASSERT_LESS_OR_EQUAL(polls + 4, canBus->requests.stats(25, COMM_GET_VALUES_SELECTIVE)->sent);
+    TEST_ASSERT_EQUAL(9100, vescData->erpm);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 2.5, vescData->adc1);
+
+    // the broadcasts stop, polling takes over again
+    vesc.statusInterval = 0;
+    simulate(1000);
+    TEST_ASSERT_FALSE(canBus->scheduler.broadcastMode());
+    TEST_ASSERT_EQUAL_HEX32(VALUES_SELECTIVE_MASK, vesc.lastSelectiveMask);
+    vesc.values.erpm = 7000;
+    simulate(1000);
+    TEST_ASSERT_EQUAL(7000, vescData->erpm);
+    TEST_ASSERT_TRUE(vescData->connected);
+}
+
+// what a board records can be fed back into CanBus on the host
+void testReplayOfRecordedCapture() {
+    SimulatedVesc vesc(25);
+    vesc.statusInterval = 20000;
+    bus.attach(&vesc);
+    canBus->getRecorder()->start();
+    simulate(1500);
+    canBus->getRecorder()->stop();
+    VescTelemetry recorded = vescData->snapshot.read();
+    // as the BLE characteristic does it, the main loop writes the file
+    SPIFFS.remove(CAN_CAPTURE_FILE);
+    canBus->getRecorder()->requestFlush();
+    TEST_ASSERT_FALSE(SPIFFS.exists(CAN_CAPTURE_FILE));
+    simulate(10);
+    TEST_ASSERT_TRUE(SPIFFS.exists(CAN_CAPTURE_FILE));
+    TEST_ASSERT_EQUAL(0, canBus->getRecorder()->droppedFrames());
+
+    File file = SPIFFS.open(CAN_CAPTURE_FILE, FILE_READ);
+    TEST_ASSERT_TRUE((bool) file);
+    std::vector<uint8_t> capture(file.size());
+    file.read(capture.data(), capture.size());
+    file.close();
+
+    startCanBus();
+    SimulatedReplay replay(capture.data(), capture.size());
+    TEST_ASSERT_TRUE(replay.valid());
+    bus.attach(&replay);
+    simulate(1600);
+
+    TEST_ASSERT_TRUE(replay.finished());
+    TEST_ASSERT_GREATER_THAN(100, replay.framesReplayed);
+    TEST_ASSERT_EQUAL(recorded.erpm, vescData->erpm);
+    TEST_ASSERT_EQUAL(recorded.tachometer, vescData->tachometer);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, recorded.inputVoltage, vescData->inputVoltage);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, recorded.pitch, vescData->pitch);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, recorded.ampHours, vescData->ampHours);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(testPollsTelemetryFromSimulatedVesc);
+    RUN_TEST(testSnapshotFollowsCanBusLoop);
+    RUN_TEST(testTelemetryFramePacksSnapshot);
+    RUN_TEST(testUnansweredRequestsTimeOut);
+    RUN_TEST(testDeadSecondaryKeepsPrimaryConnected);
+    RUN_TEST(testSilentPrimaryStaysDisconnected);
+    RUN_TEST(testProxyLongPacketsWhilePolling);
+    RUN_TEST(testProxyFramesBatchedAndSplitWrites);
+    RUN_TEST(testProxyStreamsUploadsToPacketLimit);
+    RUN_TEST(testProxyAnswersRepeatedQueriesFromCache);
+    RUN_TEST(testProxySynthesizesTelemetryPolls);
+    RUN_TEST(testProxyDropsCorruptPackets);
+    RUN_TEST(testProxySessionsKeepClientsApart);
+    RUN_TEST(testProxyStalledSessionReleasesRxBuffer);
+    RUN_TEST(testBlockingCommandHoldsOtherSenders);
+    RUN_TEST(testProxySessionMovesOffControllerIds);
+    RUN_TEST(testFrameQueuePrioritizesAndCoalesces);
+    RUN_TEST(testStalledLoopCatchesUp);
+    RUN_TEST(testLoadWithTwoControllers);
+    RUN_TEST(testBroadcastModeReplacesPolling);
+    RUN_TEST(testReplayOfRecordedCapture);
+    UNITY_END();
+    return 0;
+}
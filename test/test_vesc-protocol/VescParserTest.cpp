@@ -1,5 +1,12 @@
 #include <unity.h>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include "../../lib/vesc-protocol/src/VescParser.h"
+#include "../../lib/vesc-protocol/src/crc.h"
+#include "../../lib/vesc-protocol/src/VescPacketFramer.h"
 
 
 void setUp(void) {
@@ -37,9 +44,234 @@ void testCommandGetValuesSelective() {
     TEST_ASSERT_EQUAL(50, message.getCommand());
 }
 
+void testCrc16CheckValue() {
+    const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    TEST_ASSERT_EQUAL_HEX16(0x31C3, crc16(check, sizeof(check)));
+    TEST_ASSERT_EQUAL_HEX16(0x31C3, crc16_update(crc16(check, 4), check + 4, 5));
+    TEST_ASSERT_EQUAL_HEX16(0, crc16(check, 0));
+}
+
+// the proxy checksums a packet while its CAN frames come in, 7 payload bytes each
+void testCrc16UpdateInCanFrames() {
+    static uint8_t buffer[4096];
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = i * 31;
+    }
+    uint16_t crc = 0;
+    for (size_t offset = 0; offset < sizeof(buffer); offset += 7) {
+        size_t length = sizeof(buffer) - offset < 7 ? sizeof(buffer) - offset : 7;
+        crc = crc16_update(crc, buffer + offset, length);
+    }
+    TEST_ASSERT_EQUAL_HEX16(crc16(buffer, sizeof(buffer)), crc);
+}
+
+/*
+  1 Mbit/s CAN moves at most 8 payload bytes in a 131 bit extended frame, ~61 KB/s. The
+  checksum of the proxy has to be far faster than that, the bound only catches a checksum that
+  got slower by orders of magnitude, the printout tells by how much it keeps up.
+*/
+void testCrc16KeepsUpWithCan() {
+    static uint8_t buffer[4096];
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = i * 31;
+    }
+    const int rounds = 2000;
+    const double canBytesPerSecond = 1000000.0 / 131 * 8;
+    uint16_t crc = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        crc = crc16_update(crc, buffer, sizeof(buffer));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double bytesPerSecond = rounds * sizeof(buffer) / (seconds > 0 ? seconds : 1e-9);
+    char message[96];
+    snprintf(message, sizeof(message), "crc16 %.0f bytes/s, %.0f times 1 Mbit/s CAN (%04" PRIx16 ")",
+             bytesPerSecond, bytesPerSecond / canBytesPerSecond, crc);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(bytesPerSecond > 10 * canBytesPerSecond);
+}
+
+// wraps payload into the VESC framing, short header up to 255 bytes, returns the packet size
+static size_t buildPacket(const uint8_t *payload, uint16_t length, uint8_t *out) {
+    size_t index = 0;
+    if (length <= 255) {
+        out[index++] = 0x02;
+    } else {
+        out[index++] = 0x03;
+        out[index++] = length >> 8;
+    }
+    out[index++] = length & 0xFF;
+    memcpy(out + index, payload, length);
+    index += length;
+    uint16_t crc = crc16(payload, length);
+    out[index++] = crc >> 8;
+    out[index++] = crc & 0xFF;
+    out[index++] = 0x03;
+    return index;
+}
+
+void testFramerShortPacket() {
+    const uint8_t payload[] = {50, 0, 0, 135, 195};
+    uint8_t packet[16];
+    size_t size = buildPacket(payload, sizeof(payload), packet);
+    VescPacketFramer framer;
+    TEST_ASSERT_EQUAL(size, framer.feed(packet, size));
+    TEST_ASSERT_TRUE(framer.complete());
+    TEST_ASSERT_FALSE(framer.receiving());
+    TEST_ASSERT_EQUAL(sizeof(payload), framer.length());
+    TEST_ASSERT_EQUAL_MEMORY(payload, framer.payload(), sizeof(payload));
+    TEST_ASSERT_EQUAL_HEX16(crc16(payload, sizeof(payload)), framer.crc());
+    TEST_ASSERT_EQUAL(1, framer.packets);
+    TEST_ASSERT_EQUAL(0, framer.framingErrors + framer.crcErrors + framer.skippedBytes);
+}
+
+void testFramerLongPacket() {
+    static uint8_t payload[600];
+    static uint8_t packet[sizeof(payload) + 6];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i * 7;
+    }
+    size_t size = buildPacket(payload, sizeof(payload), packet);
+    TEST_ASSERT_EQUAL(0x03, packet[0]);
+    VescPacketFramer framer;
+    TEST_ASSERT_EQUAL(size, framer.feed(packet, size));
+    TEST_ASSERT_TRUE(framer.complete());
+    TEST_ASSERT_EQUAL(sizeof(payload), framer.length());
+    TEST_ASSERT_EQUAL_MEMORY(payload, framer.payload(), sizeof(payload));
+}
+
+// a BLE write can end anywhere, the packet has to come out the same for every cut
+void testFramerPacketSplitAtEveryByte() {
+    uint8_t payload[300];
+    uint8_t packet[sizeof(payload) + 6];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i * 13 + 1;
+    }
+    size_t size = buildPacket(payload, sizeof(payload), packet);
+    for (size_t cut = 1; cut < size; cut++) {
+        VescPacketFramer framer;
+        TEST_ASSERT_EQUAL(cut, framer.feed(packet, cut));
+        TEST_ASSERT_FALSE(framer.complete());
+        TEST_ASSERT_TRUE(framer.receiving());
+        TEST_ASSERT_EQUAL(size - cut, framer.feed(packet + cut, size - cut));
+        TEST_ASSERT_TRUE(framer.complete());
+        TEST_ASSERT_EQUAL(sizeof(payload), framer.length());
+        TEST_ASSERT_EQUAL_MEMORY(payload, framer.payload(), sizeof(payload));
+    }
+}
+
+// two packets in one write come out one feed() at a time
+void testFramerConsecutivePackets() {
+    const uint8_t first[] = {0};
+    const uint8_t second[] = {62, 1, 2};
+    uint8_t stream[32];
+    size_t firstSize = buildPacket(first, sizeof(first), stream);
+    size_t size = firstSize + buildPacket(second, sizeof(second), stream + firstSize);
+    VescPacketFramer framer;
+    TEST_ASSERT_EQUAL(firstSize, framer.feed(stream, size));
+    TEST_ASSERT_TRUE(framer.complete());
+    TEST_ASSERT_EQUAL(1, framer.length());
+    TEST_ASSERT_EQUAL(size - firstSize, framer.feed(stream + firstSize, size - firstSize));
+    TEST_ASSERT_TRUE(framer.complete());
+    TEST_ASSERT_EQUAL_MEMORY(second, framer.payload(), sizeof(second));
+    TEST_ASSERT_EQUAL(2, framer.packets);
+}
+
+void testFramerBadTerminator() {
+    const uint8_t payload[] = {4, 1, 2, 3};
+    uint8_t packet[16];
+    size_t size = buildPacket(payload, sizeof(payload), packet);
+    packet[size - 1] = 0x04;
+    VescPacketFramer framer;
+    TEST_ASSERT_EQUAL(size, framer.feed(packet, size));
+    TEST_ASSERT_FALSE(framer.complete());
+    TEST_ASSERT_FALSE(framer.receiving());
+    TEST_ASSERT_EQUAL(0, framer.packets);
+    TEST_ASSERT_EQUAL(1, framer.framingErrors);
+    // the bad end byte is looked at again as a possible start byte
+    TEST_ASSERT_EQUAL(1, framer.skippedBytes);
+}
+
+void testFramerBadChecksum() {
+    const uint8_t payload[] = {4, 1, 2, 3};
+    uint8_t packet[16];
+    size_t size = buildPacket(payload, sizeof(payload), packet);
+    packet[size - 2] ^= 0x01;
+    VescPacketFramer framer;
+    TEST_ASSERT_EQUAL(size, framer.feed(packet, size));
+    TEST_ASSERT_FALSE(framer.complete());
+    TEST_ASSERT_EQUAL(1, framer.crcErrors);
+    TEST_ASSERT_EQUAL(0, framer.packets);
+}
+
+void testFramerLengthOverLimit() {
+    const uint16_t length = VESC_PACKET_MAX_PAYLOAD + 1;
+    const uint8_t header[] = {0x03, length >> 8, length & 0xFF};
+    VescPacketFramer framer;
+    TEST_ASSERT_EQUAL(sizeof(header), framer.feed(header, sizeof(header)));
+    TEST_ASSERT_FALSE(framer.receiving());
+    TEST_ASSERT_EQUAL(1, framer.framingErrors);
+
+    const uint8_t empty[] = {0x02, 0x00};
+    TEST_ASSERT_EQUAL(sizeof(empty), framer.feed(empty, sizeof(empty)));
+    TEST_ASSERT_FALSE(framer.receiving());
+    TEST_ASSERT_EQUAL(2, framer.framingErrors);
+}
+
+// whatever came before, the next valid packet is found again
+void testFramerResyncAfterGarbage() {
+    const uint8_t payload[] = {50, 0, 0, 135, 195};
+    const uint8_t garbage[] = {0xFF, 0x00, 0x42, 0x02, 0x00, 0x11, 0x03, 0xFF, 0xFF};
+    uint8_t stream[64];
+    memcpy(stream, garbage, sizeof(garbage));
+    size_t size = sizeof(garbage) + buildPacket(payload, sizeof(payload), stream + sizeof(garbage));
+    VescPacketFramer framer;
+    size_t used = 0;
+    while (used < size && !framer.complete()) {
+        used += framer.feed(stream + used, size - used);
+    }
+    TEST_ASSERT_EQUAL(size, used);
+    TEST_ASSERT_TRUE(framer.complete());
+    TEST_ASSERT_EQUAL(sizeof(payload), framer.length());
+    TEST_ASSERT_EQUAL_MEMORY(payload, framer.payload(), sizeof(payload));
+    TEST_ASSERT_EQUAL(1, framer.packets);
+    TEST_ASSERT_GREATER_THAN(0, framer.framingErrors);
+    TEST_ASSERT_GREATER_THAN(0, framer.skippedBytes);
+}
+
+// a stray long packet header doesn't keep the framer waiting for 4 KB
+void testFramerTimeout() {
+    const uint8_t header[] = {0x03, 0x10, 0x00, 0x01};
+    const uint8_t payload[] = {4};
+    uint8_t packet[8];
+    size_t size = buildPacket(payload, sizeof(payload), packet);
+    VescPacketFramer framer;
+    TEST_ASSERT_EQUAL(sizeof(header), framer.feed(header, sizeof(header), 1000));
+    TEST_ASSERT_FALSE(framer.expire(1000 + VESC_PACKET_TIMEOUT - 1));
+    TEST_ASSERT_TRUE(framer.receiving());
+
+    TEST_ASSERT_EQUAL(size, framer.feed(packet, size, 1000 + VESC_PACKET_TIMEOUT));
+    TEST_ASSERT_TRUE(framer.complete());
+    TEST_ASSERT_EQUAL_MEMORY(payload, framer.payload(), sizeof(payload));
+    TEST_ASSERT_EQUAL(1, framer.timeouts);
+    TEST_ASSERT_FALSE(framer.expire(5000 + VESC_PACKET_TIMEOUT));
+}
+
 int main( int argc, char **argv) {
     UNITY_BEGIN(); // IMPORTANT LINE!
     RUN_TEST(testCommandpingCan);
+    RUN_TEST(testCrc16CheckValue);
+    RUN_TEST(testCrc16UpdateInCanFrames);
+    RUN_TEST(testCrc16KeepsUpWithCan);
+    RUN_TEST(testFramerShortPacket);
+    RUN_TEST(testFramerLongPacket);
+    RUN_TEST(testFramerPacketSplitAtEveryByte);
+    RUN_TEST(testFramerConsecutivePackets);
+    RUN_TEST(testFramerBadTerminator);
+    RUN_TEST(testFramerBadChecksum);
+    RUN_TEST(testFramerLengthOverLimit);
+    RUN_TEST(testFramerResyncAfterGarbage);
+    RUN_TEST(testFramerTimeout);
     UNITY_END(); // stop unit testing
     return 0;
 }